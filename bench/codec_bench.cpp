@@ -0,0 +1,154 @@
+// Size and speed of JSON vs CBOR vs MessagePack on recurrency data.
+//
+//   make bench && ./codec_bench [db file] [iterations]
+//
+// With a db file (any of the three formats) it measures that; otherwise a
+// synthetic household of users with long event histories. Every encoding is
+// round-tripped and compared against the original before it is timed.
+#include "codec.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+static json synthetic_user(int i, long long now) {
+    return {
+        {"name", "User" + std::to_string(i)}, {"password", "hunter" + std::to_string(i)},
+        {"vice", "Doomscrolling"}, {"target_interval_days", 7.0},
+        {"virtue1_name", "Gym"}, {"promised_v1_weekly", 3.0},
+        {"virtue2_name", "Reading"}, {"promised_v2_weekly", 5.0},
+        {"base_cost", 1296000}, {"max_threshold", 3240000}, {"debt_seconds", 86400 * (i % 9)},
+        {"last_update", now}, {"last_v1", now - 3600}, {"last_v2", now - 7200}, {"lock_time", 0},
+        {"locked", false}, {"streak", i % 4}, {"last_vice", now - 86400 * 3}, {"clean_milestone", 0},
+        {"v_streak", 12}, {"last_v_check", now - 600}, {"tz", "America/Toronto"}
+    };
+}
+
+// Shaped like db.json: users, stats, the capped feed and per-user events
+static json synthetic_db(int users, int events_per_user) {
+    long long now = 1760000000;
+    json db = {{"users", json::object()}, {"stats", json::object()}, {"logs", json::array()}, {"events", json::object()}};
+    long long log_id = 0;
+    for (int i = 0; i < users; i++) {
+        std::string id = "user" + std::to_string(i);
+        json user = synthetic_user(i, now);
+        db["users"][id] = user;
+
+        json weeks = json::object();
+        for (int w = 0; w < 52; w++) weeks[std::to_string(2900 + w)] = {w % 3, w % 5, w % 7};
+        db["stats"][user["name"].get<std::string>()] = {
+            {"weeks", weeks}, {"months", json::object()}, {"debt_sum", 123456789LL}, {"debt_samples", 4242},
+            {"clean_episodes", 17}, {"clean_seconds", 9876543}, {"bankruptcies", 1},
+            {"episode", {true, now - 500000, false, now, 86400}}
+        };
+
+        json stream = json::array();
+        json genesis = user;
+        genesis["password"] = "";
+        stream.push_back({{"e", "genesis"}, {"ts", now - 86400LL * events_per_user}, {"state", genesis}});
+        for (int e = 0; e < events_per_user; e++) {
+            long long ts = now - 86400LL * (events_per_user - e);
+            if (e % 7 == 0) stream.push_back({{"e", "vice"}, {"ts", ts}, {"logs", {++log_id}}});
+            else stream.push_back({{"e", "virtue"}, {"ts", ts}, {"n", 1 + e % 2}, {"logs", {++log_id}}});
+        }
+        db["events"][id] = stream;
+    }
+    for (int l = 0; l < 100; l++) {
+        db["logs"].push_back({{"id", log_id - l}, {"user", "User" + std::to_string(l % users)}, {"action", "virtue1"},
+                              {"msg", "Completed: Gym (-1d)"}, {"ts", now - l * 3600}, {"col", "#2196F3"},
+                              {"delta", -86400}, {"snap", 172800}});
+    }
+    return db;
+}
+
+// The records the storage layer writes one by one
+static std::vector<json> records(const json& db) {
+    std::vector<json> out;
+    for (const char* section : {"users", "stats"}) {
+        if (db.contains(section)) for (const auto& v : db[section]) out.push_back(v);
+    }
+    if (db.contains("logs")) for (const auto& v : db["logs"]) out.push_back(v);
+    if (db.contains("events")) {
+        for (const auto& stream : db["events"]) for (const auto& v : stream) out.push_back(v);
+    }
+    return out;
+}
+
+static double time_us(int iterations, const std::function<void()>& fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+}
+
+struct Row {
+    const char* name;
+    std::function<std::string(const json&)> enc;
+};
+
+static bool report(const char* title, const std::vector<json>& values, int iterations) {
+    std::vector<Row> rows = {
+        {"json (pretty)", [](const json& j) { return j.dump(4); }},
+        {"json", [](const json& j) { return encode(j, Encoding::Json); }},
+        {"cbor", [](const json& j) { return encode(j, Encoding::Cbor); }},
+        {"msgpack", [](const json& j) { return encode(j, Encoding::MsgPack); }},
+    };
+    std::printf("\n%s (%zu value%s)\n", title, values.size(), values.size() == 1 ? "" : "s");
+    std::printf("  %-14s %12s %8s %12s %12s\n", "encoding", "bytes", "vs json", "encode us", "decode us");
+    size_t baseline = 0;
+    for (const auto& v : values) baseline += encode(v, Encoding::Json).size();
+    bool ok = true;
+    for (const Row& row : rows) {
+        std::vector<std::string> encoded;
+        size_t bytes = 0;
+        for (const auto& v : values) {
+            encoded.push_back(row.enc(v));
+            bytes += encoded.back().size();
+            if (decode_object(encoded.back()) != v) {
+                std::printf("  %s: round trip changed the value\n", row.name);
+                ok = false;
+            }
+        }
+        double enc_us = time_us(iterations, [&] {
+            for (const auto& v : values) row.enc(v);
+        });
+        double dec_us = time_us(iterations, [&] {
+            for (const auto& e : encoded) decode_object(e);
+        });
+        std::printf("  %-14s %12zu %7.0f%% %12.1f %12.1f\n", row.name, bytes, 100.0 * bytes / baseline, enc_us, dec_us);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    json db;
+    if (argc > 1) {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in.is_open()) {
+            std::fprintf(stderr, "can't open %s\n", argv[1]);
+            return 1;
+        }
+        std::stringstream image;
+        image << in.rdbuf();
+        db = decode_object(image.str());
+        std::printf("database: %s\n", argv[1]);
+    } else {
+        db = synthetic_db(20, 500);
+        std::printf("database: synthetic, 20 users x 500 events\n");
+    }
+    int iterations = argc > 2 ? std::max(1, std::atoi(argv[2])) : 20;
+
+    bool ok = report("whole db file", {db}, iterations);
+    ok &= report("storage records", records(db), iterations);
+    if (db.contains("users") && !db["users"].empty()) {
+        ok &= report("one user record (a typical point update or API body)", {db["users"].begin().value()}, iterations * 100);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+// Representative traffic against a running server: a household signs up,
+// then every connection loops over a weighted mix of dashboards, API reads,
+// leaderboards and actions. Used for throughput numbers and as the PGO
+// training run (see bench/pgo_train.sh).
+//
+//   ./loadgen [host:port] [seconds] [connections] [users]
+//
+// Start the server with generous RATE_* limits or most requests are shed.
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct Target {
+    std::string host = "127.0.0.1";
+    int port = 18080;
+};
+
+// One keep-alive HTTP/1.1 connection; reconnects when the server closes it
+class Conn {
+public:
+    explicit Conn(const Target& t) : target(t) {}
+    ~Conn() { close_fd(); }
+
+    // Status code, or -1 on a transport error
+    int request(const std::string& method, const std::string& path, const std::string& cookie,
+                const std::string& body = "") {
+        std::string req = method + " " + path + " HTTP/1.1\r\nHost: " + target.host + "\r\n";
+        if (!cookie.empty()) req += "Cookie: user=" + cookie + "\r\n";
+        if (!body.empty() || method == "POST") {
+            req += "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+        req += "\r\n" + body;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (fd < 0 && !open_fd()) return -1;
+            int status = exchange(req);
+            if (status > 0) return status;
+            close_fd();
+        }
+        return -1;
+    }
+
+private:
+    bool open_fd() {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)target.port);
+        ::inet_pton(AF_INET, target.host.c_str(), &addr.sin_addr);
+        if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            close_fd();
+            return false;
+        }
+        return true;
+    }
+
+    void close_fd() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        buf.clear();
+    }
+
+    int exchange(const std::string& req) {
+        for (size_t off = 0; off < req.size();) {
+            ssize_t n = ::send(fd, req.data() + off, req.size() - off, MSG_NOSIGNAL);
+            if (n <= 0) return -1;
+            off += (size_t)n;
+        }
+        size_t header_end;
+        while ((header_end = buf.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) return -1;
+        }
+        int status = std::atoi(buf.c_str() + buf.find(' ') + 1);
+        std::string headers = buf.substr(0, header_end);
+        for (char& c : headers) c = (char)std::tolower((unsigned char)c);
+        size_t length = 0;
+        size_t cl = headers.find("content-length:");
+        if (cl != std::string::npos) length = std::strtoul(headers.c_str() + cl + 15, nullptr, 10);
+        bool closing = headers.find("connection: close") != std::string::npos;
+        while (buf.size() < header_end + 4 + length) {
+            if (!fill()) return -1;
+        }
+        buf.erase(0, header_end + 4 + length);
+        if (closing) close_fd();
+        return status;
+    }
+
+    bool fill() {
+        char chunk[16384];
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buf.append(chunk, (size_t)n);
+        return true;
+    }
+
+    Target target;
+    int fd = -1;
+    std::string buf;
+};
+
+struct Step {
+    int weight;
+    const char* method;
+    const char* path; // {me} / {other} are user ids
+};
+
+// Roughly what a household does: mostly looking, sometimes acting
+static const Step MIX[] = {
+    {40, "GET", "/"},
+    {10, "GET", "/api/chart"},
+    {8, "GET", "/api/insights"},
+    {6, "GET", "/insights"},
+    {6, "GET", "/leaderboard"},
+    {5, "GET", "/api/leaderboard?board=virtues"},
+    {5, "GET", "/api/debt_at"},
+    {4, "GET", "/api/feed"},
+    {4, "GET", "/edit"},
+    {6, "GET", "/virtue/1?name={me}"},
+    {4, "GET", "/virtue/2?name={me}"},
+    {3, "GET", "/vice?name={me}"},
+    {1, "GET", "/reset?name={other}"},
+    {1, "GET", "/undo"},
+    {1, "GET", "/login"},
+};
+
+static std::string expand(const char* path, const std::string& me, const std::string& other) {
+    std::string s = path;
+    for (auto [tag, value] : {std::make_pair("{me}", &me), std::make_pair("{other}", &other)}) {
+        size_t at = s.find(tag);
+        if (at != std::string::npos) s.replace(at, std::strlen(tag), *value);
+    }
+    return s;
+}
+
+int main(int argc, char** argv) {
+    Target target;
+    if (argc > 1) {
+        std::string hp = argv[1];
+        size_t colon = hp.rfind(':');
+        if (colon != std::string::npos) {
+            target.host = hp.substr(0, colon);
+            target.port = std::atoi(hp.c_str() + colon + 1);
+        }
+    }
+    double seconds = argc > 2 ? std::atof(argv[2]) : 10;
+    int connections = argc > 3 ? std::max(1, std::atoi(argv[3])) : 8;
+    int users = argc > 4 ? std::max(2, std::atoi(argv[4])) : 12;
+
+    {
+        Conn setup(target);
+        for (int i = 0; i < users; i++) {
+            std::string name = "load" + std::to_string(i);
+            std::string body = "name=" + name + "&password=pw&vice=Snacks&vice_freq=2&vice_per=7"
+                               "&v1name=Gym&v1_freq=3&v1_per=7&v2name=Read&v2_freq=5&v2_per=7&tz=Europe%2FBerlin";
+            if (setup.request("POST", "/signup", "", body) < 0) {
+                std::fprintf(stderr, "can't reach %s:%d\n", target.host.c_str(), target.port);
+                return 1;
+            }
+        }
+    }
+
+    int total_weight = 0;
+    for (const Step& s : MIX) total_weight += s.weight;
+
+    std::atomic<bool> stop{false};
+    std::mutex mtx;
+    std::vector<uint32_t> latencies_us;
+    std::map<int, uint64_t> statuses;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < connections; c++) {
+        threads.emplace_back([&, c] {
+            Conn conn(target);
+            std::mt19937 rng(1234 + c);
+            std::vector<uint32_t> lat;
+            std::map<int, uint64_t> st;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::string me = "load" + std::to_string(rng() % users);
+                std::string other = "load" + std::to_string(rng() % users);
+                int pick = (int)(rng() % total_weight);
+                const Step* step = MIX;
+                while (pick >= step->weight) pick -= (step++)->weight;
+                auto t0 = std::chrono::steady_clock::now();
+                int status = conn.request(step->method, expand(step->path, me, other), me);
+                auto t1 = std::chrono::steady_clock::now();
+                lat.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count());
+                st[status]++;
+                if (status < 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            latencies_us.insert(latencies_us.end(), lat.begin(), lat.end());
+            for (auto [code, n] : st) statuses[code] += n;
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    auto pct = [&](double p) {
+        return latencies_us.empty() ? 0.0 : latencies_us[(size_t)(p * (latencies_us.size() - 1))] / 1000.0;
+    };
+    std::printf("requests %zu in %.1fs: %.0f req/s, p50 %.2f ms, p99 %.2f ms, statuses",
+                latencies_us.size(), elapsed, latencies_us.size() / elapsed, pct(0.5), pct(0.99));
+    for (auto [code, n] : statuses) std::printf(" %d:%llu", code, (unsigned long long)n);
+    std::printf("\n");
+    return statuses.count(-1) ? 1 : 0;
+}
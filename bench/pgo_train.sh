@@ -0,0 +1,35 @@
+#!/bin/sh
+# PGO training run: starts an instrumented server on a scratch database,
+# drives the loadgen mix through it, then stops it with SIGTERM so the
+# profile is written on the way out.
+#
+#   bench/pgo_train.sh <server> <loadgen> [seconds]
+set -e
+server=$1
+loadgen=$2
+seconds=${3:-20}
+port=${PGO_PORT:-18199}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+env DB_PATH="$dir/db.json" PORT="$port" \
+    RATE_READ_PER_MIN=1e9 RATE_READ_BURST=1e9 RATE_WRITE_PER_MIN=1e9 RATE_WRITE_BURST=1e9 \
+    RATE_GLOBAL_WRITE_PER_MIN=1e9 RATE_GLOBAL_WRITE_BURST=1e9 MAX_INFLIGHT=100000 \
+    "$server" > "$dir/server.log" 2>&1 &
+pid=$!
+
+tries=0
+until "$loadgen" "127.0.0.1:$port" 0.1 1 2 > /dev/null 2>&1; do
+    tries=$((tries + 1))
+    if [ "$tries" -ge 50 ] || ! kill -0 "$pid" 2> /dev/null; then
+        echo "pgo_train: server did not come up" >&2
+        cat "$dir/server.log" >&2
+        kill "$pid" 2> /dev/null || true
+        exit 1
+    fi
+    sleep 0.2
+done
+
+"$loadgen" "127.0.0.1:$port" "$seconds" 8 12
+kill -TERM "$pid"
+wait "$pid"
@@ -0,0 +1,250 @@
+// Sends a capture (CAPTURE_PATH, see src/capture.h) to a running server
+// again and reports what it cost, to compare builds on real traffic.
+//
+//   ./replay <capture> [host:port] [--fast] [--speed X] [--connections N] [--summary]
+//
+// Start the server on the database the capture was made against
+// (RESTORE_FROM=<capture>.backup with a fresh DB_PATH) and generous RATE_*
+// limits, or let bench/replay.sh do it. Each user's requests go down one
+// connection in their captured order, so every user sees the same sequence
+// of states; logged-out requests are spread over the connections. Paced
+// (the default) sends each request at its captured offset, divided by
+// --speed; --fast sends the next as soon as the last is answered.
+#include "capture.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct Target {
+    std::string host = "127.0.0.1";
+    int port = 18080;
+};
+
+// One keep-alive HTTP/1.1 connection; reconnects when the server closes it
+class Conn {
+public:
+    explicit Conn(const Target& t) : target(t) {}
+    ~Conn() { close_fd(); }
+
+    // Status code, or -1 on a transport error
+    int request(const CapturedRequest& r) {
+        std::string req = r.method + " " + r.target + " HTTP/1.1\r\nHost: " + target.host + "\r\n";
+        if (!r.user.empty()) req += "Cookie: user=" + r.user + "\r\n";
+        if (!r.content_type.empty()) req += "Content-Type: " + r.content_type + "\r\n";
+        if (!r.body.empty() || r.method == "POST") req += "Content-Length: " + std::to_string(r.body.size()) + "\r\n";
+        req += "\r\n" + r.body;
+        // A connection the server has closed fails on first use; a fresh one
+        // failing means the request may have been seen, so it isn't resent
+        for (int attempt = 0; attempt < 2; attempt++) {
+            bool fresh = fd < 0;
+            if (fresh && !open_fd()) return -1;
+            int status = exchange(req);
+            if (status > 0) return status;
+            close_fd();
+            if (fresh) break;
+        }
+        return -1;
+    }
+
+    bool open_fd() {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)target.port);
+        ::inet_pton(AF_INET, target.host.c_str(), &addr.sin_addr);
+        if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            close_fd();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void close_fd() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        buf.clear();
+    }
+
+    int exchange(const std::string& req) {
+        for (size_t off = 0; off < req.size();) {
+            ssize_t n = ::send(fd, req.data() + off, req.size() - off, MSG_NOSIGNAL);
+            if (n <= 0) return -1;
+            off += (size_t)n;
+        }
+        size_t header_end;
+        while ((header_end = buf.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) return -1;
+        }
+        int status = std::atoi(buf.c_str() + buf.find(' ') + 1);
+        std::string headers = buf.substr(0, header_end);
+        for (char& c : headers) c = (char)std::tolower((unsigned char)c);
+        size_t length = 0;
+        size_t cl = headers.find("content-length:");
+        if (cl != std::string::npos) length = std::strtoul(headers.c_str() + cl + 15, nullptr, 10);
+        bool closing = headers.find("connection: close") != std::string::npos;
+        while (buf.size() < header_end + 4 + length) {
+            if (!fill()) return -1;
+        }
+        buf.erase(0, header_end + 4 + length);
+        if (closing) close_fd();
+        return status;
+    }
+
+    bool fill() {
+        char chunk[16384];
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buf.append(chunk, (size_t)n);
+        return true;
+    }
+
+    Target target;
+    int fd = -1;
+    std::string buf;
+};
+
+struct Result {
+    uint32_t latency_us = 0;
+    int status = 0;
+    int64_t lag_us = 0; // Sent this late against the captured pacing
+};
+
+static double pct_ms(std::vector<uint32_t>& v, double p) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    return v[(size_t)(p * (v.size() - 1))] / 1000.0;
+}
+
+static std::string route_of(const CapturedRequest& r) {
+    return r.method + " " + r.target.substr(0, r.target.find('?'));
+}
+
+int main(int argc, char** argv) {
+    std::string path;
+    Target target;
+    bool fast = false, summary = false;
+    double speed = 1.0;
+    int connections = 8;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--fast") fast = true;
+        else if (a == "--summary") summary = true;
+        else if (a == "--speed" && i + 1 < argc) speed = std::max(0.001, std::atof(argv[++i]));
+        else if (a == "--connections" && i + 1 < argc) connections = std::max(1, std::atoi(argv[++i]));
+        else if (path.empty()) path = a;
+        else {
+            size_t colon = a.rfind(':');
+            target.host = a.substr(0, colon);
+            if (colon != std::string::npos) target.port = std::atoi(a.c_str() + colon + 1);
+        }
+    }
+    if (path.empty()) {
+        std::fprintf(stderr, "usage: replay <capture> [host:port] [--fast] [--speed X] [--connections N] [--summary]\n");
+        return 2;
+    }
+
+    std::vector<CapturedRequest> recs;
+    try {
+        recs = read_capture(path);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    // The server may still be starting (bench/replay.sh doesn't wait)
+    for (int i = 0;; i++) {
+        Conn probe(target);
+        if (probe.open_fd()) break;
+        if (i == 100) {
+            std::fprintf(stderr, "can't reach %s:%d\n", target.host.c_str(), target.port);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    std::vector<std::vector<size_t>> queues(connections);
+    std::hash<std::string> hasher;
+    for (size_t i = 0; i < recs.size(); i++) {
+        size_t c = recs[i].user.empty() ? i % connections : hasher(recs[i].user) % connections;
+        queues[c].push_back(i);
+    }
+
+    std::vector<Result> results(recs.size());
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < connections; c++) {
+        threads.emplace_back([&, c] {
+            Conn conn(target);
+            for (size_t i : queues[c]) {
+                auto due = start + std::chrono::microseconds((int64_t)(recs[i].arrival_us / speed));
+                if (!fast) std::this_thread::sleep_until(due);
+                auto t0 = std::chrono::steady_clock::now();
+                int status = conn.request(recs[i]);
+                auto t1 = std::chrono::steady_clock::now();
+                results[i].status = status;
+                results[i].latency_us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+                results[i].lag_us = fast ? 0 : std::chrono::duration_cast<std::chrono::microseconds>(t0 - due).count();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint32_t> all;
+    std::map<int, uint64_t> statuses;
+    std::map<std::string, std::pair<std::vector<uint32_t>, std::vector<uint32_t>>> routes; // Replayed, captured
+    uint64_t differ = 0;
+    int64_t max_lag_us = 0;
+    for (size_t i = 0; i < recs.size(); i++) {
+        const Result& r = results[i];
+        all.push_back(r.latency_us);
+        statuses[r.status]++;
+        differ += r.status != (int)recs[i].status;
+        max_lag_us = std::max(max_lag_us, r.lag_us);
+        auto& route = routes[route_of(recs[i])];
+        route.first.push_back(r.latency_us);
+        route.second.push_back((uint32_t)std::min<uint64_t>(recs[i].duration_us, UINT32_MAX));
+    }
+
+    std::printf("requests %zu in %.1fs (%s): %.0f req/s, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms, "
+                "statuses", all.size(), elapsed, fast ? "fast" : "paced", all.size() / elapsed,
+                pct_ms(all, 0.5), pct_ms(all, 0.9), pct_ms(all, 0.99), pct_ms(all, 1.0));
+    for (auto [code, n] : statuses) std::printf(" %d:%llu", code, (unsigned long long)n);
+    std::printf(", %llu differ from capture", (unsigned long long)differ);
+    if (!fast) std::printf(", max lag %.1f ms", max_lag_us / 1000.0);
+    std::printf("\n");
+
+    if (!summary) {
+        // Replayed times are seen by the client; captured ones are the
+        // recording server's own handling time, for scale
+        std::vector<std::pair<size_t, std::string>> by_count;
+        for (auto& [name, lat] : routes) by_count.push_back({lat.first.size(), name});
+        std::sort(by_count.rbegin(), by_count.rend());
+        std::printf("%-32s %8s %9s %9s %9s   %9s %9s\n", "route", "count", "p50 ms", "p99 ms", "max ms", "capt p50", "capt p99");
+        for (auto& [count, name] : by_count) {
+            auto& [replayed, captured] = routes[name];
+            std::printf("%-32s %8zu %9.2f %9.2f %9.2f   %9.2f %9.2f\n", name.substr(0, 32).c_str(), count,
+                        pct_ms(replayed, 0.5), pct_ms(replayed, 0.99), pct_ms(replayed, 1.0),
+                        pct_ms(captured, 0.5), pct_ms(captured, 0.99));
+        }
+    }
+    return statuses.count(-1) ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# One capture (CAPTURE_PATH, see "TRAFFIC CAPTURE" in src/main.cpp) against
+# each build in turn: every server starts from the capture's snapshot in a
+# fresh directory, takes the same requests, and is stopped again.
+#
+#   bench/replay.sh <replay> <capture> <server>...
+#
+# REPLAY_ARGS is passed on (e.g. "--fast", "--speed 10").
+set -e
+replay=$1
+capture=$2
+shift 2
+port=${BENCH_PORT:-18199}
+
+for server in "$@"; do
+    dir=$(mktemp -d)
+    env DB_PATH="$dir/db.json" PORT="$port" RESTORE_FROM="$capture.backup" \
+        RATE_READ_PER_MIN=1e9 RATE_READ_BURST=1e9 RATE_WRITE_PER_MIN=1e9 RATE_WRITE_BURST=1e9 \
+        RATE_GLOBAL_WRITE_PER_MIN=1e9 RATE_GLOBAL_WRITE_BURST=1e9 MAX_INFLIGHT=100000 \
+        "$server" > "$dir/server.log" 2>&1 &
+    pid=$!
+    printf '%-28s ' "$server"
+    "$replay" "$capture" "127.0.0.1:$port" --summary $REPLAY_ARGS || true
+    kill -TERM "$pid"
+    wait "$pid" || true
+    rm -rf "$dir"
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+# The loadgen mix against one process, then against PROCESSES=1..N readers
+# behind a writer (see "PROCESSES" in src/main.cpp).
+#
+#   bench/scaling.sh <loadgen> <server> [max processes]
+set -e
+loadgen=$1
+server=$2
+max=${3:-$(nproc)}
+seconds=${SECONDS_PER_RUN:-15}
+port=${BENCH_PORT:-18198}
+connections=${CONNECTIONS:-8}
+
+run() {
+    label=$1
+    processes=$2
+    dir=$(mktemp -d)
+    env DB_PATH="$dir/db.json" PORT="$port" PROCESSES="$processes" \
+        RATE_READ_PER_MIN=1e9 RATE_READ_BURST=1e9 RATE_WRITE_PER_MIN=1e9 RATE_WRITE_BURST=1e9 \
+        RATE_GLOBAL_WRITE_PER_MIN=1e9 RATE_GLOBAL_WRITE_BURST=1e9 MAX_INFLIGHT=100000 \
+        "$server" > "$dir/server.log" 2>&1 &
+    pid=$!
+    until "$loadgen" "127.0.0.1:$port" 0.1 1 2 > /dev/null 2>&1; do sleep 0.2; done
+    "$loadgen" "127.0.0.1:$port" 2 8 12 > /dev/null # warm up
+    printf '%-28s ' "$label"
+    "$loadgen" "127.0.0.1:$port" "$seconds" "$connections" 12
+    kill -TERM "$pid"
+    wait "$pid" || true
+    rm -rf "$dir"
+}
+
+run "single process" 0
+n=1
+while [ "$n" -le "$max" ]; do
+    run "writer + $n reader(s)" "$n"
+    n=$((n + 1))
+done
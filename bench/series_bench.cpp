@@ -0,0 +1,123 @@
+// Bytes per point and decode speed of the debt history encoding.
+//
+//   make bench && ./series_bench [users] [points per user] [iterations]
+//
+// Histories are simulated with the live rules (decay, relapse cost,
+// bankruptcy and bailout), with irregular gaps between actions, and
+// compared against the same three fields as the feed stores them in JSON.
+// Every series is decoded and compared against what went in before it is
+// timed.
+#include "debt_history.h"
+#include "json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+using json = nlohmann::json;
+
+static std::vector<DebtPoint> simulate(unsigned seed, size_t n) {
+    const long long base_cost = 1296000, reward = 86400, threshold = base_cost * 5 / 2;
+    std::mt19937_64 rng(seed);
+    std::exponential_distribution<double> gap(1.0 / 30000); // About one action every 8 hours
+    std::uniform_real_distribution<double> roll(0, 1);
+
+    std::vector<DebtPoint> out;
+    time_t ts = 1700000000;
+    long long debt = 0;
+    bool locked = false;
+    while (out.size() < n) {
+        time_t next = ts + 60 + (time_t)gap(rng);
+        if (!locked) debt = std::max(0LL, debt - (long long)(next - ts));
+        ts = next;
+        long long before = debt;
+        if (locked) {
+            if (roll(rng) < 0.2) {
+                debt = base_cost / 2;
+                locked = false;
+                out.push_back({ts, 0, debt}); // Bailout
+            }
+            continue;
+        }
+        if (roll(rng) < 0.12) {
+            debt += debt > 0 ? base_cost * 3 / 2 : base_cost;
+            locked = debt > threshold;
+        } else {
+            debt -= std::min(reward, debt);
+        }
+        out.push_back({ts, debt - before, debt});
+    }
+    return out;
+}
+
+static double time_us(int iterations, const std::function<void()>& fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+}
+
+static bool same(const DebtPoint& a, const DebtPoint& b) {
+    return a.ts == b.ts && a.delta == b.delta && a.snapshot == b.snapshot;
+}
+
+int main(int argc, char** argv) {
+    int users = argc > 1 ? std::max(1, std::atoi(argv[1])) : 20;
+    size_t per_user = argc > 2 ? (size_t)std::max(1, std::atoi(argv[2])) : 5000;
+    int iterations = argc > 3 ? std::max(1, std::atoi(argv[3])) : 20;
+
+    std::vector<std::vector<DebtPoint>> raw;
+    std::vector<DebtSeries> series(users);
+    size_t json_bytes = 0, encoded = 0, points = 0;
+    bool ok = true;
+    for (int u = 0; u < users; u++) {
+        raw.push_back(simulate(u + 1, per_user));
+        for (const DebtPoint& p : raw.back()) {
+            series[u].append(p);
+            json_bytes += json{{"ts", p.ts}, {"delta", p.delta}, {"snap", p.snapshot}}.dump().size();
+        }
+        encoded += series[u].bytes();
+        points += raw.back().size();
+
+        // Through the stored form and back, then undo down to an odd length
+        DebtSeries reloaded;
+        for (size_t b = 0; b < series[u].block_count(); b++) reloaded.load_block(series[u].block(b));
+        std::vector<DebtPoint> back = reloaded.points();
+        ok &= back.size() == raw.back().size() && std::equal(back.begin(), back.end(), raw.back().begin(), same);
+        for (int k = 0; k < 77; k++) reloaded.pop();
+        back = reloaded.points();
+        ok &= back.size() == raw.back().size() - 77 && std::equal(back.begin(), back.end(), raw.back().begin(), same);
+    }
+    if (!ok) {
+        std::printf("round trip changed the series\n");
+        return 1;
+    }
+
+    std::printf("%d users x %zu points, %zu points per block\n", users, per_user, BLOCK_POINTS);
+    std::printf("  %-26s %12s %10s\n", "form", "bytes", "per point");
+    std::printf("  %-26s %12zu %10.1f\n", "json {ts, delta, snap}", json_bytes, (double)json_bytes / points);
+    std::printf("  %-26s %12zu %10.1f\n", "raw 3 x int64", points * 24, 24.0);
+    std::printf("  %-26s %12zu %10.2f\n", "debt history blocks", encoded, (double)encoded / points);
+
+    size_t sink = 0;
+    double all_us = time_us(iterations, [&] {
+        for (const DebtSeries& s : series) sink += s.points().size();
+    });
+    // The last 30 days of each history
+    time_t to = raw[0].back().ts + 1, from = to - 30 * 86400;
+    size_t window = series[0].points(from, to).size();
+    double range_us = time_us(iterations * 100, [&] { sink += series[0].points(from, to).size(); });
+    double append_us = time_us(iterations, [&] {
+        DebtSeries s;
+        for (const DebtPoint& p : raw[0]) s.append(p);
+        sink += s.size();
+    });
+
+    std::printf("\n  full decode    %10.1f us  %8.1f M points/s\n", all_us, points / all_us);
+    std::printf("  last 30 days   %10.2f us  (%zu of %zu points, one user)\n", range_us, window, per_user);
+    std::printf("  append         %10.3f us per point\n", append_us / per_user);
+    return sink ? 0 : 1;
+}
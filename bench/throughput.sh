@@ -0,0 +1,26 @@
+#!/bin/sh
+# Same loadgen mix against each server binary in turn, one at a time.
+#
+#   bench/throughput.sh <loadgen> <server>...
+set -e
+loadgen=$1
+shift
+seconds=${SECONDS_PER_RUN:-15}
+port=${BENCH_PORT:-18198}
+connections=${CONNECTIONS:-8}
+
+for server in "$@"; do
+    dir=$(mktemp -d)
+    env DB_PATH="$dir/db.json" PORT="$port" \
+        RATE_READ_PER_MIN=1e9 RATE_READ_BURST=1e9 RATE_WRITE_PER_MIN=1e9 RATE_WRITE_BURST=1e9 \
+        RATE_GLOBAL_WRITE_PER_MIN=1e9 RATE_GLOBAL_WRITE_BURST=1e9 MAX_INFLIGHT=100000 \
+        "$server" > "$dir/server.log" 2>&1 &
+    pid=$!
+    until "$loadgen" "127.0.0.1:$port" 0.1 1 2 > /dev/null 2>&1; do sleep 0.2; done
+    "$loadgen" "127.0.0.1:$port" 2 8 12 > /dev/null # warm up
+    printf '%-28s ' "$server"
+    "$loadgen" "127.0.0.1:$port" "$seconds" "$connections" 12
+    kill -TERM "$pid"
+    wait "$pid" || true
+    rm -rf "$dir"
+done
@@ -0,0 +1,92 @@
+#include "activity_feed.h"
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+// Every atomic here is sequentially consistent: a reader's epoch announce
+// and its slot loads must not be reordered against a writer's slot store
+// and its scan of the reader table, or an entry could be freed mid-read.
+
+ActivityFeed::~ActivityFeed() {
+    for (auto& slot : slots) delete slot.load();
+    for (auto& [tag, e] : retired) delete e;
+}
+
+ActivityFeed::Snapshot::Snapshot(const ActivityFeed& feed) : reader(feed.pin()), feed(feed) {
+    uint64_t h = feed.head.load();
+    uint64_t from = h > FEED_SIZE ? h - FEED_SIZE : 0;
+    for (uint64_t s = h; s-- > from;) {
+        const Entry* e = feed.slots[s % FEED_SIZE].load();
+        // A tombstone, or already replaced by an entry newer than this snapshot
+        if (e && e->seq == s) entries[count++] = &e->log;
+    }
+}
+
+ActivityFeed::Snapshot::~Snapshot() {
+    feed.unpin(reader);
+}
+
+int ActivityFeed::pin() const {
+    static thread_local int hint = 0;
+    while (true) {
+        for (int i = 0; i < MAX_READERS; i++) {
+            int r = (hint + i) % MAX_READERS;
+            uint64_t idle = 0;
+            if (readers[r].epoch.compare_exchange_strong(idle, epoch.load())) {
+                hint = r;
+                return r;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void ActivityFeed::unpin(int reader) const {
+    readers[reader].epoch.store(0);
+}
+
+void ActivityFeed::append(ActivityLog log) {
+    uint64_t s = head.load();
+    newest_id = std::max(newest_id, log.id);
+    const Entry* old = slots[s % FEED_SIZE].exchange(new Entry{s, std::move(log)});
+    head.store(s + 1);
+    if (old) retire(old);
+    reclaim();
+}
+
+std::optional<ActivityLog> ActivityFeed::remove(long long id) {
+    for (auto& slot : slots) {
+        const Entry* e = slot.load();
+        if (!e || e->log.id != id) continue;
+        slot.store(nullptr);
+        ActivityLog removed = e->log;
+        retire(e);
+        reclaim();
+        return removed;
+    }
+    return std::nullopt;
+}
+
+void ActivityFeed::clear() {
+    for (auto& slot : slots) {
+        if (const Entry* e = slot.exchange(nullptr)) retire(e);
+    }
+    newest_id = 0;
+    reclaim();
+}
+
+// Snapshots pinned at or before this epoch may still hold e
+void ActivityFeed::retire(const Entry* e) {
+    retired.push_back({epoch.fetch_add(1), e});
+}
+
+void ActivityFeed::reclaim() {
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (const Reader& r : readers) {
+        uint64_t pinned = r.epoch.load();
+        if (pinned) oldest = std::min(oldest, pinned);
+    }
+    auto keep = std::partition(retired.begin(), retired.end(), [&](const auto& t) { return t.first >= oldest; });
+    for (auto it = keep; it != retired.end(); ++it) delete it->second;
+    retired.erase(keep, retired.end());
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "models.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// --- ACTIVITY FEED ---
+// The household's latest FEED_SIZE entries in a fixed ring. Entries are
+// immutable once written, and each slot holds an atomic pointer to one, so
+// readers never lock: they take a Snapshot, which copies the pointers of
+// the current window and keeps them alive until it goes away. Writers
+// publish with an atomic sequence number and are serialised by their
+// caller, like everything else in Engine. Undo leaves a tombstone (an
+// empty slot) rather than moving anything.
+//
+// Entries that fall off or are taken back are freed once no snapshot that
+// could have seen them is still open (epoch-based reclamation), so a reader
+// on another thread never sees one freed under it. Up to MAX_READERS
+// snapshots can be open at once; one more waits for a free reader slot.
+
+const size_t FEED_SIZE = 100; // Entries kept in the activity feed
+
+class ActivityFeed {
+public:
+    ActivityFeed() = default;
+    ~ActivityFeed();
+    ActivityFeed(const ActivityFeed&) = delete;
+    ActivityFeed& operator=(const ActivityFeed&) = delete;
+
+    // The live entries at the moment it was taken, newest first. Cheap to
+    // take and lock-free; hold it only as long as the render that needs it.
+    class Snapshot {
+    public:
+        ~Snapshot();
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        using const_iterator = std::array<const ActivityLog*, FEED_SIZE>::const_iterator;
+        using const_reverse_iterator = std::array<const ActivityLog*, FEED_SIZE>::const_reverse_iterator;
+        const_iterator begin() const { return entries.begin(); }
+        const_iterator end() const { return entries.begin() + count; }
+        // Oldest first
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        const_reverse_iterator rend() const { return entries.rend(); }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+    private:
+        friend class ActivityFeed;
+        explicit Snapshot(const ActivityFeed& feed);
+        int reader = -1; // Slot in the feed's reader table
+        const ActivityFeed& feed;
+        std::array<const ActivityLog*, FEED_SIZE> entries{};
+        size_t count = 0;
+    };
+
+    Snapshot snapshot() const { return Snapshot(*this); }
+
+    // Writers. Ids must increase; the oldest entry drops off once full.
+    void append(ActivityLog log);
+    // Tombstones the entry with this id. Returns a copy of it, or nullopt.
+    std::optional<ActivityLog> remove(long long id);
+    void clear();
+    // Id of the newest entry ever appended, 0 before the first.
+    long long last_id() const { return newest_id; }
+
+private:
+    struct Entry {
+        uint64_t seq;
+        ActivityLog log;
+    };
+    struct alignas(64) Reader {
+        std::atomic<uint64_t> epoch{0}; // 0: not reading
+    };
+    static const int MAX_READERS = 64;
+
+    int pin() const;
+    void unpin(int reader) const;
+    void retire(const Entry* e);
+    void reclaim();
+
+    std::array<std::atomic<const Entry*>, FEED_SIZE> slots{};
+    std::atomic<uint64_t> head{0}; // Sequence number of the next entry
+    long long newest_id = 0;
+
+    mutable std::atomic<uint64_t> epoch{1};
+    mutable std::array<Reader, MAX_READERS> readers;
+    std::vector<std::pair<uint64_t, const Entry*>> retired; // Epoch it was retired in
+};
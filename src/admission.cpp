@@ -0,0 +1,115 @@
+#include "admission.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double env_double(const char* name, double fallback) {
+    const char* v = std::getenv(name);
+    if (!v || !*v) return fallback;
+    char* end = nullptr;
+    double d = std::strtod(v, &end);
+    return (end && *end == '\0' && d > 0) ? d : fallback;
+}
+
+AdmissionConfig AdmissionConfig::from_env() {
+    AdmissionConfig c;
+    c.read_per_min = env_double("RATE_READ_PER_MIN", c.read_per_min);
+    c.read_burst = env_double("RATE_READ_BURST", c.read_burst);
+    c.write_per_min = env_double("RATE_WRITE_PER_MIN", c.write_per_min);
+    c.write_burst = env_double("RATE_WRITE_BURST", c.write_burst);
+    c.global_write_per_min = env_double("RATE_GLOBAL_WRITE_PER_MIN", c.global_write_per_min);
+    c.global_write_burst = env_double("RATE_GLOBAL_WRITE_BURST", c.global_write_burst);
+    c.max_inflight = (int)env_double("MAX_INFLIGHT", c.max_inflight);
+    return c;
+}
+
+RateLimit::RateLimit(double per_minute, double burst)
+    : interval_ns((int64_t)(60e9 / per_minute)), burst_ns((int64_t)(60e9 / per_minute * burst)) {}
+
+int64_t RateLimit::try_acquire(std::atomic<int64_t>& tat, int64_t now) const {
+    int64_t old = tat.load(std::memory_order_relaxed);
+    while (true) {
+        int64_t next = std::max(old, now) + interval_ns;
+        if (next - now > burst_ns) return next - now - burst_ns;
+        if (tat.compare_exchange_weak(old, next, std::memory_order_acq_rel, std::memory_order_relaxed)) return 0;
+    }
+}
+
+AdmissionController::AdmissionController(const AdmissionConfig& c)
+    : cfg(c),
+      read_limit(c.read_per_min, c.read_burst),
+      write_limit(c.write_per_min, c.write_burst),
+      global_write_limit(c.global_write_per_min, c.global_write_burst) {}
+
+std::atomic<int64_t>& AdmissionController::bucket_for(uint64_t key, const RateLimit& limit, int64_t now) {
+    if (key == 0) key = 1; // 0 marks an empty slot
+    size_t home = key & (SLOTS - 1);
+    for (size_t i = 0; i < PROBES; i++) {
+        Slot& s = slots[(home + i) & (SLOTS - 1)];
+        uint64_t k = s.key.load(std::memory_order_acquire);
+        if (k == key) return s.tat;
+        if (k == 0 && s.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) return s.tat;
+        if (k == key) return s.tat; // Lost the race to the same key
+    }
+    // Table neighbourhood is full: recycle a slot whose bucket has fully refilled
+    for (size_t i = 0; i < PROBES; i++) {
+        Slot& s = slots[(home + i) & (SLOTS - 1)];
+        uint64_t k = s.key.load(std::memory_order_acquire);
+        if (s.tat.load(std::memory_order_relaxed) + limit.burst_ns < now &&
+            s.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+            return s.tat;
+        }
+    }
+    return slots[home].tat; // Share with a colliding key rather than fail open
+}
+
+size_t AdmissionController::expire_idle(int64_t idle_sec) {
+    int64_t cutoff = now_ns() - idle_sec * 1000000000LL;
+    size_t freed = 0;
+    for (Slot& s : slots) {
+        uint64_t k = s.key.load(std::memory_order_acquire);
+        if (k == 0 || s.tat.load(std::memory_order_relaxed) >= cutoff) continue;
+        if (s.key.compare_exchange_strong(k, 0, std::memory_order_acq_rel)) {
+            s.tat.store(0, std::memory_order_relaxed);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+AdmissionDecision AdmissionController::admit(RequestClass cls, const std::string& session, const std::string& ip) {
+    int64_t now = now_ns();
+    bool write = cls == RequestClass::Write;
+
+    int load = inflight.load(std::memory_order_relaxed);
+    if (load >= (write ? std::max(1, cfg.max_inflight / 2) : cfg.max_inflight)) {
+        shed_overload.fetch_add(1, std::memory_order_relaxed);
+        return {false, 1};
+    }
+
+    const RateLimit& limit = write ? write_limit : read_limit;
+    std::hash<std::string> hasher;
+    uint64_t salt = write ? 0x9e3779b97f4a7c15ULL : 0;
+    int64_t wait = 0;
+
+    if (!ip.empty()) wait = std::max(wait, limit.try_acquire(bucket_for(hasher("ip:" + ip) ^ salt, limit, now), now));
+    if (!session.empty()) wait = std::max(wait, limit.try_acquire(bucket_for(hasher("s:" + session) ^ salt, limit, now), now));
+    if (wait == 0 && write) wait = global_write_limit.try_acquire(global_write_tat, now);
+
+    if (wait > 0) {
+        shed_rate.fetch_add(1, std::memory_order_relaxed);
+        return {false, (int)std::max<int64_t>(1, (wait + 999999999) / 1000000000)};
+    }
+    inflight.fetch_add(1, std::memory_order_relaxed);
+    admitted.fetch_add(1, std::memory_order_relaxed);
+    return {true, 0};
+}
+
+void AdmissionController::finish() {
+    inflight.fetch_sub(1, std::memory_order_relaxed);
+}
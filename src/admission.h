@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// --- ADMISSION CONTROL ---
+// Rate limits are GCRA token buckets: each bucket is a single atomic
+// "theoretical arrival time" advanced with CAS, so admission never takes a
+// lock. Buckets live in a fixed open-addressed table keyed by a hash of
+// (class, session or IP); idle slots are recycled.
+
+enum class RequestClass { Read, Write };
+
+struct RateLimit {
+    int64_t interval_ns; // Time to earn one token
+    int64_t burst_ns;    // interval_ns * burst size
+
+    RateLimit(double per_minute, double burst);
+
+    // 0 if admitted, otherwise nanoseconds until a token is available.
+    int64_t try_acquire(std::atomic<int64_t>& tat, int64_t now_ns) const;
+};
+
+struct AdmissionConfig {
+    double read_per_min = 240, read_burst = 60;     // Per session / per IP
+    double write_per_min = 30, write_burst = 10;    // Per session / per IP
+    double global_write_per_min = 1200, global_write_burst = 50;
+    int max_inflight = 32; // Writes are shed at half of this, reads at the full value
+
+    static AdmissionConfig from_env();
+};
+
+struct AdmissionDecision {
+    bool admitted;
+    int retry_after_sec;
+};
+
+class AdmissionController {
+public:
+    explicit AdmissionController(const AdmissionConfig& cfg);
+
+    // Call finish() exactly once for every admitted request.
+    AdmissionDecision admit(RequestClass cls, const std::string& session, const std::string& ip);
+    void finish();
+
+    // Frees buckets that have been full for longer than idle_sec. Returns how many.
+    size_t expire_idle(int64_t idle_sec);
+
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> shed_rate{0};
+    std::atomic<uint64_t> shed_overload{0};
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<int64_t> tat{0};
+    };
+    static const size_t SLOTS = 16384;
+    static const size_t PROBES = 8;
+
+    std::atomic<int64_t>& bucket_for(uint64_t key, const RateLimit& limit, int64_t now_ns);
+
+    AdmissionConfig cfg;
+    RateLimit read_limit, write_limit, global_write_limit;
+    std::atomic<int64_t> global_write_tat{0};
+    std::atomic<int> inflight{0};
+    Slot slots[SLOTS];
+};
@@ -0,0 +1,137 @@
+#include "analytics.h"
+
+static const double DAY = 86400.0;
+
+double UserStats::avg_debt_days() const {
+    return debt_samples ? (double)debt_sum / (double)debt_samples / DAY : 0.0;
+}
+
+double UserStats::avg_time_to_clean_days() const {
+    return clean_episodes ? (double)clean_seconds / (double)clean_episodes / DAY : 0.0;
+}
+
+static void bump(WindowCounts& w, const std::string& action, int by) {
+    if (action == "vice") w.vices += by;
+    else if (action == "virtue1") w.virtue1 += by;
+    else if (action == "virtue2") w.virtue2 += by;
+}
+
+static bool counted(const std::string& action) {
+    return action == "vice" || action == "virtue1" || action == "virtue2";
+}
+
+void Analytics::apply(const std::string& user, const std::string& action, time_t ts, long long snapshot, const TimeZone& zone) {
+    UserStats& s = stats[user];
+    changed.insert(user);
+    long long day = civil_day(ts, zone);
+    Undo u{ts, action, week_index(day), month_index(day), s.in_debt_episode, s.episode_start, s.frozen, s.last_ts, s.last_snapshot, false, 0};
+
+    if (counted(action)) {
+        bump(s.weeks[u.week], action, 1);
+        bump(s.months[u.month], action, 1);
+    }
+    if (action == "locked") s.bankruptcies++;
+    s.debt_sum += snapshot;
+    s.debt_samples++;
+
+    // Did decay clear the debt between the previous event and this one?
+    if (s.in_debt_episode && !s.frozen && s.last_ts && s.last_snapshot <= ts - s.last_ts) {
+        u.closed = true;
+        u.closed_seconds = (s.last_ts + s.last_snapshot) - s.episode_start;
+        s.in_debt_episode = false;
+    }
+    if (!s.in_debt_episode && action == "vice") {
+        s.in_debt_episode = true;
+        s.episode_start = ts;
+    } else if (s.in_debt_episode && snapshot == 0) {
+        u.closed = true;
+        u.closed_seconds = ts - s.episode_start;
+        s.in_debt_episode = false;
+    }
+    if (u.closed) {
+        s.clean_episodes++;
+        s.clean_seconds += u.closed_seconds;
+    }
+
+    if (action == "locked") s.frozen = true;
+    if (action == "reset") s.frozen = false;
+    s.last_ts = ts;
+    s.last_snapshot = snapshot;
+
+    auto& log = undo_log[user];
+    log.push_back(u);
+    if (log.size() > UNDO_DEPTH) log.pop_front();
+}
+
+void Analytics::revert(const std::string& user, const std::string& action, time_t ts, long long snapshot, const TimeZone& zone) {
+    auto it = stats.find(user);
+    if (it == stats.end()) return;
+    changed.insert(user);
+    UserStats& s = it->second;
+
+    auto& log = undo_log[user];
+    bool exact = !log.empty() && log.back().ts == ts && log.back().action == action;
+    long long week, month;
+    if (exact) {
+        week = log.back().week;
+        month = log.back().month;
+    } else {
+        long long day = civil_day(ts, zone);
+        week = week_index(day);
+        month = month_index(day);
+    }
+
+    if (counted(action)) {
+        bump(s.weeks[week], action, -1);
+        bump(s.months[month], action, -1);
+    }
+    if (action == "locked") s.bankruptcies--;
+    s.debt_sum -= snapshot;
+    s.debt_samples--;
+
+    // Episode state is only restorable from the undo record
+    if (exact) {
+        const Undo& u = log.back();
+        if (u.closed) {
+            s.clean_episodes--;
+            s.clean_seconds -= u.closed_seconds;
+        }
+        s.in_debt_episode = u.in_debt_episode;
+        s.episode_start = u.episode_start;
+        s.frozen = u.frozen;
+        s.last_ts = u.last_ts;
+        s.last_snapshot = u.last_snapshot;
+        log.pop_back();
+    }
+}
+
+void Analytics::erase(const std::string& user) {
+    stats.erase(user);
+    undo_log.erase(user);
+    changed.insert(user);
+}
+
+void Analytics::clear() {
+    stats.clear();
+    undo_log.clear();
+    changed.clear();
+}
+
+const UserStats* Analytics::find(const std::string& user) const {
+    auto it = stats.find(user);
+    return it == stats.end() ? nullptr : &it->second;
+}
+
+WindowCounts Analytics::week(const std::string& user, long long week_idx) const {
+    const UserStats* s = find(user);
+    if (!s) return {};
+    auto it = s->weeks.find(week_idx);
+    return it == s->weeks.end() ? WindowCounts{} : it->second;
+}
+
+WindowCounts Analytics::month(const std::string& user, long long month_idx) const {
+    const UserStats* s = find(user);
+    if (!s) return {};
+    auto it = s->months.find(month_idx);
+    return it == s->months.end() ? WindowCounts{} : it->second;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <ctime>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "calendar.h"
+
+// --- ANALYTICS ---
+// Rolling per-user aggregates, updated as each event is logged so that any
+// window read is a single hash lookup. Every apply() records what it changed,
+// which lets revert() (undo) restore the exact previous state.
+
+struct WindowCounts {
+    int vices = 0;
+    int virtue1 = 0;
+    int virtue2 = 0;
+};
+
+struct UserStats {
+    std::unordered_map<long long, WindowCounts> weeks;  // week_index -> counts
+    std::unordered_map<long long, WindowCounts> months; // month_index -> counts
+
+    long long debt_sum = 0;      // Sum of debt snapshots over all events
+    long long debt_samples = 0;
+    long long clean_episodes = 0; // Vice-from-clean ... debt back to zero
+    long long clean_seconds = 0;
+    int bankruptcies = 0;
+
+    // Episode tracking
+    bool in_debt_episode = false;
+    time_t episode_start = 0;
+    bool frozen = false; // Bankrupt: debt does not decay until bailed out
+    time_t last_ts = 0;
+    long long last_snapshot = 0;
+
+    double avg_debt_days() const;
+    double avg_time_to_clean_days() const;
+};
+
+class Analytics {
+public:
+    void apply(const std::string& user, const std::string& action, time_t ts, long long snapshot, const TimeZone& zone);
+    void revert(const std::string& user, const std::string& action, time_t ts, long long snapshot, const TimeZone& zone);
+    void erase(const std::string& user);
+    void clear();
+
+    const UserStats* find(const std::string& user) const;
+    UserStats& at(const std::string& user) { return stats[user]; }
+    const std::map<std::string, UserStats>& all() const { return stats; }
+    // Users whose stats apply(), revert() or erase() touched since the last
+    // call, for persistence. at() doesn't count: it is for loading.
+    std::set<std::string> take_changed() { return std::exchange(changed, {}); }
+
+    WindowCounts week(const std::string& user, long long week_idx) const;
+    WindowCounts month(const std::string& user, long long month_idx) const;
+
+private:
+    // Everything apply() touched that cannot be derived from the event itself
+    struct Undo {
+        time_t ts;
+        std::string action;
+        long long week, month;
+        bool in_debt_episode;
+        time_t episode_start;
+        bool frozen;
+        time_t last_ts;
+        long long last_snapshot;
+        bool closed;              // This event ended a debt episode...
+        long long closed_seconds; // ...of this length
+    };
+    static const size_t UNDO_DEPTH = 32;
+
+    std::map<std::string, UserStats> stats;
+    std::map<std::string, std::deque<Undo>> undo_log;
+    std::set<std::string> changed;
+};
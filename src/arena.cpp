@@ -0,0 +1,28 @@
+#include "arena.h"
+#include <memory>
+#include <optional>
+
+static thread_local std::pmr::memory_resource* current = nullptr;
+
+// Allocated on a thread's first request and reused for every one after
+static char* thread_block() {
+    static thread_local std::unique_ptr<char[]> block;
+    if (!block) block.reset(new char[ARENA_BLOCK]);
+    return block.get();
+}
+
+static thread_local std::optional<std::pmr::monotonic_buffer_resource> arena;
+
+void arena_begin() {
+    arena.emplace(thread_block(), ARENA_BLOCK, std::pmr::new_delete_resource());
+    current = &*arena;
+}
+
+void arena_end() {
+    current = nullptr;
+    arena.reset();
+}
+
+std::pmr::memory_resource* request_arena() {
+    return current ? current : std::pmr::get_default_resource();
+}
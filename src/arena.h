@@ -0,0 +1,76 @@
+#pragma once
+#include <charconv>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// --- REQUEST ARENA ---
+// Everything a handler builds while rendering comes out of a per-request
+// monotonic arena carved from a block the worker thread keeps, and is
+// dropped in one go when the response goes out. Only blocks past the first
+// ARENA_BLOCK bytes touch the global allocator.
+
+using pstring = std::pmr::string;
+
+const size_t ARENA_BLOCK = 256 * 1024;
+
+// Opens this thread's arena for a request, and releases everything it
+// handed out. Requests on one thread do not overlap, so they never nest.
+void arena_begin();
+void arena_end();
+
+// The arena of the request being handled on this thread, or the default
+// resource outside of one.
+std::pmr::memory_resource* request_arena();
+
+// One decimal place, the way the dashboard shows day counts
+struct Fixed1 {
+    double value;
+};
+
+// User text going into a page or an attribute
+struct Html {
+    std::string_view text;
+};
+
+template <typename String>
+void append_html(String& out, std::string_view s) {
+    for (char c : s) {
+        switch (c) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '\'': out += "&#39;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += c;
+        }
+    }
+}
+
+template <typename Part>
+void append_part(pstring& out, const Part& part) {
+    if constexpr (std::is_same_v<Part, Fixed1>) {
+        char buf[32];
+        int n = std::snprintf(buf, sizeof(buf), "%.1f", part.value);
+        out.append(buf, n > 0 ? (size_t)n : 0);
+    } else if constexpr (std::is_same_v<Part, Html>) {
+        append_html(out, part.text);
+    } else if constexpr (std::is_same_v<Part, char>) {
+        out.push_back(part);
+    } else if constexpr (std::is_integral_v<Part>) {
+        char buf[24];
+        auto r = std::to_chars(buf, buf + sizeof(buf), part);
+        out.append(buf, r.ptr - buf);
+    } else {
+        std::string_view s(part);
+        out.append(s.data(), s.size());
+    }
+}
+
+// html += a + b + c, without the temporaries
+template <typename... Parts>
+void cat(pstring& out, const Parts&... parts) {
+    (append_part(out, parts), ...);
+}
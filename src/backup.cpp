@@ -0,0 +1,138 @@
+#include "backup.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char HEAD_MAGIC[8] = {'R', 'C', 'Y', 'B', 'A', 'C', 'K', '1'};
+static const char TAIL_MAGIC[8] = {'R', 'C', 'Y', 'B', 'K', 'E', 'N', 'D'};
+static const size_t TRAILER = 8 + 8 + 8; // count, checksum, magic
+static const size_t FLUSH_AT = 1 << 20;
+
+static void put_u32(std::string& out, uint32_t v) { out.append((const char*)&v, 4); }
+static void put_u64(std::string& out, uint64_t v) { out.append((const char*)&v, 8); }
+static uint32_t get_u32(const char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+static uint64_t get_u64(const char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+
+static const uint64_t FNV_BASIS = 1469598103934665603ULL;
+
+static uint64_t fnv1a(uint64_t h, const char* p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static std::runtime_error io_error(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+static void write_all(int fd, const std::string& data, const std::string& path) {
+    const char* p = data.data();
+    size_t n = data.size();
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            throw io_error("write", path);
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+BackupStats write_backup(StorageEngine& storage, const std::string& path) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw io_error("open", tmp);
+
+    BackupStats st;
+    uint64_t sum = FNV_BASIS;
+    std::string buf(HEAD_MAGIC, 8);
+    buf.reserve(FLUSH_AT + 4096);
+    auto flush = [&] {
+        sum = fnv1a(sum, buf.data(), buf.size());
+        write_all(fd, buf, tmp);
+        st.bytes += buf.size();
+        buf.clear();
+    };
+    try {
+        // Every key the engines use is ASCII, so this bound covers them all
+        storage.scan("", std::string(1, '\xff'), [&](const std::string& key, const std::string& value) {
+            put_u32(buf, (uint32_t)key.size());
+            put_u32(buf, (uint32_t)value.size());
+            buf += key;
+            buf += value;
+            st.records++;
+            if (buf.size() >= FLUSH_AT) flush();
+            return true;
+        });
+        flush();
+        put_u64(buf, st.records);
+        put_u64(buf, sum);
+        buf.append(TAIL_MAGIC, 8);
+        write_all(fd, buf, tmp);
+        st.bytes += buf.size();
+        if (::fsync(fd) != 0) throw io_error("fsync", tmp);
+    } catch (...) {
+        ::close(fd);
+        std::remove(tmp.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw io_error("rename", path);
+    }
+    return st;
+}
+
+BackupStats read_backup(const std::string& path, const std::function<void(std::string key, std::string value)>& record) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw io_error("open", path);
+    std::string data;
+    char chunk[65536];
+    for (;;) {
+        ssize_t r = ::read(fd, chunk, sizeof(chunk));
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            throw io_error("read", path);
+        }
+        if (r == 0) break;
+        data.append(chunk, (size_t)r);
+    }
+    ::close(fd);
+
+    auto bad = [&](const char* why) { return std::runtime_error(path + ": " + why); };
+    if (data.size() < 8 + TRAILER || std::memcmp(data.data(), HEAD_MAGIC, 8) != 0) throw bad("not a backup");
+    size_t end = data.size() - TRAILER;
+    if (std::memcmp(data.data() + end + 16, TAIL_MAGIC, 8) != 0) throw bad("backup is truncated");
+    if (get_u64(data.data() + end + 8) != fnv1a(FNV_BASIS, data.data(), end)) throw bad("backup checksum mismatch");
+
+    BackupStats st;
+    st.bytes = data.size();
+    uint64_t count = get_u64(data.data() + end);
+    // Walk the whole thing before handing anything out: all or nothing
+    std::vector<std::pair<size_t, size_t>> spans; // Offset of each key, then its value
+    for (size_t p = 8; p < end;) {
+        if (end - p < 8) throw bad("backup record malformed");
+        size_t klen = get_u32(data.data() + p), vlen = get_u32(data.data() + p + 4);
+        if (klen + vlen > end - p - 8) throw bad("backup record malformed");
+        spans.push_back({p + 8, p + 8 + klen});
+        p += 8 + klen + vlen;
+    }
+    if (spans.size() != count) throw bad("backup record count mismatch");
+    for (size_t i = 0; i < spans.size(); i++) {
+        size_t key = spans[i].first, value = spans[i].second;
+        size_t value_end = i + 1 < spans.size() ? spans[i + 1].first - 8 : end;
+        record(data.substr(key, value - key), data.substr(value, value_end - value));
+        st.records++;
+    }
+    return st;
+}
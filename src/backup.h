@@ -0,0 +1,28 @@
+#pragma once
+#include "storage.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// --- BACKUPS ---
+// A backup is every storage record, in key order, in one file:
+//   "RCYBACK1"
+//   per record: key length, value length (u32), key, value
+//   trailer: record count (u64), FNV-1a of everything before it (u64), "RCYBKEND"
+// Values are kept exactly as the engine hands them out (codec.h objects),
+// so a backup taken from one engine restores into any other. The server
+// writes them from a forked child (see "BACKUPS" in main.cpp); a backup
+// that was cut short or altered fails its checksum and is never loaded.
+
+struct BackupStats {
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+};
+
+// Writes `path` atomically (temp file + fsync + rename). Throws
+// std::runtime_error on any I/O error.
+BackupStats write_backup(StorageEngine& storage, const std::string& path);
+
+// Checks the whole file first, then hands out every record in order.
+// Throws std::runtime_error if it can't be read or doesn't check out.
+BackupStats read_backup(const std::string& path, const std::function<void(std::string key, std::string value)>& record);
@@ -0,0 +1,220 @@
+// recurrency-batch: recomputes every user from their event history without
+// the web server, e.g. to see (and apply) what a rule change would do.
+//
+//   recurrency-batch [--db PATH] [--storage json|btree] [--format json|cbor|msgpack]
+//                    [--rounding SEC] [--virtue-reward SEC] [--relapse X] [--threshold X]
+//                    [--threads N] [--dry-run]
+//
+// Defaults come from the same DB_PATH / STORAGE / PERSIST_FORMAT the server
+// reads, and the policy defaults are the live rules, so a plain run checks
+// that stored users still match their histories. Users are independent, so
+// decoding and replay are spread over every core; only the users that
+// changed are written back, in one commit. Stop the server first: it does
+// not notice the database changing underneath it.
+#include "codec.h"
+#include "io_executor.h"
+#include "records.h"
+#include "storage.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+struct Options {
+    std::string db_path = "/data/db.json";
+    std::string storage = "json";
+    std::string format = "json";
+    Policy policy;
+    unsigned threads = std::thread::hardware_concurrency();
+    bool dry_run = false;
+};
+
+// One user's raw records in, the recomputed record out
+struct Job {
+    std::string id;
+    std::string user;
+    std::vector<std::string> events;
+    std::optional<std::string> updated; // Set when the user changed
+    long long debt_before = 0;
+    long long debt_after = 0;
+    bool locked_before = false;
+    bool locked_after = false;
+};
+
+struct Totals {
+    size_t events = 0;
+    size_t changed = 0;
+    size_t bankrupt = 0;   // Locked now, wasn't before
+    size_t discharged = 0; // The other way round
+    long long debt_delta = 0;
+};
+
+static void usage() {
+    std::cerr << "usage: recurrency-batch [--db PATH] [--storage json|btree] [--format json|cbor|msgpack]\n"
+                 "                        [--rounding SEC] [--virtue-reward SEC] [--relapse X] [--threshold X]\n"
+                 "                        [--threads N] [--dry-run]" << std::endl;
+}
+
+static bool parse_args(int argc, char** argv, Options& o) {
+    if (const char* v = std::getenv("DB_PATH")) o.db_path = v;
+    if (const char* v = std::getenv("STORAGE")) o.storage = v;
+    if (const char* v = std::getenv("PERSIST_FORMAT")) o.format = v;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dry-run") {
+            o.dry_run = true;
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        std::string v = argv[++i];
+        char* end = nullptr;
+        double n = std::strtod(v.c_str(), &end);
+        bool numeric = end != v.c_str() && *end == '\0' && n > 0;
+        if (arg == "--db") o.db_path = v;
+        else if (arg == "--storage") o.storage = v;
+        else if (arg == "--format") o.format = v;
+        else if (arg == "--rounding" && numeric) o.policy.rounding = (long long)n;
+        else if (arg == "--virtue-reward" && numeric) o.policy.virtue_reward = (long long)n;
+        else if (arg == "--relapse" && numeric) o.policy.relapse_multiplier = n;
+        else if (arg == "--threshold" && numeric) o.policy.threshold_multiplier = n;
+        else if (arg == "--threads" && numeric) o.threads = (unsigned)n;
+        else return false;
+    }
+    if (o.threads == 0) o.threads = 1;
+    return true;
+}
+
+static void recompute(Job& job, const Policy& policy, Encoding format) {
+    json before = decode_object(job.user);
+    User u = user_from_json(job.id, before);
+    std::vector<UserEvent> events;
+    events.reserve(job.events.size());
+    for (const std::string& raw : job.events) events.push_back(event_from_json(job.id, decode_object(raw)));
+
+    User after = replay(u, events, policy);
+    json out = user_to_json(after);
+    job.debt_before = u.debt_seconds;
+    job.debt_after = after.debt_seconds;
+    job.locked_before = u.locked;
+    job.locked_after = after.locked;
+    if (out != before) job.updated = encode(out, format);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_args(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    std::optional<Encoding> format = encoding_from_name(opt.format);
+    if (!format) {
+        std::cerr << "unknown format '" << opt.format << "' (json, cbor or msgpack)" << std::endl;
+        return 2;
+    }
+
+    IoExecutor io;
+    std::unique_ptr<StorageEngine> storage;
+    try {
+        storage = open_storage(opt.storage, opt.db_path, io, *format);
+    } catch (const std::exception& e) {
+        std::cerr << "storage: " << e.what() << std::endl;
+        return 1;
+    }
+    io.start();
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Job> jobs;
+    std::map<std::string, size_t> index;
+    storage->scan("u/", prefix_end("u/"), [&](const std::string& key, const std::string& v) {
+        index[key.substr(2)] = jobs.size();
+        Job job;
+        job.id = key.substr(2);
+        job.user = v;
+        jobs.push_back(std::move(job));
+        return true;
+    });
+    // Keys sort by sequence within a user, so streams arrive in order
+    storage->scan("e/", prefix_end("e/"), [&](const std::string& key, const std::string& v) {
+        std::string id;
+        size_t seq;
+        if (!parse_event_key(key, id, seq)) return true;
+        auto it = index.find(id);
+        if (it != index.end()) jobs[it->second].events.push_back(v);
+        return true;
+    });
+    auto t1 = std::chrono::steady_clock::now();
+
+    // Streams without events predate event sourcing; there is nothing to replay
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < opt.threads; t++) {
+        workers.emplace_back([&] {
+            for (size_t i; (i = next++) < jobs.size();) {
+                if (jobs[i].events.empty()) continue;
+                try {
+                    recompute(jobs[i], opt.policy, *format);
+                } catch (const std::exception& e) {
+                    std::cerr << jobs[i].id << ": " << e.what() << std::endl;
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    auto t2 = std::chrono::steady_clock::now();
+    if (failed) {
+        io.stop();
+        return 1;
+    }
+
+    Totals totals;
+    StorageBatch batch;
+    for (const Job& job : jobs) {
+        totals.events += job.events.size();
+        if (!job.updated) continue;
+        totals.changed++;
+        totals.debt_delta += job.debt_after - job.debt_before;
+        totals.bankrupt += job.locked_after && !job.locked_before;
+        totals.discharged += job.locked_before && !job.locked_after;
+        batch.push_back({user_key(job.id), *job.updated});
+    }
+
+    bool ok = true;
+    if (!opt.dry_run && !batch.empty()) {
+        std::promise<std::string> written;
+        storage->commit(std::move(batch), [&](bool success, const std::string& error) {
+            written.set_value(success ? "" : error);
+        });
+        std::string error = written.get_future().get();
+        if (!error.empty()) {
+            std::cerr << "write failed: " << error << std::endl;
+            ok = false;
+        }
+    }
+    io.stop();
+    auto t3 = std::chrono::steady_clock::now();
+
+    auto ms = [](auto a, auto b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+    double replay_ms = ms(t1, t2);
+    std::cout << jobs.size() << " users, " << totals.events << " events: read " << (long long)ms(t0, t1) << " ms, replay "
+              << (long long)replay_ms << " ms on " << opt.threads << " thread(s) ("
+              << (long long)(replay_ms > 0 ? totals.events / replay_ms * 1000 : 0) << " events/s), write "
+              << (long long)ms(t2, t3) << " ms" << std::endl;
+    std::cout << totals.changed << " changed";
+    if (totals.changed) {
+        std::cout << ", debt " << (totals.debt_delta >= 0 ? "+" : "") << totals.debt_delta / (double)DAY_SEC
+                  << " days in total, " << totals.bankrupt << " newly bankrupt, " << totals.discharged << " released";
+    }
+    std::cout << (opt.dry_run ? " (dry run, nothing written)" : "") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,593 @@
+#include "btree.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char TREE_MAGIC[8] = {'R', 'C', 'Y', 'B', 'T', 'R', 'E', '1'};
+static const char WAL_MAGIC[8] = {'R', 'C', 'Y', 'W', 'A', 'L', 'O', 'K'};
+static const size_t NODE_HEADER = 7;                                          // type, count, link
+static const size_t OVERFLOW_DATA = BTreeStorage::PAGE_SIZE - NODE_HEADER;    // type, next, used
+static const size_t WAL_TRAILER = 4 + 8 + 8;                                  // count, checksum, magic
+
+enum PageType : uint8_t { PAGE_FREE = 0, PAGE_LEAF = 1, PAGE_INTERNAL = 2, PAGE_OVERFLOW = 3 };
+
+static void put_u16(char* p, uint16_t v) { std::memcpy(p, &v, 2); }
+static void put_u32(char* p, uint32_t v) { std::memcpy(p, &v, 4); }
+static void put_u64(char* p, uint64_t v) { std::memcpy(p, &v, 8); }
+static uint16_t get_u16(const char* p) { uint16_t v; std::memcpy(&v, p, 2); return v; }
+static uint32_t get_u32(const char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+static uint64_t get_u64(const char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+
+static uint64_t fnv1a(const char* p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static std::runtime_error io_error(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+static void pwrite_all(int fd, const char* p, size_t n, off_t off, const std::string& path) {
+    while (n > 0) {
+        ssize_t w = ::pwrite(fd, p, n, off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            throw io_error("write", path);
+        }
+        p += w;
+        n -= (size_t)w;
+        off += w;
+    }
+}
+
+// Short reads past the end of the file leave zeros
+static void pread_all(int fd, char* p, size_t n, off_t off, const std::string& path) {
+    while (n > 0) {
+        ssize_t r = ::pread(fd, p, n, off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            throw io_error("read", path);
+        }
+        if (r == 0) break;
+        p += r;
+        n -= (size_t)r;
+        off += r;
+    }
+}
+
+// Leaf slots are stored as-is: [0][u16 len][bytes] inline, or
+// [1][u32 len][u32 first overflow page]
+struct BTreeStorage::Node {
+    bool leaf = true;
+    uint32_t link = 0;              // Leaf: next leaf. Internal: child left of keys[0]
+    std::vector<std::string> keys;
+    std::vector<std::string> slots; // Leaf only
+    std::vector<uint32_t> kids;     // Internal only: kids[i] holds keys >= keys[i]
+
+    size_t entry_size(size_t i) const { return 2 + keys[i].size() + (leaf ? slots[i].size() : 4); }
+    size_t size() const {
+        size_t n = NODE_HEADER;
+        for (size_t i = 0; i < keys.size(); i++) n += entry_size(i);
+        return n;
+    }
+    size_t child_index(const std::string& key) const {
+        return std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+    }
+    uint32_t child(size_t i) const { return i ? kids[i - 1] : link; }
+};
+
+BTreeStorage::BTreeStorage(const std::string& path, IoExecutor& io, size_t cache_pages)
+    : path(path), io(io), cache_pages(std::max<size_t>(cache_pages, 16)) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw io_error("open", path);
+    wal_fd = ::open((path + ".wal").c_str(), O_RDWR | O_CREAT, 0644);
+    if (wal_fd < 0) {
+        ::close(fd);
+        throw io_error("open", path + ".wal");
+    }
+    try {
+        recover();
+        std::lock_guard<std::mutex> lock(tree_mtx);
+        if (::lseek(fd, 0, SEEK_END) == 0) {
+            page_count = 2;
+            root = 1;
+            store_node(root, Node());
+            write_pages();
+        } else {
+            read_header();
+        }
+    } catch (...) {
+        ::close(fd);
+        ::close(wal_fd);
+        throw;
+    }
+}
+
+void BTreeStorage::read_header() {
+    const char* h = page(0, false);
+    if (std::memcmp(h, TREE_MAGIC, 8) != 0) throw std::runtime_error(path + " is not a b-tree file");
+    root = get_u32(h + 8);
+    page_count = get_u32(h + 12);
+    free_head = get_u32(h + 16);
+    height = get_u32(h + 20);
+    entries = get_u64(h + 24);
+}
+
+BTreeStorage::~BTreeStorage() {
+    ::close(fd);
+    ::close(wal_fd);
+}
+
+// --- BUFFER POOL ---
+// Pointers are only good until the next page() call, which may evict.
+
+char* BTreeStorage::page(uint32_t id, bool write) {
+    auto it = frames.find(id);
+    if (it != frames.end()) {
+        cache_hits++;
+        lru.splice(lru.begin(), lru, it->second.lru);
+    } else {
+        Frame f;
+        f.data.assign(PAGE_SIZE, 0);
+        pread_all(fd, f.data.data(), PAGE_SIZE, (off_t)id * PAGE_SIZE, path);
+        page_reads++;
+        lru.push_front(id);
+        f.lru = lru.begin();
+        it = frames.emplace(id, std::move(f)).first;
+        evict();
+    }
+    if (write) it->second.dirty = true;
+    return it->second.data.data();
+}
+
+// Dirty pages stay until write_pages() has them in the log, and so does
+// the page just touched
+void BTreeStorage::evict() {
+    auto it = lru.end();
+    while (frames.size() > cache_pages && --it != lru.begin()) {
+        if (frames[*it].dirty) continue;
+        frames.erase(*it);
+        it = lru.erase(it);
+    }
+}
+
+uint32_t BTreeStorage::alloc_page() {
+    uint32_t id;
+    if (free_head) {
+        id = free_head;
+        char* p = page(id, true);
+        free_head = get_u32(p + 1);
+        std::memset(p, 0, PAGE_SIZE);
+    } else {
+        id = page_count++;
+        Frame f;
+        f.data.assign(PAGE_SIZE, 0);
+        f.dirty = true;
+        lru.push_front(id);
+        f.lru = lru.begin();
+        frames.emplace(id, std::move(f));
+    }
+    return id;
+}
+
+void BTreeStorage::free_page(uint32_t id) {
+    char* p = page(id, true);
+    std::memset(p, 0, PAGE_SIZE);
+    p[0] = PAGE_FREE;
+    put_u32(p + 1, free_head);
+    free_head = id;
+}
+
+// --- NODES ---
+
+BTreeStorage::Node BTreeStorage::load_node(uint32_t id) {
+    const char* p = page(id, false);
+    Node n;
+    n.leaf = p[0] != PAGE_INTERNAL;
+    uint16_t count = get_u16(p + 1);
+    n.link = get_u32(p + 3);
+    n.keys.reserve(count);
+    size_t off = NODE_HEADER;
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t klen = get_u16(p + off);
+        n.keys.emplace_back(p + off + 2, klen);
+        off += 2 + klen;
+        if (n.leaf) {
+            size_t slen = p[off] == 0 ? 3 + get_u16(p + off + 1) : 9;
+            n.slots.emplace_back(p + off, slen);
+            off += slen;
+        } else {
+            n.kids.push_back(get_u32(p + off));
+            off += 4;
+        }
+    }
+    return n;
+}
+
+void BTreeStorage::store_node(uint32_t id, const Node& n) {
+    char* p = page(id, true);
+    std::memset(p, 0, PAGE_SIZE);
+    p[0] = n.leaf ? PAGE_LEAF : PAGE_INTERNAL;
+    put_u16(p + 1, (uint16_t)n.keys.size());
+    put_u32(p + 3, n.link);
+    size_t off = NODE_HEADER;
+    for (size_t i = 0; i < n.keys.size(); i++) {
+        put_u16(p + off, (uint16_t)n.keys[i].size());
+        std::memcpy(p + off + 2, n.keys[i].data(), n.keys[i].size());
+        off += 2 + n.keys[i].size();
+        if (n.leaf) {
+            std::memcpy(p + off, n.slots[i].data(), n.slots[i].size());
+            off += n.slots[i].size();
+        } else {
+            put_u32(p + off, n.kids[i]);
+            off += 4;
+        }
+    }
+}
+
+uint32_t BTreeStorage::find_leaf(const std::string& key) {
+    uint32_t id = root;
+    while (true) {
+        Node n = load_node(id);
+        if (n.leaf) return id;
+        id = n.child(n.child_index(key));
+    }
+}
+
+std::string BTreeStorage::make_slot(const std::string& value) {
+    std::string slot;
+    if (value.size() <= INLINE_MAX) {
+        slot.resize(3);
+        slot[0] = 0;
+        put_u16(&slot[1], (uint16_t)value.size());
+        return slot + value;
+    }
+    size_t chunks = (value.size() + OVERFLOW_DATA - 1) / OVERFLOW_DATA;
+    std::vector<uint32_t> ids(chunks);
+    for (auto& id : ids) id = alloc_page();
+    for (size_t c = 0; c < chunks; c++) {
+        size_t off = c * OVERFLOW_DATA;
+        size_t len = std::min(OVERFLOW_DATA, value.size() - off);
+        char* p = page(ids[c], true);
+        p[0] = PAGE_OVERFLOW;
+        put_u32(p + 1, c + 1 < chunks ? ids[c + 1] : 0);
+        put_u16(p + 5, (uint16_t)len);
+        std::memcpy(p + NODE_HEADER, value.data() + off, len);
+    }
+    slot.resize(9);
+    slot[0] = 1;
+    put_u32(&slot[1], (uint32_t)value.size());
+    put_u32(&slot[5], ids[0]);
+    return slot;
+}
+
+std::string BTreeStorage::read_slot(const std::string& slot) {
+    if (slot[0] == 0) return slot.substr(3);
+    std::string value;
+    value.reserve(get_u32(&slot[1]));
+    for (uint32_t id = get_u32(&slot[5]); id;) {
+        const char* p = page(id, false);
+        value.append(p + NODE_HEADER, get_u16(p + 5));
+        id = get_u32(p + 1);
+    }
+    return value;
+}
+
+void BTreeStorage::drop_slot(const std::string& slot) {
+    if (slot[0] == 0) return;
+    for (uint32_t id = get_u32(&slot[5]); id;) {
+        uint32_t next = get_u32(page(id, false) + 1);
+        free_page(id);
+        id = next;
+    }
+}
+
+// --- TREE ---
+
+BTreeStorage::Split BTreeStorage::insert(uint32_t id, const std::string& key, std::string slot) {
+    Node n = load_node(id);
+    if (n.leaf) {
+        auto it = std::lower_bound(n.keys.begin(), n.keys.end(), key);
+        size_t i = it - n.keys.begin();
+        if (it != n.keys.end() && *it == key) {
+            drop_slot(n.slots[i]);
+            n.slots[i] = std::move(slot);
+        } else {
+            n.keys.insert(it, key);
+            n.slots.insert(n.slots.begin() + i, std::move(slot));
+            entries++;
+        }
+    } else {
+        size_t i = n.child_index(key);
+        Split s = insert(n.child(i), key, std::move(slot));
+        if (!s) return std::nullopt;
+        n.keys.insert(n.keys.begin() + i, s->first);
+        n.kids.insert(n.kids.begin() + i, s->second);
+    }
+    if (n.size() <= PAGE_SIZE) {
+        store_node(id, n);
+        return std::nullopt;
+    }
+    return split(id, n);
+}
+
+// Cuts where the two halves come closest to equal bytes. An entry is at
+// most MAX_KEY + INLINE_MAX plus a few bytes, so both halves always fit.
+BTreeStorage::Split BTreeStorage::split(uint32_t id, Node& n) {
+    size_t total = n.size() - NODE_HEADER;
+    size_t best = 1, best_gap = SIZE_MAX, prefix = 0;
+    for (size_t m = 0; m < n.keys.size(); m++) {
+        if (m > 0 || !n.leaf) {
+            size_t left = prefix, right = total - prefix - (n.leaf ? 0 : n.entry_size(m));
+            size_t gap = left > right ? left - right : right - left;
+            if (gap < best_gap) best_gap = gap, best = m;
+        }
+        prefix += n.entry_size(m);
+    }
+
+    Node right;
+    right.leaf = n.leaf;
+    std::string separator;
+    uint32_t rid = alloc_page();
+    if (n.leaf) {
+        right.keys.assign(n.keys.begin() + best, n.keys.end());
+        right.slots.assign(n.slots.begin() + best, n.slots.end());
+        right.link = n.link;
+        n.link = rid;
+        separator = right.keys[0];
+        n.slots.resize(best);
+    } else {
+        separator = n.keys[best];
+        right.link = n.kids[best];
+        right.keys.assign(n.keys.begin() + best + 1, n.keys.end());
+        right.kids.assign(n.kids.begin() + best + 1, n.kids.end());
+        n.kids.resize(best);
+    }
+    n.keys.resize(best);
+    store_node(id, n);
+    store_node(rid, right);
+    return std::make_pair(separator, rid);
+}
+
+void BTreeStorage::erase(const std::string& key) {
+    uint32_t id = find_leaf(key);
+    Node n = load_node(id);
+    auto it = std::lower_bound(n.keys.begin(), n.keys.end(), key);
+    if (it == n.keys.end() || *it != key) return;
+    size_t i = it - n.keys.begin();
+    drop_slot(n.slots[i]);
+    n.keys.erase(it);
+    n.slots.erase(n.slots.begin() + i);
+    entries--;
+    store_node(id, n);
+}
+
+// --- READS ---
+
+std::optional<std::string> BTreeStorage::get(const std::string& key) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const Overlay* o : {&pending, &applying}) {
+            auto it = o->find(key);
+            if (it != o->end()) return it->second;
+        }
+    }
+    std::lock_guard<std::mutex> lock(tree_mtx);
+    Node n = load_node(find_leaf(key));
+    auto it = std::lower_bound(n.keys.begin(), n.keys.end(), key);
+    if (it == n.keys.end() || *it != key) return std::nullopt;
+    return read_slot(n.slots[it - n.keys.begin()]);
+}
+
+void BTreeStorage::scan(const std::string& from, const std::string& to, const Visit& visit) {
+    // Overlays first: a drain finishing mid-scan is then covered either way
+    Overlay newer;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const Overlay* o : {&applying, &pending}) {
+            for (auto it = o->lower_bound(from); it != o->end() && it->first < to; ++it) newer[it->first] = it->second;
+        }
+    }
+    std::map<std::string, std::string> out;
+    {
+        std::lock_guard<std::mutex> lock(tree_mtx);
+        for (uint32_t id = find_leaf(from); id;) {
+            Node n = load_node(id);
+            size_t i = std::lower_bound(n.keys.begin(), n.keys.end(), from) - n.keys.begin();
+            for (; i < n.keys.size() && n.keys[i] < to; i++) out[n.keys[i]] = read_slot(n.slots[i]);
+            if (i < n.keys.size()) break;
+            id = n.link;
+        }
+    }
+    for (auto& [key, value] : newer) {
+        if (value) out[key] = std::move(*value);
+        else out.erase(key);
+    }
+    for (auto const& [key, value] : out) {
+        if (!visit(key, value)) break;
+    }
+}
+
+// --- COMMITS ---
+
+void BTreeStorage::commit(StorageBatch batch, Completion done, asio::io_context* reply_to) {
+    for (const auto& w : batch) {
+        if (w.key.size() > MAX_KEY) throw std::invalid_argument("storage key longer than " + std::to_string(MAX_KEY) + " bytes");
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& w : batch) pending[w.key] = std::move(w.value);
+    }
+    io.submit(path, [this](std::string& error) { return drain(error); }, std::move(done), reply_to);
+}
+
+// I/O thread: everything committed so far goes to disk as one atomic batch
+bool BTreeStorage::drain(std::string& error) {
+    std::unique_lock<std::mutex> lock(mtx);
+    held_cv.wait(lock, [this] { return !held; });
+    applying.swap(pending);
+    // Taken before mtx is let go, so prepare_fork() finds either the batch
+    // still in `applying` or the tree already holding it, never half of each
+    std::unique_lock<std::mutex> tree(tree_mtx);
+    lock.unlock();
+    bool ok = true;
+    try {
+        if (stale) reload();
+        for (const auto& [key, value] : applying) {
+            if (!value) {
+                erase(key);
+                continue;
+            }
+            Split s = insert(root, key, make_slot(*value));
+            if (s) {
+                Node top;
+                top.leaf = false;
+                top.link = root;
+                top.keys.push_back(s->first);
+                top.kids.push_back(s->second);
+                root = alloc_page();
+                store_node(root, top);
+                height++;
+            }
+        }
+        write_pages();
+        commits++;
+    } catch (const std::exception& e) {
+        error = e.what();
+        ok = false;
+        // The cache is part way through the batch: start again from the
+        // file, or failing that before the next drain touches the tree
+        stale = true;
+        try {
+            reload();
+        } catch (const std::exception& e) {
+            error += std::string("; reloading: ") + e.what();
+        }
+    }
+    tree.unlock();
+    lock.lock();
+    // A failed batch goes again with the next drain, under anything
+    // committed since
+    if (!ok) {
+        for (auto& [key, value] : applying) pending.emplace(key, std::move(value));
+    }
+    applying.clear();
+    return ok;
+}
+
+// Drops every cached page, finishes (or discards) whatever the log holds
+// and rereads the header. tree_mtx held.
+void BTreeStorage::reload() {
+    frames.clear();
+    lru.clear();
+    recover();
+    read_header();
+    stale = false;
+}
+
+// --- BACKUPS ---
+
+void BTreeStorage::prepare_fork() {
+    mtx.lock();
+    tree_mtx.lock();
+}
+
+void BTreeStorage::after_fork() {
+    tree_mtx.unlock();
+    mtx.unlock();
+}
+
+void BTreeStorage::hold_disk_writes(bool h) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        held = h;
+    }
+    held_cv.notify_all();
+}
+
+// Log every dirty page, then write them in place. tree_mtx held.
+void BTreeStorage::write_pages() {
+    char* h = page(0, true);
+    std::memcpy(h, TREE_MAGIC, 8);
+    put_u32(h + 8, root);
+    put_u32(h + 12, page_count);
+    put_u32(h + 16, free_head);
+    put_u32(h + 20, height);
+    put_u64(h + 24, entries);
+
+    std::vector<uint32_t> dirty;
+    for (auto const& [id, f] : frames) {
+        if (f.dirty) dirty.push_back(id);
+    }
+    std::sort(dirty.begin(), dirty.end());
+
+    std::string log(dirty.size() * (4 + PAGE_SIZE) + WAL_TRAILER, '\0');
+    size_t off = 0;
+    for (uint32_t id : dirty) {
+        put_u32(&log[off], id);
+        std::memcpy(&log[off + 4], frames[id].data.data(), PAGE_SIZE);
+        off += 4 + PAGE_SIZE;
+    }
+    put_u32(&log[off], (uint32_t)dirty.size());
+    put_u64(&log[off + 4], fnv1a(log.data(), off));
+    std::memcpy(&log[off + 12], WAL_MAGIC, 8);
+
+    if (::ftruncate(wal_fd, 0) != 0) throw io_error("truncate", path + ".wal");
+    pwrite_all(wal_fd, log.data(), log.size(), 0, path + ".wal");
+    if (::fdatasync(wal_fd) != 0) throw io_error("fsync", path + ".wal");
+
+    for (uint32_t id : dirty) {
+        pwrite_all(fd, frames[id].data.data(), PAGE_SIZE, (off_t)id * PAGE_SIZE, path);
+        page_writes++;
+    }
+    if (::fdatasync(fd) != 0) throw io_error("fsync", path);
+    if (::ftruncate(wal_fd, 0) != 0) throw io_error("truncate", path + ".wal");
+
+    for (uint32_t id : dirty) frames[id].dirty = false;
+    evict();
+}
+
+// A complete log means the crash came after it was synced: finish the job.
+// Anything else means the tree file was never touched.
+void BTreeStorage::recover() {
+    off_t size = ::lseek(wal_fd, 0, SEEK_END);
+    if (size <= 0) return;
+    std::string log((size_t)size, '\0');
+    pread_all(wal_fd, &log[0], log.size(), 0, path + ".wal");
+    if (log.size() >= WAL_TRAILER) {
+        size_t off = log.size() - WAL_TRAILER;
+        uint32_t count = get_u32(&log[off]);
+        bool complete = std::memcmp(&log[off + 12], WAL_MAGIC, 8) == 0 &&
+                        off == (size_t)count * (4 + PAGE_SIZE) &&
+                        get_u64(&log[off + 4]) == fnv1a(log.data(), off);
+        if (complete) {
+            for (size_t p = 0; p < off; p += 4 + PAGE_SIZE) {
+                pwrite_all(fd, &log[p + 4], PAGE_SIZE, (off_t)get_u32(&log[p]) * PAGE_SIZE, path);
+            }
+            if (::fdatasync(fd) != 0) throw io_error("fsync", path);
+        }
+    }
+    if (::ftruncate(wal_fd, 0) != 0) throw io_error("truncate", path + ".wal");
+}
+
+std::map<std::string, uint64_t> BTreeStorage::stats() const {
+    std::lock_guard<std::mutex> lock(tree_mtx);
+    return {
+        {"entries", entries},
+        {"pages", page_count},
+        {"height", height},
+        {"cached_pages", frames.size()},
+        {"page_reads", page_reads},
+        {"page_writes", page_writes},
+        {"cache_hits", cache_hits},
+        {"commits", commits}
+    };
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "storage.h"
+#include <condition_variable>
+#include <list>
+#include <unordered_map>
+
+// --- B-TREE STORAGE ---
+// One file of PAGE_SIZE pages: a header page, B+tree nodes with sorted keys
+// (leaves are chained left to right for scans) and overflow chains for
+// values too big to sit in a leaf. A lookup reads one page per level and a
+// range scan then walks the leaf chain, so updating one user or listing one
+// user's history touches O(log n) pages instead of the whole database.
+//
+// Pages are cached in an LRU buffer pool. Commits queue on the IoExecutor
+// and coalesce; the I/O thread applies them, writes every dirtied page to a
+// write-ahead log, fsyncs, then writes the pages in place. A crash mid-way
+// is repaired on open by replaying a complete log, or ignoring a torn one.
+// Deletes don't rebalance: emptied leaves stay in the chain.
+
+class BTreeStorage : public StorageEngine {
+public:
+    static const size_t PAGE_SIZE = 4096;
+    static const size_t MAX_KEY = 512;
+    static const size_t INLINE_MAX = 1024; // Longer values move to overflow pages
+
+    // Throws std::runtime_error if the file can't be opened or isn't a tree.
+    BTreeStorage(const std::string& path, IoExecutor& io, size_t cache_pages = 1024);
+    ~BTreeStorage() override;
+
+    const char* name() const override { return "btree"; }
+    std::optional<std::string> get(const std::string& key) override;
+    void scan(const std::string& from, const std::string& to, const Visit& visit) override;
+    void commit(StorageBatch batch, Completion done = {}, asio::io_context* reply_to = nullptr) override;
+    std::map<std::string, uint64_t> stats() const override;
+    void prepare_fork() override;
+    void after_fork() override;
+    // Held drains wait (and block the I/O thread) with commits piling up
+    // in `pending`, so the page file stays as the child found it
+    void hold_disk_writes(bool held) override;
+
+private:
+    struct Node;
+    struct Frame {
+        std::vector<char> data;
+        bool dirty = false;
+        std::list<uint32_t>::iterator lru;
+    };
+    using Overlay = std::map<std::string, std::optional<std::string>>;
+    using Split = std::optional<std::pair<std::string, uint32_t>>; // Separator, new right sibling
+
+    // Buffer pool (tree_mtx held)
+    char* page(uint32_t id, bool write);
+    void evict();
+    uint32_t alloc_page();
+    void free_page(uint32_t id);
+
+    Node load_node(uint32_t id);
+    void store_node(uint32_t id, const Node& n);
+    uint32_t find_leaf(const std::string& key);
+
+    std::string make_slot(const std::string& value);
+    std::string read_slot(const std::string& slot);
+    void drop_slot(const std::string& slot);
+
+    Split insert(uint32_t id, const std::string& key, std::string slot);
+    void erase(const std::string& key);
+    Split split(uint32_t id, Node& n);
+
+    bool drain(std::string& error);
+    void write_pages();
+    void recover();
+    void read_header();
+    void reload();
+
+    std::string path;
+    IoExecutor& io;
+    size_t cache_pages;
+    int fd = -1;
+    int wal_fd = -1;
+
+    mutable std::mutex mtx;      // pending, applying
+    Overlay pending;             // Committed, not yet picked up by the I/O thread
+    Overlay applying;            // Being written into the tree right now
+    bool held = false;           // See hold_disk_writes()
+    std::condition_variable held_cv;
+
+    mutable std::mutex tree_mtx; // Everything below
+    std::unordered_map<uint32_t, Frame> frames;
+    std::list<uint32_t> lru;     // Front = most recent
+    uint32_t root = 1;
+    uint32_t page_count = 0;
+    uint32_t free_head = 0;
+    uint32_t height = 1;
+    uint64_t entries = 0;
+    bool stale = false;          // A failed drain couldn't reload from the file yet
+    uint64_t page_reads = 0;
+    uint64_t page_writes = 0;
+    uint64_t cache_hits = 0;
+    uint64_t commits = 0;
+};
@@ -0,0 +1,315 @@
+#include "calendar.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// --- DATE MATH ---
+
+static long long floor_div(long long a, long long b) {
+    long long q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (Hinnant's algorithm).
+static long long days_from_civil(long long y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const long long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+
+static const unsigned MONTH_DAYS[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static bool is_leap(long long y) { return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0; }
+
+int weekday_of(long long day) {
+    long long w = (day + 4) % 7; // 1970-01-01 was a Thursday
+    return (int)(w < 0 ? w + 7 : w);
+}
+
+const char* weekday_abbrev(long long day) {
+    static const char* names[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    return names[weekday_of(day)];
+}
+
+long long week_index(long long day) {
+    return floor_div(day + 3, 7); // Day 4 (1970-01-05) was a Monday
+}
+
+long long month_index(long long day) {
+    day += 719468;
+    const long long era = (day >= 0 ? day : day - 146096) / 146097;
+    const unsigned doe = (unsigned)(day - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    long long y = (long long)yoe + era * 400 + (m <= 2);
+    return y * 12 + (m - 1);
+}
+
+int TimeZone::offset_at(time_t t) const {
+    auto it = std::upper_bound(starts.begin(), starts.end(), (long long)t);
+    return offsets[(it - starts.begin()) - 1];
+}
+
+long long civil_day(time_t t, const TimeZone& tz) {
+    return floor_div((long long)t + tz.offset_at(t), 86400);
+}
+
+long long month_start_day(long long month_idx) {
+    long long y = floor_div(month_idx, 12);
+    return days_from_civil(y, (unsigned)(month_idx - y * 12 + 1), 1);
+}
+
+// The offset in force just before local midnight is close enough to find
+// the one in force at it
+time_t day_start(long long day, const TimeZone& tz) {
+    long long local = day * 86400;
+    return (time_t)(local - tz.offset_at((time_t)(local - tz.offset_at((time_t)local))));
+}
+
+// --- POSIX TZ RULES (TZif footer) ---
+
+struct PosixRule {
+    unsigned month = 0, week = 0, wday = 0;
+    long long secs = 7200;
+};
+
+struct PosixTz {
+    int std_off = 0;   // Seconds east of UTC
+    bool has_dst = false;
+    int dst_off = 0;
+    PosixRule start, end;
+};
+
+static bool parse_tz_name(const std::string& s, size_t& i) {
+    if (i < s.size() && s[i] == '<') {
+        size_t close = s.find('>', i);
+        if (close == std::string::npos) return false;
+        i = close + 1;
+        return true;
+    }
+    size_t begin = i;
+    while (i < s.size() && std::isalpha((unsigned char)s[i])) i++;
+    return i - begin >= 3;
+}
+
+// [+-]hh[:mm[:ss]], returned as seconds.
+static bool parse_hms(const std::string& s, size_t& i, long long& out) {
+    int sign = 1;
+    if (i < s.size() && (s[i] == '+' || s[i] == '-')) { if (s[i] == '-') sign = -1; i++; }
+    long long parts[3] = {0, 0, 0};
+    for (int p = 0; p < 3; p++) {
+        if (p > 0) {
+            if (i >= s.size() || s[i] != ':') break;
+            i++;
+        }
+        size_t begin = i;
+        while (i < s.size() && std::isdigit((unsigned char)s[i])) parts[p] = parts[p] * 10 + (s[i++] - '0');
+        if (i == begin) return false;
+    }
+    out = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+    return true;
+}
+
+static bool parse_rule(const std::string& s, size_t& i, PosixRule& r) {
+    if (i >= s.size() || s[i] != 'M') return false; // Julian forms are not used by current tzdata zones
+    i++;
+    unsigned* fields[] = {&r.month, &r.week, &r.wday};
+    for (int f = 0; f < 3; f++) {
+        if (f > 0) {
+            if (i >= s.size() || s[i] != '.') return false;
+            i++;
+        }
+        size_t begin = i;
+        while (i < s.size() && std::isdigit((unsigned char)s[i])) *fields[f] = *fields[f] * 10 + (s[i++] - '0');
+        if (i == begin) return false;
+    }
+    if (r.month < 1 || r.month > 12 || r.week < 1 || r.week > 5 || r.wday > 6) return false;
+    if (i < s.size() && s[i] == '/') {
+        i++;
+        if (!parse_hms(s, i, r.secs)) return false;
+    }
+    return true;
+}
+
+static bool parse_posix_tz(const std::string& s, PosixTz& out) {
+    size_t i = 0;
+    long long off = 0;
+    if (!parse_tz_name(s, i) || !parse_hms(s, i, off)) return false;
+    out.std_off = (int)-off; // POSIX offsets are west-positive
+    if (i >= s.size()) return true;
+    if (!parse_tz_name(s, i)) return false;
+    out.has_dst = true;
+    out.dst_off = out.std_off + 3600;
+    if (i < s.size() && s[i] != ',') {
+        if (!parse_hms(s, i, off)) return false;
+        out.dst_off = (int)-off;
+    }
+    if (i >= s.size() || s[i] != ',') return false;
+    i++;
+    if (!parse_rule(s, i, out.start)) return false;
+    if (i >= s.size() || s[i] != ',') return false;
+    i++;
+    return parse_rule(s, i, out.end);
+}
+
+// Local seconds since epoch at which a rule fires in the given year.
+static long long rule_local_time(const PosixRule& r, long long year) {
+    long long first = days_from_civil(year, r.month, 1);
+    unsigned mdays = MONTH_DAYS[r.month - 1] + (r.month == 2 && is_leap(year) ? 1 : 0);
+    long long day = first + (r.wday - weekday_of(first) + 7) % 7 + (long long)(r.week - 1) * 7;
+    while (day >= first + mdays) day -= 7;
+    return day * 86400 + r.secs;
+}
+
+static void extend_with_rule(TimeZone& tz, const PosixTz& p, long long last_year) {
+    if (!p.has_dst) return; // The table already ends on the permanent offset
+    long long first_year = tz.starts.size() > 1 ? floor_div(month_index(floor_div(tz.starts.back(), 86400)), 12) : 1970;
+    std::vector<std::pair<long long, int>> extra;
+    for (long long y = first_year; y <= last_year; y++) {
+        extra.push_back({rule_local_time(p.start, y) - p.std_off, p.dst_off});
+        extra.push_back({rule_local_time(p.end, y) - p.dst_off, p.std_off});
+    }
+    std::sort(extra.begin(), extra.end());
+    for (const auto& [at, off] : extra) {
+        if (at <= tz.starts.back()) continue;
+        if (off == tz.offsets.back()) continue;
+        tz.starts.push_back(at);
+        tz.offsets.push_back(off);
+    }
+}
+
+// --- TZIF LOADING ---
+
+static long long read_be(const unsigned char* p, int n) {
+    unsigned long long v = 0;
+    for (int k = 0; k < n; k++) v = (v << 8) | p[k];
+    if (n == 4) return (long long)(int32_t)(uint32_t)v;
+    return (long long)v;
+}
+
+static bool load_tzif(const std::string& path, TimeZone& tz) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) return false;
+    std::vector<unsigned char> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if (buf.size() < 44 || std::string(buf.begin(), buf.begin() + 4) != "TZif") return false;
+
+    size_t pos = 0;
+    int time_size = 4;
+    bool v2 = buf[4] >= '2';
+    for (int block = 0; block < (v2 ? 2 : 1); block++) {
+        if (pos + 44 > buf.size()) return false;
+        const unsigned char* h = &buf[pos + 20];
+        long long isutcnt = read_be(h, 4), isstdcnt = read_be(h + 4, 4), leapcnt = read_be(h + 8, 4);
+        long long timecnt = read_be(h + 12, 4), typecnt = read_be(h + 16, 4), charcnt = read_be(h + 20, 4);
+        pos += 44;
+        size_t body = timecnt * time_size + timecnt + typecnt * 6 + charcnt + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+        if (timecnt < 0 || typecnt <= 0 || charcnt < 0 || leapcnt < 0 || isstdcnt < 0 || isutcnt < 0) return false;
+        if (pos + body > buf.size()) return false;
+        if (v2 && block == 0) {
+            pos += body;
+            time_size = 8;
+            continue;
+        }
+        const unsigned char* times = &buf[pos];
+        const unsigned char* idx = times + timecnt * time_size;
+        const unsigned char* types = idx + timecnt;
+
+        // Before the first transition the first non-DST type applies
+        int initial = 0;
+        for (long long t = 0; t < typecnt; t++) {
+            if (types[t * 6 + 4] == 0) { initial = (int)t; break; }
+        }
+        tz.starts = {LLONG_MIN};
+        tz.offsets = {(int)read_be(types + initial * 6, 4)};
+        for (long long k = 0; k < timecnt; k++) {
+            unsigned type = idx[k];
+            if (type >= typecnt) return false;
+            int off = (int)read_be(types + type * 6, 4);
+            if (off == tz.offsets.back()) continue;
+            tz.starts.push_back(read_be(times + k * time_size, time_size));
+            tz.offsets.push_back(off);
+        }
+        pos += body;
+    }
+
+    // v2+ footer: "\n<posix tz>\n" describes transitions past the table
+    if (v2 && pos < buf.size() && buf[pos] == '\n') {
+        size_t end = pos + 1;
+        while (end < buf.size() && buf[end] != '\n') end++;
+        std::string footer(buf.begin() + pos + 1, buf.begin() + end);
+        PosixTz rule;
+        if (!footer.empty() && parse_posix_tz(footer, rule)) extend_with_rule(tz, rule, 2100);
+    }
+    return true;
+}
+
+static bool is_safe_zone_name(const std::string& name) {
+    if (name.empty() || name.size() > 64 || name[0] == '/' || name.find("..") != std::string::npos) return false;
+    for (char c : name) {
+        if (!std::isalnum((unsigned char)c) && c != '/' && c != '_' && c != '-' && c != '+') return false;
+    }
+    return true;
+}
+
+static bool build_zone(const std::string& name, TimeZone& tz) {
+    tz.name = name;
+    if (name == "UTC" || name == "Etc/UTC" || name == "GMT") {
+        tz.starts = {LLONG_MIN};
+        tz.offsets = {0};
+        return true;
+    }
+    // "UTC+05:30" / "UTC-4" fixed offsets (east-positive, unlike POSIX)
+    if (name.size() > 3 && name.compare(0, 3, "UTC") == 0 && (name[3] == '+' || name[3] == '-')) {
+        size_t i = 3;
+        long long off = 0;
+        if (!parse_hms(name, i, off) || i != name.size() || off < -14 * 3600 || off > 14 * 3600) return false;
+        tz.starts = {LLONG_MIN};
+        tz.offsets = {(int)off};
+        return true;
+    }
+    if (!is_safe_zone_name(name)) return false;
+    const char* dir = std::getenv("ZONEINFO");
+    return load_tzif(std::string(dir ? dir : "/usr/share/zoneinfo") + "/" + name, tz);
+}
+
+// --- ZONE REGISTRY ---
+
+static std::mutex zone_mutex;
+static std::map<std::string, std::unique_ptr<TimeZone>> zones;
+
+const TimeZone* find_zone(const std::string& name) {
+    std::lock_guard<std::mutex> lock(zone_mutex);
+    auto it = zones.find(name);
+    if (it != zones.end()) return it->second.get();
+    auto tz = std::make_unique<TimeZone>();
+    if (!build_zone(name, *tz)) return nullptr;
+    const TimeZone* out = tz.get();
+    zones[name] = std::move(tz);
+    return out;
+}
+
+const TimeZone* default_zone() {
+    static const TimeZone* zone = [] {
+        for (const char* var : {"DEFAULT_TZ", "TZ"}) {
+            const char* v = std::getenv(var);
+            if (!v || !*v) continue;
+            const TimeZone* z = find_zone(v[0] == ':' ? v + 1 : v);
+            if (z) return z;
+        }
+        return find_zone("UTC");
+    }();
+    return zone;
+}
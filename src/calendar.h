@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ctime>
+
+// --- CIVIL DAYS ---
+// Timestamps are bucketed into days with pure integer arithmetic against a
+// per-zone table of UTC offset transitions. The table is built once when a
+// zone is first requested, so no libc time calls happen on the hot path.
+
+struct TimeZone {
+    std::string name;
+    std::vector<long long> starts;  // UTC second each offset takes effect (ascending, starts[0] is the minimum)
+    std::vector<int> offsets;       // Seconds east of UTC
+
+    int offset_at(time_t t) const;
+};
+
+// Returns the zone for an IANA name ("America/Toronto") or a fixed offset
+// ("UTC", "UTC-05:00"). Zones are loaded once and live for the whole process.
+// Returns nullptr if the name cannot be resolved.
+const TimeZone* find_zone(const std::string& name);
+
+// Zone used for users without a setting: DEFAULT_TZ, then TZ, then UTC.
+const TimeZone* default_zone();
+
+// Days since 1970-01-01 in the given zone.
+long long civil_day(time_t t, const TimeZone& tz);
+
+// 0 = Sunday
+int weekday_of(long long day);
+const char* weekday_abbrev(long long day);
+
+// Monday-based week index and (year * 12 + month - 1) for a civil day.
+long long week_index(long long day);
+long long month_index(long long day);
+// The first civil day of a month_index().
+long long month_start_day(long long month_idx);
+
+// The UTC second a civil day begins at in the given zone.
+time_t day_start(long long day, const TimeZone& tz);
@@ -0,0 +1,161 @@
+#include "capture.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'R', 'C', 'Y', 'C', 'A', 'P', '0', '1'};
+
+static void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+static void put_bytes(std::string& out, std::string_view s) {
+    put_varint(out, s.size());
+    out.append(s.data(), s.size());
+}
+
+// False at the end of the data rather than reading past it
+static bool get_varint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = (uint8_t)*p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static bool get_bytes(const char*& p, const char* end, std::string& s) {
+    uint64_t n;
+    if (!get_varint(p, end, n) || n > (uint64_t)(end - p)) return false;
+    s.assign(p, (size_t)n);
+    p += n;
+    return true;
+}
+
+void CaptureWriter::open(const std::string& file, uint64_t start_unix_us, uint64_t max) {
+    fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) throw std::runtime_error("open " + file + ": " + std::strerror(errno));
+    path = file;
+    max_bytes = max;
+    std::lock_guard<std::mutex> lock(mtx);
+    buf.assign(MAGIC, 8);
+    buf.append((const char*)&start_unix_us, 8);
+    total_bytes = buf.size();
+}
+
+void CaptureWriter::add(const CapturedRequest& r) {
+    std::string rec;
+    put_varint(rec, r.arrival_us);
+    put_varint(rec, r.duration_us);
+    put_varint(rec, r.status);
+    put_bytes(rec, r.method);
+    put_bytes(rec, r.target);
+    put_bytes(rec, r.user);
+    put_bytes(rec, r.content_type);
+    put_bytes(rec, r.body);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (total_bytes + rec.size() > max_bytes) {
+        dropped_count++;
+        return;
+    }
+    buf += rec;
+    total_bytes += rec.size();
+    record_count++;
+}
+
+size_t CaptureWriter::buffered() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return buf.size();
+}
+
+bool CaptureWriter::flush(std::string& error) {
+    std::lock_guard<std::mutex> write_lock(write_mtx);
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        out.swap(buf);
+    }
+    for (size_t off = 0; off < out.size();) {
+        ssize_t n = ::write(fd, out.data() + off, out.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = "write " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        off += (size_t)n;
+    }
+    return true;
+}
+
+uint64_t CaptureWriter::records() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return record_count;
+}
+
+uint64_t CaptureWriter::dropped() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return dropped_count;
+}
+
+uint64_t CaptureWriter::bytes() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return total_bytes;
+}
+
+std::vector<CapturedRequest> read_capture(const std::string& path, uint64_t* start_unix_us) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) throw std::runtime_error("can't open " + path);
+    std::stringstream image;
+    image << in.rdbuf();
+    std::string data = image.str();
+    if (data.size() < 16 || std::memcmp(data.data(), MAGIC, 8) != 0) throw std::runtime_error(path + " is not a capture");
+    if (start_unix_us) std::memcpy(start_unix_us, data.data() + 8, 8);
+
+    std::vector<CapturedRequest> out;
+    const char* p = data.data() + 16;
+    const char* end = data.data() + data.size();
+    while (p < end) {
+        CapturedRequest r;
+        uint64_t status;
+        bool ok = get_varint(p, end, r.arrival_us) && get_varint(p, end, r.duration_us) && get_varint(p, end, status) &&
+                  get_bytes(p, end, r.method) && get_bytes(p, end, r.target) && get_bytes(p, end, r.user) &&
+                  get_bytes(p, end, r.content_type) && get_bytes(p, end, r.body);
+        if (!ok) break; // Torn tail
+        r.status = (uint32_t)status;
+        out.push_back(std::move(r));
+    }
+    std::stable_sort(out.begin(), out.end(), [](const CapturedRequest& a, const CapturedRequest& b) {
+        return a.arrival_us < b.arrival_us;
+    });
+    return out;
+}
+
+std::string redact_form(std::string_view body) {
+    std::string out;
+    out.reserve(body.size());
+    size_t pos = 0;
+    while (pos <= body.size()) {
+        size_t amp = body.find('&', pos);
+        if (amp == std::string_view::npos) amp = body.size();
+        std::string_view field = body.substr(pos, amp - pos);
+        size_t eq = field.find('=');
+        std::string_view name = field.substr(0, eq);
+        if (eq != std::string_view::npos && name.size() >= 8 && name.substr(name.size() - 8) == "password") {
+            field = field.substr(0, eq + 1);
+        }
+        if (pos > 0) out += '&';
+        out.append(field.data(), field.size());
+        pos = amp + 1;
+    }
+    return out;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- TRAFFIC CAPTURE ---
+// CAPTURE_PATH records every request the server receives so bench/replay
+// can send the same traffic to another build. The file is
+//   "RCYCAP01", capture start (unix µs, u64)
+//   per request: arrival (µs after start), handling time (µs), status as
+//   varints, then method, path and query, "user" cookie, Content-Type and
+//   body, each a varint length and its bytes
+// Records are appended as requests finish, so arrivals are only roughly in
+// order; readers sort them. A record cut short by a crash is ignored.
+
+struct CapturedRequest {
+    uint64_t arrival_us = 0;  // Since the capture started
+    uint64_t duration_us = 0; // Handling time on the server that recorded it
+    uint32_t status = 0;
+    std::string method;
+    std::string target;       // Path and query
+    std::string user;         // "user" cookie; empty when logged out
+    std::string content_type;
+    std::string body;         // Password fields blanked (redact_form)
+};
+
+class CaptureWriter {
+public:
+    // Truncates `path` and writes the header. Throws std::runtime_error.
+    void open(const std::string& path, uint64_t start_unix_us, uint64_t max_bytes);
+    bool is_open() const { return fd >= 0; }
+    const std::string& file() const { return path; }
+
+    // Buffers one record; any thread. Past max_bytes records are dropped.
+    void add(const CapturedRequest& r);
+    size_t buffered() const;
+    // Appends what add() buffered (on the I/O thread, see main.cpp).
+    bool flush(std::string& error);
+
+    uint64_t records() const;
+    uint64_t dropped() const;
+    uint64_t bytes() const;
+
+private:
+    std::string path;
+    int fd = -1;
+    uint64_t max_bytes = 0;
+    mutable std::mutex mtx; // buf and the counters
+    std::string buf;
+    uint64_t total_bytes = 0; // Written and buffered
+    uint64_t record_count = 0;
+    uint64_t dropped_count = 0;
+    std::mutex write_mtx;     // One flush at a time
+};
+
+// Every complete record, sorted by arrival. Throws std::runtime_error if
+// `path` can't be read or isn't a capture.
+std::vector<CapturedRequest> read_capture(const std::string& path, uint64_t* start_unix_us = nullptr);
+
+// A form body with the value of every "...password" field emptied
+std::string redact_form(std::string_view body);
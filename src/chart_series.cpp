@@ -0,0 +1,96 @@
+#include "chart_series.h"
+#include "codec.h"
+#include <algorithm>
+#include <cmath>
+
+std::vector<SeriesPoint> lttb(const std::vector<SeriesPoint>& in, size_t threshold) {
+    if (threshold < 3 || in.size() <= threshold) return in;
+
+    std::vector<SeriesPoint> out;
+    out.reserve(threshold);
+    out.push_back(in.front());
+
+    // Interior points are split into threshold - 2 buckets
+    double every = (double)(in.size() - 2) / (double)(threshold - 2);
+    size_t a = 0;
+    for (size_t i = 0; i < threshold - 2; i++) {
+        // Average of the next bucket is the third triangle vertex
+        size_t next_start = (size_t)std::floor((i + 1) * every) + 1;
+        size_t next_end = std::min((size_t)std::floor((i + 2) * every) + 1, in.size());
+        if (next_start >= next_end) next_start = next_end - 1;
+        double avg_x = 0, avg_y = 0;
+        for (size_t k = next_start; k < next_end; k++) {
+            avg_x += (double)in[k].x;
+            avg_y += (double)in[k].y;
+        }
+        avg_x /= (double)(next_end - next_start);
+        avg_y /= (double)(next_end - next_start);
+
+        size_t start = (size_t)std::floor(i * every) + 1;
+        size_t end = (size_t)std::floor((i + 1) * every) + 1;
+        double ax = (double)in[a].x, ay = (double)in[a].y;
+        double best = -1;
+        size_t pick = start;
+        for (size_t k = start; k < end; k++) {
+            double area = std::fabs((ax - avg_x) * ((double)in[k].y - ay) - (ax - (double)in[k].x) * (avg_y - ay));
+            if (area > best) {
+                best = area;
+                pick = k;
+            }
+        }
+        out.push_back(in[pick]);
+        a = pick;
+    }
+    out.push_back(in.back());
+    return out;
+}
+
+static void put_i32(std::string& buf, long long v) {
+    uint32_t u = (uint32_t)(int32_t)v;
+    for (int k = 0; k < 4; k++) buf += (char)((u >> (8 * k)) & 0xFF);
+}
+
+std::string encode_series(const std::vector<SeriesPoint>& pts) {
+    long long x0 = pts.empty() ? 0 : pts.front().x;
+    std::string xs, ys;
+    xs.reserve(pts.size() * 4);
+    ys.reserve(pts.size() * 4);
+    long long px = x0, py = 0;
+    for (const auto& p : pts) {
+        put_i32(xs, p.x - px);
+        put_i32(ys, p.y - py);
+        px = p.x;
+        py = p.y;
+    }
+    return "{\"n\":" + std::to_string(pts.size()) + ",\"x0\":" + std::to_string(x0) +
+           ",\"x\":\"" + base64_encode(xs) + "\",\"y\":\"" + base64_encode(ys) + "\"}";
+}
+
+std::shared_ptr<const std::string> ChartSeriesCache::get(const std::string& user, const std::function<std::vector<SeriesPoint>()>& load, size_t budget) {
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Entry& e = entries[user];
+        if (e.built_version == e.version && e.built_budget == budget) return e.payload;
+        version = e.version;
+    }
+    auto payload = std::make_shared<const std::string>(encode_series(lttb(load(), budget)));
+    std::lock_guard<std::mutex> lock(mtx);
+    Entry& e = entries[user];
+    if (e.version == version) {
+        e.payload = payload;
+        e.built_version = version;
+        e.built_budget = budget;
+    }
+    return payload;
+}
+
+void ChartSeriesCache::invalidate(const std::string& user) {
+    std::lock_guard<std::mutex> lock(mtx);
+    entries[user].version++;
+}
+
+void ChartSeriesCache::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto& [user, e] : entries) e.version++;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --- CHART SERIES ---
+// The debt chart is downsampled to a fixed point budget with
+// Largest-Triangle-Three-Buckets and shipped as base64 little-endian int32
+// deltas, so the page size and Chart.js work stay bounded however long a
+// user's history gets.
+
+struct SeriesPoint {
+    long long x; // Unix seconds
+    long long y; // Debt seconds
+};
+
+// Keeps the first and last point and `threshold` points in total.
+std::vector<SeriesPoint> lttb(const std::vector<SeriesPoint>& in, size_t threshold);
+
+// JSON object: {"n":N,"x0":first_ts,"x":"<b64 deltas>","y":"<b64 deltas>"}
+std::string encode_series(const std::vector<SeriesPoint>& pts);
+
+class ChartSeriesCache {
+public:
+    // Returns the cached payload, rebuilding it when the user changed since.
+    // Shared so hits hand it out without copying.
+    std::shared_ptr<const std::string> get(const std::string& user, const std::function<std::vector<SeriesPoint>()>& load, size_t budget);
+    void invalidate(const std::string& user);
+    void clear();
+
+private:
+    struct Entry {
+        uint64_t version = 0;
+        uint64_t built_version = UINT64_MAX;
+        size_t built_budget = 0;
+        std::shared_ptr<const std::string> payload;
+    };
+    std::mutex mtx;
+    std::map<std::string, Entry> entries;
+};
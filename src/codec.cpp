@@ -0,0 +1,156 @@
+#include "codec.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+
+using json = nlohmann::json;
+
+std::optional<Encoding> encoding_from_name(std::string_view name) {
+    if (name == "json") return Encoding::Json;
+    if (name == "cbor") return Encoding::Cbor;
+    if (name == "msgpack") return Encoding::MsgPack;
+    return std::nullopt;
+}
+
+const char* encoding_name(Encoding e) {
+    switch (e) {
+    case Encoding::Cbor: return "cbor";
+    case Encoding::MsgPack: return "msgpack";
+    case Encoding::Json: break;
+    }
+    return "json";
+}
+
+const char* mime_type(Encoding e) {
+    switch (e) {
+    case Encoding::Cbor: return "application/cbor";
+    case Encoding::MsgPack: return "application/msgpack";
+    case Encoding::Json: break;
+    }
+    return "application/json";
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && std::isspace((unsigned char)s.front())) s.remove_prefix(1);
+    while (!s.empty() && std::isspace((unsigned char)s.back())) s.remove_suffix(1);
+    return s;
+}
+
+static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+// Ties go to the exact type over a wildcard, then to whichever came first
+std::optional<Encoding> negotiate(std::string_view accept) {
+    if (trim(accept).empty()) return Encoding::Json;
+    std::optional<Encoding> best;
+    double best_q = 0;
+    bool best_exact = false;
+    while (!accept.empty()) {
+        size_t comma = accept.find(',');
+        std::string_view range = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+        size_t semi = range.find(';');
+        std::string_view type = trim(range.substr(0, semi));
+        double q = 1;
+        while (semi != std::string_view::npos) {
+            range = range.substr(semi + 1);
+            semi = range.find(';');
+            std::string_view param = trim(range.substr(0, semi));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+            }
+        }
+        if (q <= 0) continue;
+
+        std::optional<Encoding> offer;
+        bool exact = true;
+        if (iequals(type, "application/json")) offer = Encoding::Json;
+        else if (iequals(type, "application/cbor")) offer = Encoding::Cbor;
+        else if (iequals(type, "application/msgpack") || iequals(type, "application/x-msgpack") ||
+                 iequals(type, "application/vnd.msgpack")) offer = Encoding::MsgPack;
+        else if (type == "*/*" || iequals(type, "application/*")) {
+            offer = Encoding::Json;
+            exact = false;
+        }
+        if (!offer) continue;
+
+        if (!best || q > best_q || (q == best_q && exact && !best_exact)) {
+            best = offer;
+            best_q = q;
+            best_exact = exact;
+        }
+    }
+    return best;
+}
+
+std::string encode(const json& j, Encoding e) {
+    std::string out;
+    switch (e) {
+    case Encoding::Cbor: json::to_cbor(j, out); break;
+    case Encoding::MsgPack: json::to_msgpack(j, out); break;
+    case Encoding::Json: out = j.dump(); break;
+    }
+    return out;
+}
+
+json decode_object(std::string_view bytes) {
+    unsigned char b = bytes.empty() ? 0 : (unsigned char)bytes[0];
+    if (b >= 0xa0 && b <= 0xbf) return json::from_cbor(bytes.begin(), bytes.end());
+    if ((b >= 0x80 && b <= 0x8f) || b == 0xde || b == 0xdf) return json::from_msgpack(bytes.begin(), bytes.end());
+    return json::parse(bytes.begin(), bytes.end());
+}
+
+static const char* BASE64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64_encode(std::string_view bytes) {
+    std::string out;
+    out.reserve((bytes.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < bytes.size(); i += 3) {
+        uint32_t v = ((uint8_t)bytes[i] << 16) | ((uint8_t)bytes[i + 1] << 8) | (uint8_t)bytes[i + 2];
+        out += BASE64[v >> 18];
+        out += BASE64[(v >> 12) & 63];
+        out += BASE64[(v >> 6) & 63];
+        out += BASE64[v & 63];
+    }
+    if (i < bytes.size()) {
+        uint32_t v = (uint8_t)bytes[i] << 16;
+        if (i + 1 < bytes.size()) v |= (uint8_t)bytes[i + 1] << 8;
+        out += BASE64[v >> 18];
+        out += BASE64[(v >> 12) & 63];
+        out += (i + 1 < bytes.size()) ? BASE64[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+    return out;
+}
+
+std::optional<std::string> base64_decode(std::string_view text) {
+    if (text.size() % 4 != 0) return std::nullopt;
+    int value[256];
+    std::fill(std::begin(value), std::end(value), -1);
+    for (int k = 0; k < 64; k++) value[(uint8_t)BASE64[k]] = k;
+
+    std::string out;
+    out.reserve(text.size() / 4 * 3);
+    for (size_t i = 0; i < text.size(); i += 4) {
+        bool last = i + 4 == text.size();
+        int pad = last ? (text[i + 3] == '=') + (text[i + 2] == '=') : 0;
+        uint32_t v = 0;
+        for (int k = 0; k < 4; k++) {
+            int d = k < 4 - pad ? value[(uint8_t)text[i + k]] : 0;
+            if (d < 0) return std::nullopt;
+            v = v << 6 | (uint32_t)d;
+        }
+        out += (char)(v >> 16);
+        if (pad < 2) out += (char)(v >> 8);
+        if (pad < 1) out += (char)v;
+    }
+    return out;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "json.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+
+// --- WIRE ENCODINGS ---
+// The same JSON values as text, CBOR or MessagePack (nlohmann's to_cbor /
+// to_msgpack). API clients pick one with Accept; stored records and the
+// db file use PERSIST_FORMAT. Every stored value is an object, and the
+// three encodings start objects with disjoint bytes ('{', 0xa0-0xbf,
+// 0x80-0x8f/0xde/0xdf), so reads never need to be told which one wrote it.
+
+enum class Encoding { Json, Cbor, MsgPack };
+
+// "json", "cbor" or "msgpack"
+std::optional<Encoding> encoding_from_name(std::string_view name);
+const char* encoding_name(Encoding e);
+const char* mime_type(Encoding e);
+
+// Best encoding for an Accept header, honouring q-values; JSON when the
+// header is empty or only has wildcards. Nothing if no offer is acceptable.
+std::optional<Encoding> negotiate(std::string_view accept);
+
+std::string encode(const nlohmann::json& j, Encoding e);
+// Throws nlohmann::json::exception on malformed input.
+nlohmann::json decode_object(std::string_view bytes);
+
+// Standard alphabet, padded: binary inside a JSON string
+std::string base64_encode(std::string_view bytes);
+// Nothing if `text` isn't padded base64.
+std::optional<std::string> base64_decode(std::string_view text);
@@ -0,0 +1,185 @@
+#include "debt_history.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+uint64_t zigzag(long long v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+long long unzigzag(uint64_t u) {
+    return (long long)(u >> 1) ^ -(long long)(u & 1);
+}
+
+void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+// Advances p; throws rather than read past end
+uint64_t get_varint(const uint8_t*& p, const uint8_t* end) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) throw std::runtime_error("debt history block truncated");
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    throw std::runtime_error("debt history varint too long");
+}
+
+long long predict(long long prev_snapshot, long long gap, long long delta) {
+    return std::max(0LL, prev_snapshot - gap) + delta;
+}
+
+} // namespace
+
+void DebtSeries::encode(Block& b, const DebtPoint& p) {
+    long long gap = 0;
+    if (b.count == 0) {
+        put_varint(b.ts, zigzag(p.ts));
+        b.first_ts = b.last_ts = p.ts;
+    } else {
+        gap = p.ts - b.prev_ts;
+        put_varint(b.ts, zigzag(gap - b.prev_gap));
+        b.first_ts = std::min(b.first_ts, p.ts);
+        b.last_ts = std::max(b.last_ts, p.ts);
+    }
+    int sign = p.delta > 0 ? 0 : 1;
+    put_varint(b.delta, zigzag(p.delta - b.prev_delta[sign]) << 1 | (uint64_t)sign);
+    put_varint(b.snapshot, zigzag(p.snapshot - predict(b.prev_snapshot, gap, p.delta)));
+
+    b.prev_ts = p.ts;
+    b.prev_gap = gap;
+    b.prev_delta[sign] = p.delta;
+    b.prev_snapshot = p.snapshot;
+    b.count++;
+}
+
+void DebtSeries::decode(const Block& b, std::vector<DebtPoint>& out, time_t from, time_t to) {
+    const uint8_t* ts = (const uint8_t*)b.ts.data();
+    const uint8_t* ts_end = ts + b.ts.size();
+    const uint8_t* delta = (const uint8_t*)b.delta.data();
+    const uint8_t* delta_end = delta + b.delta.size();
+    const uint8_t* snap = (const uint8_t*)b.snapshot.data();
+    const uint8_t* snap_end = snap + b.snapshot.size();
+
+    time_t prev_ts = 0;
+    long long prev_gap = 0, prev_snapshot = 0;
+    long long prev_delta[2] = {0, 0};
+    for (uint32_t i = 0; i < b.count; i++) {
+        DebtPoint p;
+        long long gap = 0;
+        if (i == 0) {
+            p.ts = unzigzag(get_varint(ts, ts_end));
+        } else {
+            gap = prev_gap + unzigzag(get_varint(ts, ts_end));
+            p.ts = prev_ts + gap;
+        }
+        uint64_t code = get_varint(delta, delta_end);
+        int sign = (int)(code & 1);
+        p.delta = prev_delta[sign] + unzigzag(code >> 1);
+        p.snapshot = predict(prev_snapshot, gap, p.delta) + unzigzag(get_varint(snap, snap_end));
+
+        prev_ts = p.ts;
+        prev_gap = gap;
+        prev_delta[sign] = p.delta;
+        prev_snapshot = p.snapshot;
+        if (p.ts >= from && p.ts < to) out.push_back(p);
+    }
+}
+
+void DebtSeries::append(const DebtPoint& p) {
+    if (blocks.empty() || blocks.back().count == BLOCK_POINTS) blocks.emplace_back();
+    changed_from = std::min(changed_from, blocks.size() - 1);
+    encode(blocks.back(), p);
+    count++;
+}
+
+bool DebtSeries::pop() {
+    if (blocks.empty()) return false;
+    std::vector<DebtPoint> pts;
+    decode(blocks.back(), pts, std::numeric_limits<time_t>::min(), std::numeric_limits<time_t>::max());
+    pts.pop_back();
+    changed_from = std::min(changed_from, blocks.size() - 1);
+    blocks.back() = Block();
+    for (const DebtPoint& p : pts) encode(blocks.back(), p);
+    if (pts.empty()) blocks.pop_back();
+    count--;
+    return true;
+}
+
+size_t DebtSeries::bytes() const {
+    size_t n = 0;
+    for (size_t i = 0; i < blocks.size(); i++) n += block(i).size();
+    return n;
+}
+
+std::vector<DebtPoint> DebtSeries::points(time_t from, time_t to) const {
+    std::vector<DebtPoint> out;
+    if (from <= std::numeric_limits<time_t>::min() && to >= std::numeric_limits<time_t>::max()) out.reserve(count);
+    for (const Block& b : blocks) {
+        if (b.last_ts < from || b.first_ts >= to) continue;
+        decode(b, out, from, to);
+    }
+    return out;
+}
+
+// count, then the lengths of the first two columns, then the columns
+std::string DebtSeries::block(size_t i) const {
+    const Block& b = blocks[i];
+    std::string out;
+    out.reserve(12 + b.ts.size() + b.delta.size() + b.snapshot.size());
+    put_varint(out, b.count);
+    put_varint(out, b.ts.size());
+    put_varint(out, b.delta.size());
+    out += b.ts;
+    out += b.delta;
+    out += b.snapshot;
+    return out;
+}
+
+void DebtSeries::load_block(std::string_view bytes) {
+    const uint8_t* p = (const uint8_t*)bytes.data();
+    const uint8_t* end = p + bytes.size();
+    uint64_t n = get_varint(p, end);
+    uint64_t ts_len = get_varint(p, end);
+    uint64_t delta_len = get_varint(p, end);
+    if (n == 0 || n > BLOCK_POINTS || ts_len > (uint64_t)(end - p) || delta_len > (uint64_t)(end - p) - ts_len) {
+        throw std::runtime_error("debt history block malformed");
+    }
+    Block raw;
+    raw.count = (uint32_t)n;
+    raw.ts.assign((const char*)p, ts_len);
+    raw.delta.assign((const char*)p + ts_len, delta_len);
+    raw.snapshot.assign((const char*)p + ts_len + delta_len, end - p - ts_len - delta_len);
+
+    // Decoding restores the encoder state and checks the columns add up
+    std::vector<DebtPoint> pts;
+    decode(raw, pts, std::numeric_limits<time_t>::min(), std::numeric_limits<time_t>::max());
+    Block b;
+    for (const DebtPoint& pt : pts) encode(b, pt);
+    if (b.ts.size() != raw.ts.size() || b.delta.size() != raw.delta.size() || b.snapshot.size() != raw.snapshot.size()) {
+        throw std::runtime_error("debt history block malformed");
+    }
+    blocks.push_back(std::move(b));
+    count += n;
+}
+
+void DebtSeries::truncate_blocks(size_t n) {
+    while (blocks.size() > n) {
+        count -= blocks.back().count;
+        blocks.pop_back();
+    }
+    changed_from = std::min(changed_from, blocks.size());
+}
+
+size_t DebtSeries::take_changed() {
+    size_t from = std::min(changed_from, blocks.size());
+    changed_from = blocks.size();
+    return from;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- DEBT HISTORY ---
+// Every point a user's debt chart has ever had (vices, virtues, bailouts):
+// when, what the action did to the debt, and the debt right after it. The
+// feed only keeps the household's last 100 entries; this keeps everything,
+// so it is stored compactly. Points go into blocks of BLOCK_POINTS, and a
+// block holds one varint column per field:
+//   ts        delta-of-delta, so evenly spaced actions cost a byte each
+//   delta     zig-zag, against the previous delta of the same sign: the
+//             vice cost and the virtue reward repeat, so usually one byte
+//   snapshot  zig-zag, against what the decay rule predicts (the previous
+//             debt less the seconds since, floored at 0, plus the delta);
+//             one byte unless the user was bankrupt or bailed out
+// Every block starts from nothing, so a range query decodes only the blocks
+// that overlap it and an append only ever re-encodes the last one.
+
+struct DebtPoint {
+    time_t ts = 0;
+    long long delta = 0;    // What the action did to the debt
+    long long snapshot = 0; // Debt seconds right after it
+};
+
+const size_t BLOCK_POINTS = 128;
+
+class DebtSeries {
+public:
+    // Points are expected oldest first, but anything round-trips
+    void append(const DebtPoint& p);
+    // Takes the newest point back (undo). False if there is none.
+    bool pop();
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    // Encoded bytes, block headers included
+    size_t bytes() const;
+
+    // Points with from <= ts < to, oldest first. Blocks that cannot
+    // overlap the range are skipped without decoding.
+    std::vector<DebtPoint> points(time_t from = std::numeric_limits<time_t>::min(),
+                                  time_t to = std::numeric_limits<time_t>::max()) const;
+
+    // Blocks in their stored form, oldest first; only the last can be short
+    size_t block_count() const { return blocks.size(); }
+    std::string block(size_t i) const;
+    // Appends a block as block() gave it. Throws std::runtime_error if it
+    // is malformed.
+    void load_block(std::string_view bytes);
+    // Drops blocks from the nth on, so a replica can load changed ones again
+    void truncate_blocks(size_t n);
+    // Index of the first block changed since the last call (block_count()
+    // if none), and starts tracking afresh.
+    size_t take_changed();
+
+private:
+    struct Block {
+        uint32_t count = 0;
+        time_t first_ts = 0, last_ts = 0; // Smallest and largest ts, for skipping
+        std::string ts, delta, snapshot;  // The columns
+        // Encoder state after the last point
+        time_t prev_ts = 0;
+        long long prev_gap = 0;
+        long long prev_delta[2] = {0, 0}; // Positive, not positive
+        long long prev_snapshot = 0;
+    };
+    static void encode(Block& b, const DebtPoint& p);
+    static void decode(const Block& b, std::vector<DebtPoint>& out, time_t from, time_t to);
+
+    std::vector<Block> blocks;
+    size_t count = 0;
+    size_t changed_from = 0;
+};
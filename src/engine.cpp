@@ -0,0 +1,299 @@
+#include "engine.h"
+#include "memory.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+User* Engine::find_user_by_name(const std::string& name) {
+    std::string id = name;
+    std::transform(id.begin(), id.end(), id.begin(), ::tolower);
+    auto it = users.find(id);
+    return it == users.end() ? nullptr : &it->second;
+}
+
+const TimeZone& Engine::zone_for_name(const std::string& name) {
+    User* u = find_user_by_name(name);
+    return u ? *u->zone : *default_zone();
+}
+
+User& Engine::add_user(User u) {
+    MemScope mem(MemTag::Users);
+    std::string id = u.id;
+    User& added = users[id] = std::move(u);
+    events.load(added, {genesis_event(added)});
+    refresh_rankings(added);
+    changed(added);
+    return added;
+}
+
+// Their feed entries stay: the feed is the household's history
+void Engine::remove_user(const std::string& id) {
+    auto it = users.find(id);
+    if (it == users.end()) return;
+    analytics.erase(it->second.name);
+    debt_history.erase(it->second.name);
+    charts.invalidate(it->second.name);
+    leaderboards.remove(id);
+    events.erase(id);
+    changed_users.insert(id);
+    users.erase(it);
+    changed();
+}
+
+long long Engine::add_log(const std::string& user, const std::string& action, const std::string& msg,
+                          const std::string& color, long long delta, long long snapshot, time_t at) {
+    MemScope mem(MemTag::Feed);
+    ActivityLog log;
+    log.id = ++next_log_id;
+    log.user_name = user;
+    log.action = action;
+    log.message = msg;
+    log.timestamp = at ? at : std::time(nullptr);
+    log.color = color;
+    log.change_delta = delta;
+    log.debt_snapshot = snapshot;
+    {
+        MemScope index(MemTag::Search);
+        search.add(log);
+    }
+    activity_feed.append(log);
+    analytics.apply(user, action, log.timestamp, snapshot, zone_for_name(user));
+    if (charted_action(action)) debt_history[user].append({log.timestamp, delta, snapshot});
+    charts.invalidate(user);
+    changed();
+    return log.id;
+}
+
+void Engine::refresh_rankings(const User& u) {
+    MemScope mem(MemTag::Users);
+    long long projected_clean = u.debt_seconds > 0 ? (long long)u.last_update + u.debt_seconds : 0;
+    leaderboards.update(Board::Debt, u.id, u.locked ? 1 : 0, u.locked ? u.debt_seconds : projected_clean);
+    leaderboards.update(Board::Streak, u.id, -u.streak);
+    leaderboards.update(Board::Clean, u.id, u.last_vice);
+    WindowCounts w = analytics.week(u.name, week_index(civil_day(std::time(nullptr), *u.zone)));
+    leaderboards.update(Board::Virtues, u.id, -(w.virtue1 + w.virtue2));
+}
+
+void Engine::check_achievements(User& u) {
+    time_t now = std::time(nullptr);
+    double days_clean = std::difftime(now, u.last_vice) / 86400.0;
+
+    for (int m : CLEAN_MILESTONES) {
+        if (days_clean >= m && u.highest_clean_milestone < m) {
+            u.highest_clean_milestone = m;
+            changed_users.insert(u.id);
+            add_log(u.name, "achievement", "🏆 ACHIEVEMENT: Clean for " + std::to_string(m) + " days!", "#FFD700", 0, u.debt_seconds);
+        }
+    }
+}
+
+void Engine::update_decay(User& u) {
+    if (u.locked) return;
+    time_t now = std::time(nullptr);
+    long long seconds_passed = (long long)std::difftime(now, u.last_update);
+    if (u.debt_seconds > 0) {
+        u.debt_seconds -= seconds_passed;
+        if (u.debt_seconds < 0) u.debt_seconds = 0;
+    }
+    u.last_update = now;
+    if (announce_milestones) check_achievements(u);
+    refresh_rankings(u);
+}
+
+void Engine::record_vice(User& u, UserEvent ev) {
+    time_t ts = ev.ts;
+    long long before = u.debt_seconds;
+    events.append(u, std::move(ev));
+    long long cost = u.debt_seconds - before;
+
+    double days = (double)cost / (double)DAY_SEC;
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << days;
+    std::string msg = "Indulged in " + u.vice + " (+" + ss.str() + "d)";
+    events.add_log_id(u.id, add_log(u.name, "vice", msg, "#ff5252", cost, u.debt_seconds, ts));
+    if (u.locked) {
+        events.add_log_id(u.id, add_log(u.name, "locked", "WENT BANKRUPT.", "#ff0000", 0, u.debt_seconds, ts));
+    }
+}
+
+void Engine::record_virtue(User& u, UserEvent ev) {
+    time_t ts = ev.ts;
+    int virtue_num = ev.virtue;
+    long long before = u.debt_seconds;
+    int streak_before = u.virtue_streak_days;
+    events.append(u, std::move(ev));
+
+    if (u.virtue_streak_days != streak_before) {
+        int milestones[] = {10, 25, 50, 100};
+        for (int m : milestones) {
+            if (u.virtue_streak_days == m) {
+                events.add_log_id(u.id, add_log(u.name, "achievement", "🔥 STREAK: " + std::to_string(m) + " days of virtues!", "#FFD700", 0, u.debt_seconds, ts));
+            }
+        }
+    }
+
+    long long removed = before - u.debt_seconds;
+    std::string v_name = (virtue_num == 1) ? u.virtue1_name : u.virtue2_name;
+    std::string col = (virtue_num == 1) ? "#2196F3" : "#9c27b0";
+    std::string action_key = (virtue_num == 1) ? "virtue1" : "virtue2";
+    events.add_log_id(u.id, add_log(u.name, action_key, "Completed: " + v_name + " (-1d)", col, -removed, u.debt_seconds, ts));
+}
+
+void Engine::add_vice(User& u) {
+    update_decay(u);
+    if (u.locked) return;
+    UserEvent ev;
+    ev.type = EventType::Vice;
+    ev.ts = u.last_update;
+    record_vice(u, std::move(ev));
+    refresh_rankings(u);
+    changed(u);
+}
+
+bool Engine::perform_virtue(User& u, int virtue_num) {
+    update_decay(u);
+    if (u.locked) return false;
+    time_t now = u.last_update;
+    time_t last_track = (virtue_num == 1) ? u.last_v1 : u.last_v2;
+    if (std::difftime(now, last_track) < ACTION_COOLDOWN) return false;
+
+    UserEvent ev;
+    ev.type = EventType::Virtue;
+    ev.ts = now;
+    ev.virtue = virtue_num;
+    record_virtue(u, std::move(ev));
+    refresh_rankings(u);
+    changed(u);
+    return true;
+}
+
+void Engine::reset_user(User& u, const std::string& verifier) {
+    UserEvent ev;
+    ev.type = EventType::Reset;
+    ev.ts = std::time(nullptr);
+    ev.by = verifier;
+    events.append(u, std::move(ev));
+    events.add_log_id(u.id, add_log(u.name, "reset", "Bailed out by " + verifier + ".", "#4CAF50", 0, u.debt_seconds));
+    refresh_rankings(u);
+    changed(u);
+}
+
+void Engine::change_contract(User& u, const User& terms) {
+    update_decay(u);
+    UserEvent ev;
+    ev.type = EventType::Contract;
+    ev.ts = u.locked ? std::time(nullptr) : u.last_update;
+    ev.state = std::make_shared<User>(terms);
+    events.append(u, std::move(ev));
+    refresh_rankings(u);
+    changed(u);
+}
+
+BatchResult Engine::apply_batch(User& u, const std::vector<OfflineAction>& actions) {
+    BatchResult result;
+    time_t now = std::time(nullptr);
+    const UserEvent* latest = events.last(u.id);
+    time_t floor = latest ? latest->ts : 0;
+
+    // Dry run on a copy: nothing is touched unless every action passes
+    std::vector<const OfflineAction*> todo;
+    std::vector<std::string> seen;
+    std::optional<User> sim;
+    time_t prev = floor;
+    for (size_t i = 0; i < actions.size(); i++) {
+        const OfflineAction& a = actions[i];
+        auto fail = [&](const std::string& why) {
+            result.error = why;
+            result.failed_at = i;
+            return result;
+        };
+        if (a.key.empty()) return fail("missing key");
+        if (a.ts > now + CLOCK_SKEW) return fail("in the future");
+        if (std::find(seen.begin(), seen.end(), a.key) != seen.end()) {
+            result.duplicates++;
+            continue;
+        }
+        seen.push_back(a.key);
+        time_t ts = std::min(a.ts, now);
+        // A retry may come after our clock caught up with one that ran ahead
+        if (events.has_key(u.id, a.key, ts - CLOCK_SKEW)) {
+            result.duplicates++;
+            continue;
+        }
+        if (ts < prev) return fail(ts < floor ? "before the latest recorded action" : "out of order");
+        prev = ts;
+
+        if (!sim) sim = events.state_at(u, ts);
+        if (!sim) return fail("before the account existed");
+        UserEvent ev;
+        ev.type = a.type;
+        ev.ts = ts;
+        ev.virtue = a.virtue;
+        // Decay never unlocks, so the state before ev's own decay will do
+        if (sim->locked) return fail("bankrupt");
+        if (a.type == EventType::Virtue) {
+            time_t last_track = (a.virtue == 1) ? sim->last_v1 : sim->last_v2;
+            if (std::difftime(ts, last_track) < ACTION_COOLDOWN) return fail("cooldown");
+        }
+        apply_event(*sim, ev, policy());
+        todo.push_back(&a);
+    }
+
+    holding_changes = true;
+    for (const OfflineAction* a : todo) {
+        time_t ts = std::min(a->ts, now);
+        User at = *events.state_at(u, ts);
+        UserEvent ev;
+        ev.type = a->type;
+        ev.ts = ts;
+        ev.virtue = a->virtue;
+        ev.key = a->key;
+        if (a->type == EventType::Vice) record_vice(at, std::move(ev));
+        else record_virtue(at, std::move(ev));
+        u = std::move(at);
+        result.applied++;
+    }
+    // Milestones already announced since the last event stay announced
+    u.highest_clean_milestone = std::max(u.highest_clean_milestone, u.clean_milestone(now));
+    update_decay(u);
+    holding_changes = false;
+    if (result.applied) changed(u);
+    return result;
+}
+
+bool Engine::can_undo(const User& u, time_t now) const {
+    const UserEvent* last = events.last(u.id);
+    if (!last || (last->type != EventType::Vice && last->type != EventType::Virtue)) return false;
+    return std::difftime(now, last->ts) < 600;
+}
+
+bool Engine::perform_undo(User& u) {
+    time_t now = std::time(nullptr);
+    if (!can_undo(u, now)) return false;
+
+    // Take the event's feed entries back out, newest first. The feed may
+    // have moved past them, so what analytics counted comes from the event:
+    // record_vice() logs the vice then maybe "locked", record_virtue() any
+    // streak achievements then the virtue, all at its time and resulting debt.
+    const UserEvent& ev = *events.last(u.id);
+    long long snapshot = events.state_at(u, ev.ts)->debt_seconds;
+    const std::vector<long long>& ids = ev.log_ids;
+    for (size_t i = ids.size(); i-- > 0;) {
+        std::string action;
+        if (ev.type == EventType::Vice) action = i == 0 ? "vice" : "locked";
+        else action = i + 1 < ids.size() ? "achievement" : ev.virtue == 1 ? "virtue1" : "virtue2";
+        search.remove(ids[i]);
+        activity_feed.remove(ids[i]);
+        analytics.revert(u.name, action, ev.ts, snapshot, *u.zone);
+    }
+    // A vice or virtue: one chart point, whether or not the feed still has it
+    debt_history[u.name].pop();
+    events.drop_last(u);
+
+    // Milestones already announced since the last event stay announced
+    u.highest_clean_milestone = std::max(u.highest_clean_milestone, u.clean_milestone(now));
+    charts.invalidate(u.name);
+    update_decay(u);
+    changed(u);
+    return true;
+}
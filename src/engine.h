@@ -0,0 +1,114 @@
+#pragma once
+#include "activity_feed.h"
+#include "analytics.h"
+#include "chart_series.h"
+#include "debt_history.h"
+#include "event_store.h"
+#include "leaderboard.h"
+#include "models.h"
+#include "search_index.h"
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+// --- ENGINE ---
+// The household and the rules that move it: users, their event streams, the
+// feed and everything derived from them. There are no globals, no I/O and
+// no web server in here. The server owns one Engine; recurrency-batch and
+// the benchmarks build their own. It is not thread-safe, so callers
+// serialise access the way the server's StateGuard does.
+
+const long long ACTION_COOLDOWN = 72000; // 20 Hours between two of the same virtue
+const long long CLOCK_SKEW = 300;        // How far ahead of ours a client's clock may run
+
+// Feed actions that put a point on the user's debt chart
+inline bool charted_action(const std::string& action) {
+    return action == "vice" || action == "virtue1" || action == "virtue2" || action == "reset";
+}
+
+// An action logged on a device while it was offline
+struct OfflineAction {
+    std::string key; // Chosen by the client; the same key is only ever applied once
+    EventType type = EventType::Vice; // Vice or Virtue
+    int virtue = 0;
+    time_t ts = 0;
+};
+
+struct BatchResult {
+    size_t applied = 0;
+    size_t duplicates = 0; // Keys already applied, skipped
+    std::string error;     // Set if nothing was applied because of actions[failed_at]
+    size_t failed_at = 0;
+};
+
+class Engine {
+public:
+    std::map<std::string, User> users;
+    ActivityFeed activity_feed;
+    long long next_log_id = 0;
+    EventStore events;
+    Analytics analytics;
+    std::map<std::string, DebtSeries> debt_history; // By display name, like analytics
+    SearchIndex search; // Every entry ever logged; the feed keeps the last FEED_SIZE
+    ChartSeriesCache charts;
+    Leaderboards leaderboards;
+
+    // Runs after every change that should reach storage
+    std::function<void()> on_change;
+    // Ids of users added, changed or removed since the last call, for
+    // persistence. Decay alone doesn't count: it replays from last_update.
+    std::set<std::string> take_changed_users() { return std::exchange(changed_users, {}); }
+    // Replicas leave clean-streak milestones to the primary
+    bool announce_milestones = true;
+
+    const Policy& policy() const { return events.policy; }
+    void set_policy(const Policy& p) { events.policy = p; }
+
+    // Logs carry display names; ids are their lowercase form
+    User* find_user_by_name(const std::string& name);
+    const TimeZone& zone_for_name(const std::string& name);
+
+    // A new user with a fresh history. The caller checked the id is free.
+    User& add_user(User u);
+    void remove_user(const std::string& id);
+
+    // `at` defaults to now
+    long long add_log(const std::string& user, const std::string& action, const std::string& msg,
+                      const std::string& color, long long delta, long long snapshot, time_t at = 0);
+    // Keys are chosen to stay constant between events so the trees are only
+    // touched when something actually changed
+    void refresh_rankings(const User& u);
+    void check_achievements(User& u);
+
+    void update_decay(User& u);
+    void add_vice(User& u);
+    bool perform_virtue(User& u, int virtue_num);
+    void reset_user(User& u, const std::string& verifier);
+    void change_contract(User& u, const User& terms);
+    // Only the user's own actions can be taken back, for 10 minutes
+    bool can_undo(const User& u, time_t now) const;
+    bool perform_undo(User& u);
+
+    // Applies actions in order at their own times, all or none, with one
+    // change notification. Each is checked the way the live routes would
+    // have at that time (not bankrupt, virtue cooldown), must not predate
+    // the user's latest event, and the times must not go backwards.
+    BatchResult apply_batch(User& u, const std::vector<OfflineAction>& actions);
+
+private:
+    // u is already decayed to ev.ts; appends the event and its feed entries
+    void record_vice(User& u, UserEvent ev);
+    void record_virtue(User& u, UserEvent ev);
+
+    void changed() {
+        if (on_change && !holding_changes) on_change();
+    }
+    void changed(const User& u) {
+        changed_users.insert(u.id);
+        changed();
+    }
+    bool holding_changes = false; // Set while a batch is applied
+    std::set<std::string> changed_users;
+};
@@ -0,0 +1,320 @@
+#include "event_store.h"
+#include "memory.h"
+
+static void keep_identity(User& u, const User& from) {
+    u.name = from.name;
+    u.id = from.id;
+    u.password = from.password;
+    u.tz_name = from.tz_name;
+    u.zone = from.zone;
+}
+
+void apply_event(User& u, const UserEvent& ev, const Policy& policy) {
+    if (ev.type == EventType::Genesis) {
+        User identity = u;
+        u = *ev.state;
+        keep_identity(u, identity);
+        return;
+    }
+
+    // Same decay update_decay() would have applied on the way in
+    if (!u.locked) {
+        if (u.debt_seconds > 0) {
+            u.debt_seconds -= (long long)std::difftime(ev.ts, u.last_update);
+            if (u.debt_seconds < 0) u.debt_seconds = 0;
+        }
+        u.last_update = ev.ts;
+        u.highest_clean_milestone = std::max(u.highest_clean_milestone, u.clean_milestone(ev.ts));
+    }
+
+    switch (ev.type) {
+    case EventType::Contract:
+        u.vice = ev.state->vice;
+        u.target_interval_days = ev.state->target_interval_days;
+        u.virtue1_name = ev.state->virtue1_name;
+        u.promised_v1_weekly = ev.state->promised_v1_weekly;
+        u.virtue2_name = ev.state->virtue2_name;
+        u.promised_v2_weekly = ev.state->promised_v2_weekly;
+        u.calculate_math(policy);
+        break;
+    case EventType::Vice: {
+        long long cost = u.base_cost;
+        if (u.debt_seconds > 0) cost = (long long)(u.base_cost * policy.relapse_multiplier);
+        u.debt_seconds += cost;
+        u.streak = 0;
+        u.last_vice = ev.ts;
+        u.highest_clean_milestone = 0;
+        u.virtue_streak_days = 0;
+        if (u.debt_seconds > u.max_threshold) {
+            u.locked = true;
+            u.lock_time = ev.ts;
+        }
+        break;
+    }
+    case EventType::Virtue:
+        if (civil_day(ev.ts, *u.zone) != civil_day(u.last_virtue_day_check, *u.zone)) {
+            u.virtue_streak_days++;
+            u.last_virtue_day_check = ev.ts;
+        }
+        if (u.debt_seconds > 0) u.debt_seconds -= std::min(policy.virtue_reward, u.debt_seconds);
+        (ev.virtue == 1 ? u.last_v1 : u.last_v2) = ev.ts;
+        break;
+    case EventType::Reset: {
+        long long time_served = (long long)std::difftime(ev.ts, u.lock_time);
+        u.debt_seconds = u.base_cost - time_served;
+        if (u.debt_seconds < 0) u.debt_seconds = 0;
+        u.locked = false;
+        u.last_update = ev.ts;
+        u.streak++;
+        break;
+    }
+    case EventType::Genesis:
+        break;
+    }
+}
+
+UserEvent genesis_event(const User& u) {
+    UserEvent ev;
+    ev.type = EventType::Genesis;
+    ev.ts = u.last_update;
+    ev.state = std::make_shared<User>(u);
+    return ev;
+}
+
+User replay(const User& u, const std::vector<UserEvent>& events, const Policy& policy) {
+    User state = u;
+    for (const UserEvent& ev : events) {
+        apply_event(state, ev, policy);
+        if (ev.type == EventType::Genesis) state.calculate_math(policy);
+    }
+    keep_identity(state, u);
+    if (!state.locked && u.last_update > state.last_update) {
+        if (state.debt_seconds > 0) {
+            state.debt_seconds -= (long long)std::difftime(u.last_update, state.last_update);
+            if (state.debt_seconds < 0) state.debt_seconds = 0;
+        }
+        state.last_update = u.last_update;
+        state.highest_clean_milestone = std::max(state.highest_clean_milestone, state.clean_milestone(u.last_update));
+    }
+    return state;
+}
+
+User EventStore::fold(const Stream& s, const User& identity, size_t count) const {
+    size_t k = std::min(count / CHECKPOINT_EVERY, s.checkpoints.size());
+    User u = k ? s.checkpoints[k - 1] : identity;
+    for (size_t i = k * CHECKPOINT_EVERY; i < count; i++) apply_event(u, s.events[i], policy);
+    keep_identity(u, identity);
+    return u;
+}
+
+EventStore::Stream EventStore::build(const User& u, std::vector<UserEvent> events) const {
+    Stream s;
+    s.events = std::move(events);
+    User state = u;
+    for (size_t i = 0; i < s.events.size(); i++) {
+        apply_event(state, s.events[i], policy);
+        if ((i + 1) % CHECKPOINT_EVERY == 0) s.checkpoints.push_back(state);
+    }
+    return s;
+}
+
+EventStore::Stream* EventStore::find(const std::string& id) const {
+    auto it = streams.find(id);
+    if (it != streams.end()) {
+        stats.hits++;
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return &it->second;
+    }
+    if (!paged()) return nullptr;
+
+    MemScope mem(MemTag::History);
+    std::vector<UserEvent> stored;
+    const User* u = page_in(id, stored);
+    if (!u) return nullptr;
+    stats.misses++;
+    bool legacy = stored.empty();
+    if (legacy) stored.push_back(genesis_event(*u));
+    Stream s = build(*u, std::move(stored));
+    // A stream from before event sourcing still has to be written
+    if (!legacy) {
+        s.unsynced_from = s.events.size();
+        s.dirty = false;
+    }
+    // And so does one compacted on the way in
+    if (compact_before) compact_stream(s, *u, compact_before);
+    return &insert(id, std::move(s));
+}
+
+EventStore::Stream& EventStore::insert(const std::string& id, Stream s) const {
+    auto it = streams.find(id);
+    if (it != streams.end()) {
+        s.lru = it->second.lru;
+        it->second = std::move(s);
+        lru.splice(lru.begin(), lru, it->second.lru);
+    } else {
+        lru.push_front(id);
+        s.lru = lru.begin();
+        it = streams.emplace(id, std::move(s)).first;
+    }
+    evict();
+    return it->second;
+}
+
+// Never the stream at the front: that is the one being used
+void EventStore::evict() const {
+    if (!paged()) return;
+    while (streams.size() > capacity && lru.size() > 1) {
+        auto it = streams.find(lru.back());
+        Stream& s = it->second;
+        if (s.dirty && write_back) {
+            write_back(it->first, s.events, std::min(s.unsynced_from, s.events.size()));
+            stats.write_backs++;
+        }
+        lru.pop_back();
+        streams.erase(it);
+        stats.evictions++;
+    }
+}
+
+UserEvent& EventStore::append(User& u, UserEvent ev) {
+    MemScope mem(MemTag::History);
+    Stream* found = find(u.id);
+    Stream& s = found ? *found : insert(u.id, Stream());
+    apply_event(u, ev, policy);
+    s.events.push_back(std::move(ev));
+    s.dirty = true;
+    if (s.events.size() % CHECKPOINT_EVERY == 0) s.checkpoints.push_back(u);
+    return s.events.back();
+}
+
+bool EventStore::drop_last(User& u) {
+    MemScope mem(MemTag::History);
+    Stream* s = find(u.id);
+    // The genesis event is never dropped
+    if (!s || s->events.size() < 2) return false;
+    s->events.pop_back();
+    s->unsynced_from = std::min(s->unsynced_from, s->events.size());
+    s->dirty = true;
+    s->checkpoints.resize(std::min(s->checkpoints.size(), s->events.size() / CHECKPOINT_EVERY), u);
+    u = fold(*s, u, s->events.size());
+    return true;
+}
+
+const UserEvent* EventStore::last(const std::string& id) const {
+    const Stream* s = find(id);
+    if (!s || s->events.empty()) return nullptr;
+    return &s->events.back();
+}
+
+bool EventStore::has_key(const std::string& id, const std::string& key, time_t since) const {
+    const Stream* s = find(id);
+    if (!s) return false;
+    auto it = std::lower_bound(s->events.begin(), s->events.end(), since,
+                               [](const UserEvent& e, time_t t) { return e.ts < t; });
+    return std::any_of(it, s->events.end(), [&](const UserEvent& e) { return e.key == key; });
+}
+
+void EventStore::add_log_id(const std::string& id, long long log_id) {
+    MemScope mem(MemTag::History);
+    Stream* s = find(id);
+    if (!s || s->events.empty()) return;
+    s->events.back().log_ids.push_back(log_id);
+    s->unsynced_from = std::min(s->unsynced_from, s->events.size() - 1);
+    s->dirty = true;
+}
+
+std::optional<User> EventStore::state_at(const User& u, time_t t) const {
+    const Stream* s = find(u.id);
+    if (!s) return std::nullopt;
+    const std::vector<UserEvent>& ev = s->events;
+    size_t count = std::upper_bound(ev.begin(), ev.end(), t,
+                                    [](time_t t, const UserEvent& e) { return t < e.ts; }) - ev.begin();
+    if (count == 0) return std::nullopt;
+
+    User at = fold(*s, u, count);
+    if (!at.locked) {
+        if (at.debt_seconds > 0) {
+            at.debt_seconds -= (long long)std::difftime(t, at.last_update);
+            if (at.debt_seconds < 0) at.debt_seconds = 0;
+        }
+        at.last_update = t;
+    }
+    return at;
+}
+
+// Looked up without find(): paging every stream in to compact it would
+// push the active ones out
+bool EventStore::compact(const User& u, time_t before) {
+    MemScope mem(MemTag::History);
+    auto it = streams.find(u.id);
+    return it != streams.end() && compact_stream(it->second, u, before);
+}
+
+// Rebuilds s in place, keeping its place in the LRU; all of it is then unsynced
+bool EventStore::compact_stream(Stream& s, const User& u, time_t before) const {
+    if (s.events.empty()) return false;
+    std::vector<UserEvent>& ev = s.events;
+    size_t k = std::lower_bound(ev.begin(), ev.end(), before,
+                                [](const UserEvent& e, time_t t) { return e.ts < t; }) - ev.begin();
+    k = std::min(k, ev.size() - 1);
+    if (k < 2) return false;
+
+    UserEvent genesis;
+    genesis.type = EventType::Genesis;
+    genesis.ts = ev[k - 1].ts;
+    genesis.state = std::make_shared<User>(fold(s, u, k));
+    std::vector<UserEvent> rest;
+    rest.reserve(ev.size() - k + 1);
+    rest.push_back(std::move(genesis));
+    for (size_t i = k; i < ev.size(); i++) rest.push_back(std::move(ev[i]));
+    Stream rebuilt = build(u, std::move(rest));
+    rebuilt.lru = s.lru;
+    s = std::move(rebuilt);
+    return true;
+}
+
+void EventStore::load(const User& u, std::vector<UserEvent> events) {
+    MemScope mem(MemTag::History);
+    insert(u.id, build(u, std::move(events)));
+}
+
+const std::vector<UserEvent>* EventStore::events(const std::string& id) const {
+    const Stream* s = find(id);
+    return s ? &s->events : nullptr;
+}
+
+void EventStore::erase(const std::string& id) {
+    auto it = streams.find(id);
+    if (it == streams.end()) return;
+    lru.erase(it->second.lru);
+    streams.erase(it);
+}
+
+void EventStore::clear() {
+    streams.clear();
+    lru.clear();
+}
+
+PagingStats EventStore::paging_stats() const {
+    PagingStats out = stats;
+    out.resident = streams.size();
+    return out;
+}
+
+size_t EventStore::take_unsynced(const std::string& id) {
+    auto it = streams.find(id);
+    if (it == streams.end()) return 0;
+    size_t from = it->second.unsynced_from;
+    it->second.unsynced_from = it->second.events.size();
+    it->second.dirty = false;
+    return from;
+}
+
+void EventStore::sync_all(const Sync& sync) {
+    for (auto& [id, s] : streams) {
+        if (!s.dirty) continue;
+        sync(id, s.events, std::min(s.unsynced_from, s.events.size()));
+        s.unsynced_from = s.events.size();
+        s.dirty = false;
+    }
+}
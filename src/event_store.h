@@ -0,0 +1,131 @@
+#pragma once
+#include "models.h"
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// --- EVENT STORE ---
+// A user's state is a left fold over their own events. Every
+// CHECKPOINT_EVERY events the folded User is kept, so undo ("drop my latest
+// event") and "debt at time T" replay at most that many events no matter
+// how long the history is, and never depend on what the rest of the
+// household did in between.
+//
+// Streams can be paged: with a capacity and a page_in hook only the most
+// recently used streams stay in memory, and the rest are read back from
+// storage the first time anything asks for them.
+
+enum class EventType { Genesis, Contract, Vice, Virtue, Reset };
+
+struct UserEvent {
+    EventType type = EventType::Genesis;
+    time_t ts = 0;
+    int virtue = 0;                    // Virtue: 1 or 2
+    std::string by;                    // Reset: who bailed the user out
+    std::shared_ptr<const User> state; // Genesis: starting state; Contract: the new terms
+    std::vector<long long> log_ids;    // Feed entries this event produced, oldest first
+    std::string key;                   // Idempotency key of an offline action
+};
+
+// The state transition for one event. Decay up to ev.ts is applied first.
+// Name, id, password and time zone are left alone: they are not history.
+void apply_event(User& u, const UserEvent& ev, const Policy& policy = Policy());
+
+// Starts a stream at the user's current state.
+UserEvent genesis_event(const User& u);
+
+// What u would be now had `policy` always applied: its events folded from
+// genesis (whose terms are repriced too), then decayed to u.last_update.
+// Identity and time zone come from u. Touches nothing shared, so streams
+// can be replayed on as many threads as there are cores.
+User replay(const User& u, const std::vector<UserEvent>& events, const Policy& policy);
+
+struct PagingStats {
+    size_t resident = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0; // Paged in
+    uint64_t evictions = 0;
+    uint64_t write_backs = 0; // Evictions that had unsynced events to store first
+};
+
+class EventStore {
+public:
+    static const size_t CHECKPOINT_EVERY = 32;
+
+    Policy policy; // Rules every fold uses
+
+    // Streams kept in memory when paging; 0 keeps every stream.
+    size_t capacity = 0;
+    // Fills `events` with id's stored stream (leaving it empty if nothing was
+    // stored, in which case the stream starts at the user's current state)
+    // and returns the user it belongs to, or nullptr for an unknown id.
+    // Without it nothing is ever evicted.
+    std::function<const User*(const std::string& id, std::vector<UserEvent>& events)> page_in;
+    // Stores events[from..] of a stream that is about to be dropped.
+    using Sync = std::function<void(const std::string& id, const std::vector<UserEvent>& events, size_t from)>;
+    Sync write_back;
+
+    // Folds ev into u and appends it to u's stream.
+    UserEvent& append(User& u, UserEvent ev);
+    // Forgets u's latest event and refolds u from the nearest checkpoint.
+    bool drop_last(User& u);
+    const UserEvent* last(const std::string& id) const;
+    // Whether an event at or after `since` in id's stream carries `key`.
+    bool has_key(const std::string& id, const std::string& key, time_t since) const;
+    // Records a feed entry produced by id's latest event.
+    void add_log_id(const std::string& id, long long log_id);
+
+    // u as of time t, or nothing if the stream starts after t.
+    std::optional<User> state_at(const User& u, time_t t) const;
+
+    // Folds everything before `before` into a new genesis event, keeping at
+    // least the latest event. Point-in-time queries stop at the new genesis.
+    // Only a resident stream is compacted; paged-out ones are when they come
+    // back in (see compact_before).
+    bool compact(const User& u, time_t before);
+    // Streams paged in are compacted up to here first (0: left as stored)
+    time_t compact_before = 0;
+
+    // Replaces u's stream (e.g. from disk) and rebuilds its checkpoints.
+    void load(const User& u, std::vector<UserEvent> events);
+    const std::vector<UserEvent>* events(const std::string& id) const;
+    void erase(const std::string& id);
+    void clear();
+
+    // Brings id's stream in now so the next request finds it resident.
+    void prefetch(const std::string& id) const { find(id); }
+    bool paged() const { return capacity > 0 && page_in; }
+    PagingStats paging_stats() const;
+
+    // Index of the first event of id's stream that changed since the last
+    // call (appended, or replaced after an undo or reload). For persistence.
+    size_t take_unsynced(const std::string& id);
+    // Hands every resident stream that changed since it was last synced to
+    // `sync`, then marks it synced. Never pages anything in.
+    void sync_all(const Sync& sync);
+
+private:
+    struct Stream {
+        std::vector<UserEvent> events;
+        std::vector<User> checkpoints; // [k] = state after (k + 1) * CHECKPOINT_EVERY events
+        size_t unsynced_from = 0;
+        bool dirty = true; // Also set when events were dropped, which unsynced_from can't show
+        std::list<std::string>::iterator lru;
+    };
+    User fold(const Stream& s, const User& identity, size_t count) const;
+    Stream build(const User& u, std::vector<UserEvent> events) const;
+    bool compact_stream(Stream& s, const User& u, time_t before) const;
+    // The resident stream, paging it in if need be; nullptr if id has none.
+    Stream* find(const std::string& id) const;
+    Stream& insert(const std::string& id, Stream s) const;
+    void evict() const;
+
+    // Paging is invisible to callers, so const lookups may move streams in and out
+    mutable std::map<std::string, Stream> streams;
+    mutable std::list<std::string> lru; // Most recently used first
+    mutable PagingStats stats;
+};
@@ -0,0 +1,86 @@
+#include "execution.h"
+#include <atomic>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+ExecutionConfig ExecutionConfig::from_env() {
+    ExecutionConfig c;
+    const char* mode = std::getenv("SERVE_MODE");
+    if (mode && std::string(mode) == "reactor") c.mode = ServeMode::Reactor;
+    const char* workers = std::getenv("WORKERS");
+    if (workers) c.workers = (unsigned)std::strtoul(workers, nullptr, 10);
+    const char* cpus = std::getenv("CPU_AFFINITY");
+    if (cpus) c.cpus = parse_cpu_list(cpus);
+    return c;
+}
+
+unsigned ExecutionConfig::worker_count() const {
+    if (mode == ServeMode::Reactor) return 1;
+    if (workers) return workers;
+    unsigned n = cpus.empty() ? std::thread::hardware_concurrency() : (unsigned)cpus.size();
+    return n ? n : 1;
+}
+
+std::vector<int> parse_cpu_list(const std::string& s) {
+    std::vector<int> out;
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) end = s.size();
+        std::string item = s.substr(pos, end - pos);
+        pos = end + 1;
+
+        char* rest = nullptr;
+        long lo = std::strtol(item.c_str(), &rest, 10);
+        if (rest == item.c_str() || lo < 0 || lo >= CPU_SETSIZE) continue;
+        long hi = lo;
+        if (*rest == '-') {
+            char* tail = nullptr;
+            hi = std::strtol(rest + 1, &tail, 10);
+            if (tail == rest + 1 || hi < lo || hi >= CPU_SETSIZE) continue;
+        }
+        for (long c = lo; c <= hi; c++) out.push_back((int)c);
+    }
+    return out;
+}
+
+static bool set_affinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool restrict_to_cpus(const std::vector<int>& cpus) {
+    return !cpus.empty() && set_affinity(cpus);
+}
+
+bool pin_to_next_cpu(const std::vector<int>& cpus) {
+    static std::atomic<size_t> next{0};
+    if (cpus.empty()) return false;
+    return set_affinity({cpus[next++ % cpus.size()]});
+}
+
+bool disable_nagle_on_listener(uint16_t port) {
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    for (int fd = 3; fd < (max_fd > 0 ? max_fd : 1024); fd++) {
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0 || !listening) continue;
+        sockaddr_storage addr{};
+        len = sizeof(addr);
+        if (getsockname(fd, (sockaddr*)&addr, &len) != 0) continue;
+        uint16_t bound = addr.ss_family == AF_INET ? ntohs(((sockaddr_in*)&addr)->sin_port)
+                       : addr.ss_family == AF_INET6 ? ntohs(((sockaddr_in6*)&addr)->sin6_port) : 0;
+        if (bound != port) continue;
+        int one = 1;
+        return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0;
+    }
+    return false;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --- EXECUTION MODEL ---
+// reactor: one Crow worker thread runs every handler, so the engine's state
+//          is only ever touched from that thread and needs no lock.
+// pool:    WORKERS handler threads; state access is serialised behind one
+//          mutex, and parsing, rendering to the socket and I/O overlap.
+// Either way CPU_AFFINITY ("0,2-3") restricts the process to those CPUs,
+// and pool workers each pin themselves to one of them.
+
+enum class ServeMode { Reactor, Pool };
+
+struct ExecutionConfig {
+    ServeMode mode = ServeMode::Pool;
+    unsigned workers = 0;  // Pool: handler threads, 0 = one per core
+    std::vector<int> cpus; // Empty = no pinning
+
+    static ExecutionConfig from_env();
+
+    unsigned worker_count() const;
+    // Crow counts its acceptor thread in its concurrency
+    unsigned crow_concurrency() const { return worker_count() + 1; }
+    bool shared_state() const { return worker_count() > 1; }
+    const char* mode_name() const { return mode == ServeMode::Reactor ? "reactor" : "pool"; }
+};
+
+// "0,2-5" -> {0, 2, 3, 4, 5}; malformed entries are skipped.
+std::vector<int> parse_cpu_list(const std::string& s);
+
+// Restricts the calling thread, and every thread it starts afterwards.
+bool restrict_to_cpus(const std::vector<int>& cpus);
+// Pins the calling thread to the next CPU of the set, round robin.
+bool pin_to_next_cpu(const std::vector<int>& cpus);
+
+// Crow hands each response to one gather write, but asio sends at most 16
+// buffers per syscall, so anything with two headers of its own goes out in
+// two segments and, with Nagle on, the second waits for the client's delayed
+// ACK (~40 ms). Linux copies TCP_NODELAY from a listening socket to the
+// connections it accepts; this sets it on whichever of ours listens on `port`.
+bool disable_nagle_on_listener(uint16_t port);
@@ -0,0 +1,90 @@
+#include "form.h"
+
+const char* field_error_name(FieldError e) {
+    switch (e) {
+    case FieldError::None: return "ok";
+    case FieldError::Missing: return "missing";
+    case FieldError::Malformed: return "malformed";
+    case FieldError::OutOfRange: return "out of range";
+    }
+    return "unknown";
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes p[r..] into p[w..] up to the next '&' (or '=' for keys), leaving r
+// on the delimiter. w never passes r, so earlier fields are never overwritten.
+// Malformed escapes are kept literally. Sets `control` on C0 bytes and DEL.
+static size_t decode_run(char* p, size_t n, size_t& r, size_t w, bool is_key, bool& control) {
+    while (r < n && p[r] != '&' && !(is_key && p[r] == '=')) {
+        char c = p[r];
+        if (c == '+') {
+            c = ' ';
+        } else if (c == '%' && r + 2 < n && hex_value(p[r + 1]) >= 0 && hex_value(p[r + 2]) >= 0) {
+            c = (char)(hex_value(p[r + 1]) * 16 + hex_value(p[r + 2]));
+            r += 2;
+        }
+        control |= (unsigned char)c < 0x20 || c == 0x7f;
+        p[w++] = c;
+        r++;
+    }
+    return w;
+}
+
+FormFields::FormFields(std::string& body) {
+    char* p = body.data();
+    size_t n = body.size(), r = 0, w = 0;
+    while (r < n) {
+        size_t key_start = w;
+        bool control = false;
+        w = decode_run(p, n, r, w, true, control);
+        size_t key_end = w, value_start = w;
+        if (r < n && p[r] == '=') {
+            r++;
+            w = decode_run(p, n, r, w, false, control);
+        }
+        if (r < n) r++; // '&'
+        if (control) {
+            dropped++;
+        } else if (key_end > key_start && count < MAX_FIELDS) {
+            pairs[count++] = {std::string_view(p + key_start, key_end - key_start),
+                              std::string_view(p + value_start, w - value_start)};
+        }
+    }
+}
+
+FormFields FormFields::cookies(std::string_view header) {
+    FormFields f;
+    while (!header.empty() && f.count < MAX_FIELDS) {
+        size_t end = header.find(';');
+        std::string_view item = header.substr(0, end);
+        header = end == std::string_view::npos ? std::string_view() : header.substr(end + 1);
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        size_t eq = item.find('=');
+        if (eq == 0 || eq == std::string_view::npos) continue;
+        f.pairs[f.count++] = {item.substr(0, eq), item.substr(eq + 1)};
+    }
+    return f;
+}
+
+const FormFields::Pair* FormFields::find(std::string_view key) const {
+    for (size_t i = 0; i < count; i++) {
+        if (pairs[i].key == key) return &pairs[i];
+    }
+    return nullptr;
+}
+
+std::string_view FormFields::get(std::string_view key) const {
+    const Pair* p = find(key);
+    return p ? p->value : std::string_view();
+}
+
+bool FormFields::has(std::string_view key) const {
+    return find(key) != nullptr;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <charconv>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// --- REQUEST PARSING ---
+// Form bodies are split and percent-decoded in a single pass, in place, and
+// handed out as string_views into the body itself, so nothing is allocated.
+// Numbers go through std::from_chars and report a typed error instead of
+// throwing. A field that decodes to a control character (CR, LF, NUL, ...)
+// is dropped and counted, since values end up in headers and pages.
+
+enum class FieldError { None, Missing, Malformed, OutOfRange };
+
+const char* field_error_name(FieldError e);
+
+template <typename T>
+struct Field {
+    T value{};
+    FieldError error = FieldError::Missing;
+    bool ok() const { return error == FieldError::None; }
+};
+
+// The whole view must be the number: no whitespace, sign prefix or trailing junk.
+// Infinities and NaN count as malformed.
+template <typename T>
+Field<T> parse_number(std::string_view s) {
+    Field<T> f;
+    if (s.empty()) return f;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), f.value);
+    if (ec == std::errc::result_out_of_range) f.error = FieldError::OutOfRange;
+    else if (ec != std::errc() || end != s.data() + s.size()) f.error = FieldError::Malformed;
+    else f.error = FieldError::None;
+    if constexpr (std::is_floating_point_v<T>) {
+        if (f.ok() && !std::isfinite(f.value)) f.error = FieldError::Malformed;
+    }
+    return f;
+}
+
+class FormFields {
+public:
+    static const size_t MAX_FIELDS = 32; // Later pairs are ignored
+
+    // application/x-www-form-urlencoded: "a=1&b=x%26y+z" -> a="1", b="x&y z".
+    // Decodes `body` in place; the views live as long as it does.
+    explicit FormFields(std::string& body);
+    // Fields dropped for control characters; handlers refuse such a form
+    size_t rejected() const { return dropped; }
+
+    // Cookie header: "a=1; b=2". Read-only, values are not decoded.
+    static FormFields cookies(std::string_view header);
+
+    // First value for key, "" when absent
+    std::string_view get(std::string_view key) const;
+    bool has(std::string_view key) const;
+    size_t size() const { return count; }
+
+    template <typename T>
+    Field<T> number(std::string_view key) const {
+        const Pair* p = find(key);
+        return p ? parse_number<T>(p->value) : Field<T>{};
+    }
+
+private:
+    FormFields() = default;
+    struct Pair {
+        std::string_view key;
+        std::string_view value;
+    };
+    const Pair* find(std::string_view key) const;
+
+    Pair pairs[MAX_FIELDS];
+    size_t count = 0;
+    size_t dropped = 0;
+};
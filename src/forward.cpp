@@ -0,0 +1,99 @@
+#include "forward.h"
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include "asio.hpp"
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <poll.h>
+
+using asio::ip::tcp;
+
+namespace {
+
+struct Connection {
+    asio::io_context io;
+    tcp::socket socket{io};
+    std::string host;
+    unsigned short port = 0;
+    asio::streambuf in;
+};
+
+// The writer closes idle keep-alive connections; a readable socket with
+// nothing asked of it means that happened (or it is out of step)
+bool still_open(tcp::socket& s) {
+    pollfd p{s.native_handle(), POLLIN, 0};
+    return ::poll(&p, 1, 0) == 0;
+}
+
+Connection& connection(const std::string& host, unsigned short port) {
+    thread_local std::unique_ptr<Connection> conn;
+    if (conn && conn->socket.is_open() && conn->host == host && conn->port == port && still_open(conn->socket)) return *conn;
+    conn = std::make_unique<Connection>();
+    conn->host = host;
+    conn->port = port;
+    tcp::resolver resolver(conn->io);
+    asio::connect(conn->socket, resolver.resolve(host, std::to_string(port)));
+    conn->socket.set_option(tcp::no_delay(true));
+    return *conn;
+}
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    size_t e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+}
+
+} // namespace
+
+std::optional<ForwardResponse> forward_request(const std::string& host, unsigned short port, const ForwardRequest& req) {
+    Connection* c = nullptr;
+    try {
+        c = &connection(host, port);
+        std::string out = req.method + " " + req.target + " HTTP/1.1\r\n";
+        for (auto const& [name, value] : req.headers) out += name + ": " + value + "\r\n";
+        out += "Content-Length: " + std::to_string(req.body.size()) + "\r\n\r\n";
+        out += req.body;
+        asio::write(c->socket, asio::buffer(out));
+
+        size_t head_len = asio::read_until(c->socket, c->in, "\r\n\r\n");
+        std::string head(asio::buffers_begin(c->in.data()), asio::buffers_begin(c->in.data()) + head_len);
+        c->in.consume(head_len);
+
+        ForwardResponse res;
+        size_t line_end = head.find("\r\n");
+        std::string status_line = head.substr(0, line_end);
+        size_t sp = status_line.find(' ');
+        if (status_line.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos) throw std::runtime_error("bad status line");
+        res.status = std::atoi(status_line.c_str() + sp + 1);
+        size_t length = 0;
+        bool close = false;
+        for (size_t p = line_end + 2; p < head_len - 2;) {
+            size_t e = head.find("\r\n", p);
+            std::string line = head.substr(p, e - p);
+            p = e + 2;
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string name = trim(line.substr(0, colon)), value = trim(line.substr(colon + 1));
+            std::string lower = name;
+            for (char& ch : lower) ch = (char)std::tolower((unsigned char)ch);
+            if (lower == "content-length") {
+                length = (size_t)std::strtoull(value.c_str(), nullptr, 10);
+            } else if (lower == "connection") {
+                close = value == "close";
+            } else {
+                res.headers.push_back({name, value});
+            }
+        }
+        if (c->in.size() < length) asio::read(c->socket, c->in, asio::transfer_exactly(length - c->in.size()));
+        res.body.assign(asio::buffers_begin(c->in.data()), asio::buffers_begin(c->in.data()) + length);
+        c->in.consume(length);
+        if (close) c->socket.close();
+        return res;
+    } catch (const std::exception&) {
+        if (c) c->socket.close();
+        return std::nullopt;
+    }
+}
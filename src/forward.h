@@ -0,0 +1,29 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --- WRITE FORWARDING ---
+// Reader processes (PROCESSES=N, see main.cpp) hold a replica of the state
+// and pass everything that changes it to the single writer over loopback.
+// Each calling thread keeps one keep-alive HTTP/1.1 connection to the
+// writer and reconnects when the writer has closed it.
+
+struct ForwardRequest {
+    std::string method;
+    std::string target; // Path and query
+    std::vector<std::pair<std::string, std::string>> headers; // Without Content-Length or Connection
+    std::string body;
+};
+
+struct ForwardResponse {
+    int status = 0;
+    std::vector<std::pair<std::string, std::string>> headers; // As sent, less Content-Length and Connection
+    std::string body;
+};
+
+// Nothing if the writer can't be reached or its answer makes no sense. An
+// idle connection the writer has closed is noticed before sending; once a
+// request is on the wire it is never resent, so a write can't apply twice.
+std::optional<ForwardResponse> forward_request(const std::string& host, unsigned short port, const ForwardRequest& req);
@@ -0,0 +1,137 @@
+#include "io_executor.h"
+#include "memory.h"
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include "asio.hpp"
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+
+void IoExecutor::start() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (worker.joinable()) return;
+    stopping = false;
+    worker = std::thread([this] { run(); });
+}
+
+void IoExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!worker.joinable()) return;
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void IoExecutor::flush() {
+    std::unique_lock<std::mutex> lock(mtx);
+    idle_cv.wait(lock, [this] { return (jobs.empty() && !busy) || !worker.joinable(); });
+}
+
+size_t IoExecutor::pending() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return jobs.size();
+}
+
+void IoExecutor::write_file(const std::string& path, std::string data, Completion done, asio::io_context* reply_to) {
+    auto image = std::make_shared<std::string>(std::move(data));
+    submit(path, [path, image](std::string& error) { return write_atomically(path, *image, error); },
+           std::move(done), reply_to);
+}
+
+void IoExecutor::submit(const std::string& key, Work work, Completion done, asio::io_context* reply_to) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (worker.joinable()) {
+            Job& job = jobs[key];
+            job.work = std::move(work); // Newer work supersedes any that hasn't run
+            if (done) job.waiters.push_back({std::move(done), reply_to});
+            cv.notify_one();
+            return;
+        }
+    }
+    // Not started (or already stopped): run inline
+    std::string error;
+    bool ok = perform(work, error);
+    std::vector<Waiter> waiters;
+    if (done) waiters.push_back({std::move(done), reply_to});
+    complete(waiters, ok, error);
+}
+
+void IoExecutor::run() {
+    MemScope mem(MemTag::Persistence);
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty()) break; // stopping, and fully drained
+
+        auto node = jobs.extract(jobs.begin());
+        busy = true;
+        lock.unlock();
+
+        std::string error;
+        bool ok = perform(node.mapped().work, error);
+        complete(node.mapped().waiters, ok, error);
+
+        lock.lock();
+        busy = false;
+        if (jobs.empty()) idle_cv.notify_all();
+    }
+    busy = false;
+    idle_cv.notify_all();
+}
+
+bool IoExecutor::perform(const Work& work, std::string& error) {
+    try {
+        return work(error);
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+}
+
+void IoExecutor::complete(std::vector<Waiter>& waiters, bool ok, const std::string& error) {
+    for (auto& w : waiters) {
+        if (w.reply_to) {
+            asio::post(*w.reply_to, [done = std::move(w.done), ok, error] { done(ok, error); });
+        } else {
+            w.done(ok, error);
+        }
+    }
+}
+
+bool IoExecutor::write_atomically(const std::string& path, const std::string& data, std::string& error) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error = "open " + tmp + ": " + std::strerror(errno);
+        return false;
+    }
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = ::write(fd, data.data() + off, data.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = "write " + tmp + ": " + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        off += (size_t)n;
+    }
+    if (::fsync(fd) != 0) {
+        error = "fsync " + tmp + ": " + std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        error = "rename " + tmp + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
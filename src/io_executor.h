@@ -0,0 +1,63 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace asio { class io_context; }
+
+// --- ASYNC FILE I/O ---
+// A single background thread owns all disk writes. Routes hand over a fully
+// serialized buffer and return immediately. Writes to the same path are
+// coalesced: if a newer buffer arrives before the previous one reached disk,
+// only the newest is written and every waiting completion fires after it.
+// Files are replaced atomically (temp file + fsync + rename), so readers
+// never see a torn image. Other disk work (e.g. a storage engine draining
+// its pending batch) goes through submit() with the same coalescing.
+
+class IoExecutor {
+public:
+    using Completion = std::function<void(bool ok, const std::string& error)>;
+    using Work = std::function<bool(std::string& error)>;
+
+    void start();
+    // Drains pending writes, then joins the worker.
+    void stop();
+    // Blocks until every write submitted so far is on disk.
+    void flush();
+
+    // Completions run on `reply_to` when given, otherwise on the I/O thread.
+    void write_file(const std::string& path, std::string data, Completion done = {}, asio::io_context* reply_to = nullptr);
+    // Runs `work` on the I/O thread. Unstarted work under the same key is
+    // replaced, so it must be safe to run only the newest.
+    void submit(const std::string& key, Work work, Completion done = {}, asio::io_context* reply_to = nullptr);
+    // path.tmp, fsync, rename; what write_file() runs, for work that writes files itself
+    static bool write_atomically(const std::string& path, const std::string& data, std::string& error);
+
+    size_t pending() const;
+
+private:
+    struct Waiter {
+        Completion done;
+        asio::io_context* reply_to;
+    };
+    struct Job {
+        Work work;
+        std::vector<Waiter> waiters;
+    };
+
+    void run();
+    static bool perform(const Work& work, std::string& error);
+    static void complete(std::vector<Waiter>& waiters, bool ok, const std::string& error);
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable idle_cv;
+    std::map<std::string, Job> jobs;
+    bool busy = false;
+    bool stopping = false;
+    std::thread worker;
+};
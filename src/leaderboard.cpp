@@ -0,0 +1,53 @@
+#include "leaderboard.h"
+
+bool Leaderboards::update(Board b, const std::string& id, long long primary, long long secondary) {
+    BoardIndex& bi = boards[(int)b];
+    RankKey key{primary, secondary, id};
+    auto it = bi.current.find(id);
+    if (it != bi.current.end()) {
+        if (it->second == key) return false;
+        bi.tree.erase(it->second);
+        it->second = key;
+    } else {
+        bi.current.emplace(id, key);
+    }
+    bi.tree.insert(key);
+    return true;
+}
+
+void Leaderboards::remove(const std::string& id) {
+    for (BoardIndex& bi : boards) {
+        auto it = bi.current.find(id);
+        if (it == bi.current.end()) continue;
+        bi.tree.erase(it->second);
+        bi.current.erase(it);
+    }
+}
+
+void Leaderboards::clear() {
+    for (BoardIndex& bi : boards) {
+        bi.tree.clear();
+        bi.current.clear();
+    }
+}
+
+size_t Leaderboards::rank(Board b, const std::string& id) const {
+    const BoardIndex& bi = boards[(int)b];
+    auto it = bi.current.find(id);
+    if (it == bi.current.end()) return 0;
+    return bi.tree.order_of_key(it->second) + 1;
+}
+
+std::vector<std::string> Leaderboards::page(Board b, size_t offset, size_t limit) const {
+    const BoardIndex& bi = boards[(int)b];
+    std::vector<std::string> out;
+    if (offset >= bi.tree.size()) return out;
+    for (auto it = bi.tree.find_by_order(offset); it != bi.tree.end() && out.size() < limit; ++it) {
+        out.push_back(it->id);
+    }
+    return out;
+}
+
+size_t Leaderboards::size(Board b) const {
+    return boards[(int)b].tree.size();
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// --- LEADERBOARDS ---
+// One order-statistics tree per board (libstdc++ policy-based red-black tree
+// with subtree sizes). A user's entry is only re-inserted when their sort key
+// actually changes, and top-K, page and "my rank" are all O(log n).
+
+enum class Board { Debt, Streak, Clean, Virtues };
+const int BOARD_COUNT = 4;
+
+// Smaller keys rank higher. `primary`/`secondary` are chosen by the caller so
+// that ranks stay stable between events (e.g. projected clean time instead of
+// the continuously decaying debt).
+struct RankKey {
+    long long primary;
+    long long secondary;
+    std::string id; // Tie-break so every key is unique
+
+    bool operator<(const RankKey& o) const { return std::tie(primary, secondary, id) < std::tie(o.primary, o.secondary, o.id); }
+    bool operator==(const RankKey& o) const { return primary == o.primary && secondary == o.secondary && id == o.id; }
+};
+
+class Leaderboards {
+public:
+    // Returns true if the key changed and the tree was touched.
+    bool update(Board b, const std::string& id, long long primary, long long secondary = 0);
+    void remove(const std::string& id);
+    void clear();
+
+    // 1-based rank, 0 if the user is not on the board
+    size_t rank(Board b, const std::string& id) const;
+    std::vector<std::string> page(Board b, size_t offset, size_t limit) const;
+    size_t size(Board b) const;
+
+private:
+    using Tree = __gnu_pbds::tree<RankKey, __gnu_pbds::null_type, std::less<RankKey>,
+                                  __gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update>;
+    struct BoardIndex {
+        Tree tree;
+        std::unordered_map<std::string, RankKey> current;
+    };
+    BoardIndex boards[BOARD_COUNT];
+};
@@ -1,5 +1,24 @@
 #include "crow_all.h"
 #include "json.hpp"
+#include "models.h"
+#include "engine.h"
+#include "records.h"
+#include "io_executor.h"
+#include "storage.h"
+#include "codec.h"
+#include "admission.h"
+#include "analytics.h"
+#include "chart_series.h"
+#include "leaderboard.h"
+#include "replication.h"
+#include "form.h"
+#include "arena.h"
+#include "memory.h"
+#include "execution.h"
+#include "scheduler.h"
+#include "backup.h"
+#include "forward.h"
+#include "capture.h"
 #include <iostream>
 #include <fstream>
 #include <map>
@@ -11,14 +30,21 @@
 #include <iomanip>
 #include <cmath>
 #include <cstdlib>
+#include <set>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <thread>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <strings.h>
+#include <unistd.h>
 
 using json = nlohmann::json;
 
 // --- CONSTANTS ---
-const long long DAY_SEC = 86400;
-const long long HALF_DAY = 43200; 
-const long long VIRTUE_REWARD = DAY_SEC; 
-const long long ACTION_COOLDOWN = 72000;     // 20 Hours
+const size_t CHART_POINTS = 120;             // Debt chart point budget
 
 // Dynamic DB Path
 std::string get_db_path() {
@@ -27,337 +53,597 @@ std::string get_db_path() {
 }
 const std::string DB_FILE = get_db_path();
 
+// json (default), memory or btree; see storage.h
+std::string get_storage_kind() {
+    const char* env_p = std::getenv("STORAGE");
+    return env_p ? std::string(env_p) : "json";
+}
+
+// json (default), cbor or msgpack: how records and the db file are written
+std::string get_persist_format() {
+    const char* env_p = std::getenv("PERSIST_FORMAT");
+    return env_p ? std::string(env_p) : "json";
+}
+Encoding persist_format = Encoding::Json;
+
 // --- DATA STRUCTURES ---
 
-struct ActivityLog {
-    std::string user_name;
-    std::string action; 
-    std::string message;
-    time_t timestamp;
-    std::string color; 
-    long long change_delta;
-    long long debt_snapshot;
+Engine engine; // Users, histories and the rules (see engine.h)
+// Shorthands for the routes and renderers below
+std::map<std::string, User>& users = engine.users;
+ActivityFeed& activity_feed = engine.activity_feed;
+EventStore& event_store = engine.events;
+Analytics& analytics = engine.analytics;
+ChartSeriesCache& chart_cache = engine.charts;
+Leaderboards& leaderboards = engine.leaderboards;
+long long leaderboard_week = 0; // Week the Virtues board was last rebuilt for
+
+// All disk writes go through here so Crow workers never block on the volume
+IoExecutor persist_queue;
+std::unique_ptr<StorageEngine> storage; // Primary only
+
+// Primary/replica roles (see replication.h)
+ReplicationPrimary replication_primary;
+ReplicaClient replica_client;
+bool replica_mode = false;
+std::string primary_url;             // Where replicas send writes
+std::string writer_host;             // Readers (PROCESSES): where writes are forwarded instead
+unsigned short writer_port = 0;
+std::atomic<bool> replica_loaded{false}; // First image applied
+
+// Reactor or pool (see execution.h)
+ExecutionConfig execution = ExecutionConfig::from_env();
+bool lock_state = false;             // More than one thread touches state; set before any starts
+std::mutex state_mutex;              // Handlers vs. each other and the replica applier
+
+// io_context of the request being handled on this thread (set by middleware)
+thread_local asio::io_context* current_io_context = nullptr;
+std::atomic<asio::io_context*> engine_context{nullptr}; // First worker to serve a request
+
+struct RequestIoContext {
+    struct context {};
+    void before_handle(crow::request& req, crow::response&, context&) {
+        // Pool workers spread over CPU_AFFINITY on their first request
+        static thread_local bool pinned = false;
+        if (!pinned && execution.mode == ServeMode::Pool) pin_to_next_cpu(execution.cpus);
+        pinned = true;
+        current_io_context = req.io_context;
+        if (!engine_context.load(std::memory_order_relaxed)) engine_context = req.io_context;
+    }
+    void after_handle(crow::request&, crow::response&, context&) { current_io_context = nullptr; }
 };
 
-struct User {
-    std::string name;
-    std::string id;
-    std::string password;
-    
-    std::string vice;
-    double target_interval_days;
-    std::string virtue1_name;
-    double promised_v1_weekly;
-    std::string virtue2_name;
-    double promised_v2_weekly;
-
-    long long base_cost;     
-    long long max_threshold; 
-    
-    long long debt_seconds;
-    time_t last_update;      
-    time_t last_v1;
-    time_t last_v2;
-    time_t lock_time;
-    bool locked;
-    int streak; 
-
-    // Achievements
-    time_t last_vice;
-    int highest_clean_milestone; 
-    int virtue_streak_days;
-    time_t last_virtue_day_check;
-
-    User() : debt_seconds(0), last_update(std::time(nullptr)), last_v1(0), last_v2(0), lock_time(0), locked(false), streak(0), last_vice(std::time(nullptr)), highest_clean_milestone(0), virtue_streak_days(0), last_virtue_day_check(0) {}
-
-    User(std::string n, std::string p, std::string v, double days, std::string v1n, double v1f, std::string v2n, double v2f) 
-        : name(n), password(p), vice(v), target_interval_days(days), 
-          virtue1_name(v1n), promised_v1_weekly(v1f), virtue2_name(v2n), promised_v2_weekly(v2f),
-          debt_seconds(0), last_update(std::time(nullptr)), last_v1(0), last_v2(0), lock_time(0), locked(false), streak(0),
-          last_vice(std::time(nullptr)), highest_clean_milestone(0), virtue_streak_days(0), last_virtue_day_check(0)
-    {
-        id = n;
-        std::transform(id.begin(), id.end(), id.begin(), ::tolower);
-        calculate_math();
+// Scratch memory for the handler; debug builds report what still hit the heap.
+// Whatever the handler allocates outside the engine counts as rendering.
+struct RequestScratch {
+    struct context {
+        size_t allocations = 0;
+        MemTag prev_tag = MemTag::Other;
+    };
+    void before_handle(crow::request&, crow::response&, context& ctx) {
+        ctx.allocations = thread_allocations();
+        ctx.prev_tag = mem_swap_tag(MemTag::Rendering);
+        arena_begin();
     }
-
-    void calculate_math() {
-        long long natural_decay = (long long)(target_interval_days * DAY_SEC);
-        double weeks_in_interval = target_interval_days / 7.0;
-        double total_virtues = weeks_in_interval * (promised_v1_weekly + promised_v2_weekly);
-        double raw_work_capacity = total_virtues * (double)VIRTUE_REWARD;
-        double raw_total = (double)natural_decay + raw_work_capacity;
-        long long blocks = (long long)std::round(raw_total / (double)HALF_DAY);
-        base_cost = blocks * HALF_DAY;
-        if (base_cost < natural_decay) base_cost = natural_decay;
-        max_threshold = (long long)(base_cost * 2.5);
+    void after_handle(crow::request&, crow::response& res, context& ctx) {
+        arena_end();
+        mem_swap_tag(ctx.prev_tag);
+#ifndef NDEBUG
+        res.add_header("X-Allocations", std::to_string(thread_allocations() - ctx.allocations));
+#endif
     }
 };
 
-std::map<std::string, User> users;
-std::deque<ActivityLog> activity_feed; 
+// User text going back into a page
+std::string html_escape(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    append_html(out, s);
+    return out;
+}
 
-std::string get_user_color(const std::string& name) {
+int get_user_hue(const std::string& name) {
     std::hash<std::string> hasher;
     size_t hash = hasher(name);
-    int hue = hash % 360;
-    return "hsl(" + std::to_string(hue) + ", 70%, 65%)";
+    return hash % 360;
 }
 
-// --- DATABASE FUNCTIONS ---
+// --- STORAGE SYNC ---
+// The engine marks what changed and these remember what storage already
+// holds, so a commit carries only the records that changed (one user and a
+// couple of events per action) and nothing else is encoded to find them.
 
-void save_db() {
-    json j;
-    j["users"] = json::object();
-    for (auto const& [key, user] : users) {
-        j["users"][key] = {
-            {"name", user.name},
-            {"password", user.password},
-            {"vice", user.vice},
-            {"target_interval_days", user.target_interval_days},
-            {"virtue1_name", user.virtue1_name},
-            {"promised_v1_weekly", user.promised_v1_weekly},
-            {"virtue2_name", user.virtue2_name},
-            {"promised_v2_weekly", user.promised_v2_weekly},
-            {"base_cost", user.base_cost},
-            {"max_threshold", user.max_threshold},
-            {"debt_seconds", user.debt_seconds},
-            {"last_update", user.last_update},
-            {"last_v1", user.last_v1},
-            {"last_v2", user.last_v2},
-            {"lock_time", user.lock_time},
-            {"locked", user.locked},
-            {"streak", user.streak},
-            {"last_vice", user.last_vice},
-            {"clean_milestone", user.highest_clean_milestone},
-            {"v_streak", user.virtue_streak_days},
-            {"last_v_check", user.last_virtue_day_check}
-        };
-    }
-    j["logs"] = json::array();
-    for (const auto& log : activity_feed) {
-        j["logs"].push_back({
-            {"user", log.user_name},
-            {"action", log.action},
-            {"msg", log.message},
-            {"ts", log.timestamp},
-            {"col", log.color},
-            {"delta", log.change_delta},
-            {"snap", log.debt_snapshot}
-        });
+std::map<std::string, size_t> stored_events;   // Stream length in storage
+std::map<std::string, size_t> stored_history;  // Debt history blocks in storage
+
+// events[from..] of one stream, and whatever storage holds past its end
+void stream_changes(StorageBatch& batch, const std::string& key, const std::vector<UserEvent>& evs, size_t from) {
+    size_t& stored = stored_events[key];
+    for (size_t i = from; i < evs.size(); i++) {
+        batch.push_back({event_key(key, i), encode(event_to_json(evs[i]), persist_format)});
     }
-    std::ofstream o(DB_FILE);
-    o << j.dump(4);
+    for (size_t i = evs.size(); i < stored; i++) batch.push_back({event_key(key, i), std::nullopt});
+    stored = evs.size();
 }
 
-void load_db() {
-    std::ifstream i(DB_FILE);
-    if (!i.is_open()) return;
-    json j;
-    i >> j;
-    users.clear();
-    for (auto& [key, val] : j["users"].items()) {
-        User u;
-        u.name = val["name"];
-        u.id = key; 
-        u.password = val["password"];
-        u.vice = val.value("vice", "Vice");
-        u.target_interval_days = val.value("target_interval_days", 7.0);
-        u.virtue1_name = val.value("virtue1_name", "Virtue 1");
-        u.promised_v1_weekly = val.value("promised_v1_weekly", 3.0);
-        u.virtue2_name = val.value("virtue2_name", "Virtue 2");
-        u.promised_v2_weekly = val.value("promised_v2_weekly", 5.0);
-        u.base_cost = val.value("base_cost", 10 * DAY_SEC);
-        u.max_threshold = val.value("max_threshold", 25 * DAY_SEC);
-        u.debt_seconds = val["debt_seconds"];
-        u.last_update = val["last_update"];
-        u.last_v1 = val.value("last_v1", 0);
-        u.last_v2 = val.value("last_v2", 0);
-        u.lock_time = val.value("lock_time", 0);
-        u.locked = val["locked"];
-        u.streak = val.value("streak", 0);
-        
-        u.last_vice = val.value("last_vice", (long long)std::time(nullptr));
-        u.highest_clean_milestone = val.value("clean_milestone", 0);
-        u.virtue_streak_days = val.value("v_streak", 0);
-        u.last_virtue_day_check = val.value("last_v_check", 0);
-
-        users[key] = u;
-    }
-    activity_feed.clear();
-    if (j.contains("logs")) {
-        for (const auto& l : j["logs"]) {
-            ActivityLog log;
-            log.user_name = l["user"];
-            log.action = l["action"];
-            log.message = l["msg"];
-            log.timestamp = l["ts"];
-            log.color = l["col"];
-            log.change_delta = l.value("delta", 0LL);
-            log.debt_snapshot = l.value("snap", 0LL);
-            activity_feed.push_back(log);
+StorageBatch storage_changes() {
+    StorageBatch batch;
+
+    // Only the users and stats the engine marked; gone ones are deleted
+    for (const std::string& id : engine.take_changed_users()) {
+        auto it = users.find(id);
+        if (it != users.end()) batch.push_back({user_key(id), encode(user_to_json(it->second), persist_format)});
+        else batch.push_back({user_key(id), std::nullopt});
+    }
+    for (const std::string& name : analytics.take_changed()) {
+        const UserStats* st = analytics.find(name);
+        if (st) batch.push_back({stats_key(name), encode(stats_to_json(*st), persist_format)});
+        else batch.push_back({stats_key(name), std::nullopt});
+    }
+
+    // Entries stay in storage after they drop off the feed, for search;
+    // only undo takes them out
+    for (const ActivityLog& log : engine.search.take_added()) {
+        batch.push_back({log_key(log.id), encode(log_to_json(log), persist_format)});
+    }
+    for (long long id : engine.search.take_removed()) batch.push_back({log_key(id), std::nullopt});
+
+    // Only the blocks a point went into or came out of
+    for (auto& [name, series] : engine.debt_history) {
+        size_t& stored = stored_history[name];
+        for (size_t i = series.take_changed(); i < series.block_count(); i++) {
+            batch.push_back({history_key(name, i), encode(history_block_to_json(series, i), persist_format)});
+        }
+        for (size_t i = series.block_count(); i < stored; i++) batch.push_back({history_key(name, i), std::nullopt});
+        stored = series.block_count();
+    }
+    for (auto it = stored_history.begin(); it != stored_history.end();) {
+        if (engine.debt_history.count(it->first)) {
+            ++it;
+            continue;
         }
+        for (size_t i = 0; i < it->second; i++) batch.push_back({history_key(it->first, i), std::nullopt});
+        it = stored_history.erase(it);
     }
+
+    // Streams that were paged out went to storage on the way
+    event_store.sync_all([&](const std::string& key, const std::vector<UserEvent>& evs, size_t from) {
+        stream_changes(batch, key, evs, from);
+    });
+    for (auto it = stored_events.begin(); it != stored_events.end();) {
+        if (users.count(it->first)) {
+            ++it;
+            continue;
+        }
+        for (size_t i = 0; i < it->second; i++) batch.push_back({event_key(it->first, i), std::nullopt});
+        it = stored_events.erase(it);
+    }
+    return batch;
 }
 
-// --- LOGIC FUNCTIONS ---
+// --- REPLICATION LOG ---
+// Replicas are sent what each commit wrote to storage (storage_changes()),
+// as change records: users, stats, feed entries and the debt history blocks
+// that changed. Event streams stay on the primary; a replica holds each
+// user's latest event, which is all undo needs. A full image is only built
+// when a replica connects or falls behind the backlog. Replicas never check
+// a password (logins are writes and go to the primary), so nothing they are
+// sent carries one. They connect with REPLICATION_TOKEN.
+
+std::string replication_token() {
+    const char* env_p = std::getenv("REPLICATION_TOKEN");
+    return env_p ? env_p : "";
+}
 
-void add_log(std::string user, std::string action, std::string msg, std::string color, long long delta, long long snapshot) {
-    ActivityLog log;
-    log.user_name = user;
-    log.action = action;
-    log.message = msg;
-    log.timestamp = std::time(nullptr);
-    log.color = color;
-    log.change_delta = delta;
-    log.debt_snapshot = snapshot;
-    activity_feed.push_front(log); 
-    if (activity_feed.size() > 100) activity_feed.pop_back(); 
-    save_db();
+std::string replication_bind() {
+    const char* env_p = std::getenv("REPLICATION_BIND");
+    return env_p ? env_p : "127.0.0.1";
 }
 
-void check_achievements(User& u) {
-    time_t now = std::time(nullptr);
-    double days_clean = std::difftime(now, u.last_vice) / 86400.0;
-    int milestones[] = {5, 10, 25, 50, 100, 200, 300};
-    
-    for (int m : milestones) {
-        if (days_clean >= m && u.highest_clean_milestone < m) {
-            u.highest_clean_milestone = m;
-            add_log(u.name, "achievement", "🏆 ACHIEVEMENT: Clean for " + std::to_string(m) + " days!", "#FFD700", 0, u.debt_seconds);
-        }
+// For readers the writer starts itself, when no token was configured
+std::string random_token() {
+    unsigned char bytes[16] = {};
+    std::ifstream urandom("/dev/urandom", std::ios::binary);
+    urandom.read((char*)bytes, sizeof(bytes));
+    if (!urandom) throw std::runtime_error("can't read /dev/urandom");
+    static const char* hex = "0123456789abcdef";
+    std::string out;
+    for (unsigned char b : bytes) {
+        out += hex[b >> 4];
+        out += hex[b & 15];
     }
+    return out;
 }
 
-void update_decay(User& u) {
-    if (u.locked) return;
-    time_t now = std::time(nullptr);
-    long long seconds_passed = (long long)std::difftime(now, u.last_update);
-    if (u.debt_seconds > 0) {
-        u.debt_seconds -= seconds_passed;
-        if (u.debt_seconds < 0) u.debt_seconds = 0;
-    }
-    u.last_update = now;
-    check_achievements(u);
+// The latest event of id's stream as storage has it (or is about to, from
+// `written`), or null when nothing is stored
+json last_stored_event(const std::string& id, const std::map<size_t, const std::string*>& written) {
+    auto it = stored_events.find(id);
+    if (it == stored_events.end() || it->second == 0) return nullptr;
+    size_t seq = it->second - 1;
+    auto w = written.find(seq);
+    if (w != written.end()) return decode_object(*w->second);
+    std::optional<std::string> v = storage->get(event_key(id, seq));
+    return v ? decode_object(*v) : json(nullptr);
 }
 
-void add_vice(User& u) {
-    update_decay(u);
-    if (u.locked) return;
-    long long cost = u.base_cost;
-    if (u.debt_seconds > 0) {
-        cost = (long long)(u.base_cost * 1.5);
+// The state a replica starts from. Each user brings only their latest event,
+// read back from storage, so building it pages no history in.
+json replica_image() {
+    json db = build_db_json(engine, false);
+    for (auto& [key, val] : db["users"].items()) {
+        val["password"] = "";
+        json last = last_stored_event(key, {});
+        if (!last.is_null()) db["events"][key] = json::array({last});
     }
-    u.debt_seconds += cost;
-    
-    u.streak = 0; 
-    u.last_vice = std::time(nullptr);
-    u.highest_clean_milestone = 0;
-    u.virtue_streak_days = 0;
+    return db;
+}
 
-    double days = (double)cost / (double)DAY_SEC;
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(1) << days;
-    std::string msg = "Indulged in " + u.vice + " (+" + ss.str() + "d)";
-    add_log(u.name, "vice", msg, "#ff5252", cost, u.debt_seconds);
-    if (u.debt_seconds > u.max_threshold) {
-        u.locked = true;
-        u.lock_time = std::time(nullptr);
-        add_log(u.name, "locked", "WENT BANKRUPT.", "#ff0000", 0, u.debt_seconds);
+// One record per user, stats or feed entry written; one per debt history,
+// its blocks from the first one written, which replace the rest; and one
+// per event stream written, its new latest event (or null)
+std::vector<std::string> replica_records(const StorageBatch& batch) {
+    std::vector<std::string> out;
+    std::map<std::string, std::pair<size_t, json>> history;
+    std::map<std::string, std::map<size_t, const std::string*>> events;
+    for (const StorageWrite& w : batch) {
+        std::string name;
+        size_t n;
+        if (w.key.compare(0, 2, "u/") == 0) {
+            std::string id = w.key.substr(2);
+            if (!w.value) {
+                out.push_back(json{{"t", "user_del"}, {"id", id}}.dump());
+                continue;
+            }
+            json v = decode_object(*w.value);
+            v["password"] = "";
+            out.push_back(json{{"t", "user"}, {"id", id}, {"v", v}}.dump());
+        } else if (w.key.compare(0, 2, "s/") == 0) {
+            std::string stats_name = w.key.substr(2);
+            if (w.value) out.push_back(json{{"t", "stats"}, {"name", stats_name}, {"v", decode_object(*w.value)}}.dump());
+            else out.push_back(json{{"t", "stats_del"}, {"name", stats_name}}.dump());
+        } else if (w.key.compare(0, 2, "l/") == 0) {
+            if (w.value) out.push_back(json{{"t", "log"}, {"v", decode_object(*w.value)}}.dump());
+            else out.push_back(json{{"t", "log_del"}, {"id", std::stoll(w.key.substr(2))}}.dump());
+        } else if (parse_history_key(w.key, name, n)) {
+            auto [it, fresh] = history.try_emplace(name, n, json::array());
+            it->second.first = std::min(it->second.first, n);
+            if (w.value) it->second.second.push_back(decode_object(*w.value));
+        } else if (parse_event_key(w.key, name, n)) {
+            auto& written = events[name];
+            if (w.value) written[n] = &*w.value;
+        }
+    }
+    for (auto& [name, h] : history) {
+        out.push_back(json{{"t", "history"}, {"name", name}, {"from", h.first}, {"v", std::move(h.second)}}.dump());
+    }
+    for (auto& [id, written] : events) {
+        out.push_back(json{{"t", "event"}, {"id", id}, {"v", last_stored_event(id, written)}}.dump());
     }
-    save_db();
+    return out;
 }
 
-bool perform_virtue(User& u, int virtue_num) {
-    update_decay(u);
-    if (u.locked) return false;
-    time_t now = std::time(nullptr);
-    time_t* last_track = (virtue_num == 1) ? &u.last_v1 : &u.last_v2;
-    std::string v_name = (virtue_num == 1) ? u.virtue1_name : u.virtue2_name;
-    if (std::difftime(now, *last_track) < ACTION_COOLDOWN) return false;
-    
-    struct tm* t_now = std::localtime(&now);
-    struct tm* t_last = std::localtime(&u.last_virtue_day_check);
-    bool new_day = (t_now->tm_yday != t_last->tm_yday || t_now->tm_year != t_last->tm_year);
-    if (new_day) {
-        u.virtue_streak_days++;
-        u.last_virtue_day_check = now;
-        int milestones[] = {10, 25, 50, 100};
-        for (int m : milestones) {
-            if (u.virtue_streak_days == m) {
-                add_log(u.name, "achievement", "🔥 STREAK: " + std::to_string(m) + " days of virtues!", "#FFD700", 0, u.debt_seconds);
-            }
+void save_db() {
+    if (replica_mode) return; // Replicas never write; the primary owns the file
+    MemScope mem(MemTag::Persistence);
+    StorageBatch batch = storage_changes();
+    if (replication_primary.running()) replication_primary.publish(replica_records(batch));
+    if (batch.empty()) return;
+    storage->commit(std::move(batch), [](bool ok, const std::string& error) {
+        if (!ok) CROW_LOG_ERROR << "save_db failed: " << error;
+    }, current_io_context);
+}
+
+// Reassembles the document load_db_json() reads from storage records. When
+// histories are paged only their lengths are read here; see page_in_stream().
+void load_db() {
+    MemScope mem(MemTag::Persistence);
+    json j = {{"users", json::object()}, {"logs", json::array()}, {"events", json::object()}};
+    storage->scan("u/", prefix_end("u/"), [&](const std::string& key, const std::string& v) {
+        j["users"][key.substr(2)] = decode_object(v);
+        return true;
+    });
+    storage->scan("s/", prefix_end("s/"), [&](const std::string& key, const std::string& v) {
+        j["stats"][key.substr(2)] = decode_object(v);
+        return true;
+    });
+    storage->scan("l/", prefix_end("l/"), [&](const std::string&, const std::string& v) {
+        j["logs"].push_back(decode_object(v));
+        return true;
+    });
+    std::reverse(j["logs"].begin(), j["logs"].end()); // Newest first
+    storage->scan("h/", prefix_end("h/"), [&](const std::string& key, const std::string& v) {
+        std::string name;
+        size_t block;
+        if (parse_history_key(key, name, block)) {
+            j["history"][name].push_back(decode_object(v));
+            stored_history[name] = block + 1;
         }
+        return true;
+    });
+    storage->scan("e/", prefix_end("e/"), [&](const std::string& key, const std::string& v) {
+        std::string id;
+        size_t seq;
+        if (parse_event_key(key, id, seq)) {
+            if (!event_store.paged()) j["events"][id].push_back(decode_object(v));
+            stored_events[id] = seq + 1;
+        }
+        return true;
+    });
+    load_db_json(engine, j);
+    for (auto const& [name, blocks] : stored_history) {
+        auto it = engine.debt_history.find(name);
+        if (it != engine.debt_history.end()) it->second.take_changed();
+    }
+    if (event_store.paged()) return;
+
+    // Streams synthesized for users from before event sourcing still need writing
+    for (auto const& [key, user] : users) {
+        const auto* evs = event_store.events(key);
+        if (evs && stored_events.count(key) && stored_events[key] == evs->size()) event_store.take_unsynced(key);
     }
+}
+
+// --- BACKUPS ---
+// POST /api/backup or SIGUSR2 forks the server. The child scans storage
+// out of its copy-on-write image of the parent and writes BACKUP_PATH
+// (backup.h) while the parent keeps serving; the parent pays for fork()
+// itself and for every page either side writes while the child runs. A
+// thread waits for the child and keeps what it reported. To load one back,
+// start on an empty database with RESTORE_FROM=<backup>.
+
+std::string get_backup_path() {
+    const char* env_p = std::getenv("BACKUP_PATH");
+    return env_p ? std::string(env_p) : DB_FILE + ".backup";
+}
+
+struct BackupRun {
+    bool running = false;
+    pid_t pid = 0;
+    std::string path;
+    time_t started_at = 0;
+    std::chrono::steady_clock::time_point started;
+    long long fork_us = 0;
+    long parent_faults = 0; // Minor faults before the fork
+    json last;              // What the last finished one reported
+};
+std::mutex backup_mtx;
+BackupRun backup_run;
+std::atomic<bool> backup_signalled{false};
+
+long minor_faults() {
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
 
-    long long removed = 0;
-    if (u.debt_seconds > 0) {
-        removed = VIRTUE_REWARD;
-        if (u.debt_seconds < removed) removed = u.debt_seconds;
-        u.debt_seconds -= removed;
+// In the child, where no other thread exists: nothing here may touch the
+// engine, Crow or a lock another thread could have held at fork().
+[[noreturn]] void backup_child(const std::string& path, int out) {
+    json report;
+    int code = 0;
+    try {
+        BackupStats st = write_backup(*storage, path);
+        report = {{"records", st.records}, {"bytes", st.bytes}};
+    } catch (const std::exception& e) {
+        report = {{"error", e.what()}};
+        code = 1;
     }
-    *last_track = now;
-    std::string col = (virtue_num == 1) ? "#2196F3" : "#9c27b0";
-    std::string action_key = (virtue_num == 1) ? "virtue1" : "virtue2";
-    add_log(u.name, action_key, "Completed: " + v_name + " (-1d)", col, -removed, u.debt_seconds);
-    save_db();
-    return true;
+    report["cow_bytes"] = private_dirty_bytes();
+    report["child_minor_faults"] = minor_faults();
+    std::string line = report.dump();
+    if (::write(out, line.data(), line.size()) < 0) code = 1;
+    _exit(code);
 }
 
-void reset_user(User& u, std::string verifier) {
-    time_t now = std::time(nullptr);
-    long long time_served = (long long)std::difftime(now, u.lock_time);
-    u.debt_seconds = u.base_cost - time_served;
-    if (u.debt_seconds < 0) u.debt_seconds = 0;
-    u.locked = false;
-    u.last_update = now;
-    u.streak++; 
-    add_log(u.name, "reset", "Bailed out by " + verifier + ".", "#4CAF50", 0, u.debt_seconds);
-    save_db();
-}
-
-bool perform_undo(User& u) {
-    if (activity_feed.empty()) return false;
-    
-    // Check for "LOCKED" message first (if I am currently locked)
-    if (u.locked && activity_feed.front().action == "locked" && activity_feed.front().user_name == u.name) {
-        u.locked = false;
-        u.lock_time = 0;
-        activity_feed.pop_front(); // Remove the "WENT BANKRUPT" message
-        // Do NOT return true yet. We must continue to undo the VICE action that caused it.
-        // If the feed is now empty (shouldn't be), return.
-        if (activity_feed.empty()) { save_db(); return true; }
+void reap_backup(pid_t pid, int in) {
+    std::string line;
+    char buf[512];
+    for (;;) {
+        ssize_t n = ::read(in, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        line.append(buf, (size_t)n);
+    }
+    ::close(in);
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    storage->hold_disk_writes(false);
+
+    json report = json::parse(line, nullptr, false);
+    if (!report.is_object()) report = json::object();
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && !report.contains("error");
+    if (!ok && !report.contains("error")) report["error"] = "backup process died (status " + std::to_string(status) + ")";
+
+    std::lock_guard<std::mutex> lock(backup_mtx);
+    report["ok"] = ok;
+    report["path"] = backup_run.path;
+    report["started_at"] = (long long)backup_run.started_at;
+    report["duration_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::steady_clock::now() - backup_run.started).count();
+    report["fork_us"] = backup_run.fork_us;
+    report["parent_minor_faults"] = minor_faults() - backup_run.parent_faults;
+    backup_run.last = report;
+    backup_run.running = false;
+    // Braced: the log macros are themselves an if
+    if (ok) {
+        CROW_LOG_INFO << "backup: " << report.dump();
+    } else {
+        CROW_LOG_ERROR << "backup failed: " << report.dump();
     }
+}
 
-    ActivityLog last = activity_feed.front();
-    
-    if (last.user_name == u.name) {
-        time_t now = std::time(nullptr);
-        // 10 minute undo window
-        if (std::difftime(now, last.timestamp) < 600) { 
-            
-            // Revert Debt
-            u.debt_seconds -= last.change_delta;
-            if (u.debt_seconds < 0) u.debt_seconds = 0;
-            
-            // Revert Cooldowns (Reset to 0)
-            if (last.action == "virtue1") u.last_v1 = 0;
-            if (last.action == "virtue2") u.last_v2 = 0;
-            
-            activity_feed.pop_front();
-            save_db();
-            return true;
+// Empty once a backup is on its way, otherwise why it isn't
+std::string start_backup(const std::string& path) {
+    std::lock_guard<std::mutex> lock(backup_mtx);
+    if (!storage) return "replicas have no storage to back up";
+    if (backup_run.running) return "a backup is already running";
+    int fds[2];
+    if (::pipe(fds) != 0) return std::string("pipe: ") + std::strerror(errno);
+
+    long faults = minor_faults();
+    auto started = std::chrono::steady_clock::now();
+    storage->hold_disk_writes(true);
+    storage->prepare_fork();
+    pid_t pid = ::fork();
+    storage->after_fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        backup_child(path, fds[1]);
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        std::string error = std::string("fork: ") + std::strerror(errno);
+        ::close(fds[0]);
+        storage->hold_disk_writes(false);
+        return error;
+    }
+    backup_run.running = true;
+    backup_run.pid = pid;
+    backup_run.path = path;
+    backup_run.started_at = std::time(nullptr);
+    backup_run.started = started;
+    backup_run.fork_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - started).count();
+    backup_run.parent_faults = faults;
+    std::thread(reap_backup, pid, fds[0]).detach();
+    return "";
+}
+
+json backup_json() {
+    std::lock_guard<std::mutex> lock(backup_mtx);
+    json out = {{"running", backup_run.running}, {"path", get_backup_path()}, {"last", backup_run.last}};
+    if (backup_run.running) {
+        out["path"] = backup_run.path;
+        out["pid"] = backup_run.pid;
+        out["started_at"] = (long long)backup_run.started_at;
+    }
+    return out;
+}
+
+// Fills a freshly opened database from a backup. Throws std::runtime_error
+// if the database isn't empty or the backup doesn't check out.
+void restore_backup(const std::string& path) {
+    bool empty = true;
+    storage->scan("", std::string(1, '\xff'), [&](const std::string&, const std::string&) {
+        empty = false;
+        return false;
+    });
+    if (!empty) throw std::runtime_error("RESTORE_FROM needs an empty database, and " + DB_FILE + " isn't");
+    StorageBatch batch;
+    BackupStats st = read_backup(path, [&](std::string key, std::string value) {
+        batch.push_back({std::move(key), std::move(value)});
+    });
+    storage->commit(std::move(batch));
+    std::cerr << "(server) restored " << st.records << " records from " << path << std::endl;
+}
+
+// --- HISTORY PAGING ---
+// Only HISTORY_CACHE users' event streams stay in memory (see event_store.h).
+// The rest are read back from storage when something needs them, so memory
+// follows the users who are actually active rather than everyone who ever
+// signed up. User records themselves stay resident: the household grid,
+// logins and leaderboards read all of them.
+
+size_t history_cache_size() {
+    const char* env_p = std::getenv("HISTORY_CACHE");
+    return env_p ? (size_t)std::max(0LL, std::atoll(env_p)) : 1000;
+}
+
+const User* page_in_stream(const std::string& id, std::vector<UserEvent>& out) {
+    auto it = users.find(id);
+    if (it == users.end()) return nullptr;
+    std::string prefix = event_prefix(id);
+    storage->scan(prefix, prefix_end(prefix), [&](const std::string&, const std::string& v) {
+        out.push_back(event_from_json(id, decode_object(v)));
+        return true;
+    });
+    return &it->second;
+}
+
+// Normally a no-op: every change is saved as it happens
+void write_back_stream(const std::string& id, const std::vector<UserEvent>& evs, size_t from) {
+    MemScope mem(MemTag::Persistence);
+    StorageBatch batch;
+    stream_changes(batch, id, evs, from);
+    if (batch.empty()) return;
+    storage->commit(std::move(batch), [](bool ok, const std::string& error) {
+        if (!ok) CROW_LOG_ERROR << "history write-back failed: " << error;
+    }, current_io_context);
+}
+
+// --- REPLICA APPLY ---
+
+void apply_replica_snapshot(const std::string& image) {
+    MemScope mem(MemTag::Persistence);
+    json j = json::parse(image);
+    std::lock_guard<std::mutex> lock(state_mutex);
+    load_db_json(engine, j);
+    chart_cache.clear();
+    leaderboards.clear();
+    for (auto& [key, user] : users) engine.refresh_rankings(user);
+    replica_loaded = true;
+}
+
+void apply_replica_record(const std::string& raw) {
+    MemScope mem(MemTag::Persistence);
+    json r = json::parse(raw);
+    std::string t = r["t"];
+    std::lock_guard<std::mutex> lock(state_mutex);
+    // The record itself is persistence; what it turns into belongs to its subsystem
+    if (t == "user") {
+        mem_swap_tag(MemTag::Users);
+        std::string id = r["id"];
+        users[id] = user_from_json(id, r["v"]);
+        engine.refresh_rankings(users[id]);
+    } else if (t == "user_del") {
+        leaderboards.remove(r["id"]);
+        users.erase(r["id"].get<std::string>());
+    } else if (t == "log") {
+        mem_swap_tag(MemTag::Feed);
+        ActivityLog log = log_from_json(r["v"]);
+        // Shipped oldest first; anything older is already here or has dropped off
+        if (log.id <= activity_feed.last_id()) return;
+        engine.next_log_id = std::max(engine.next_log_id, log.id);
+        chart_cache.invalidate(log.user_name);
+        activity_feed.append(std::move(log));
+    } else if (t == "log_del") {
+        if (std::optional<ActivityLog> gone = activity_feed.remove(r["id"].get<long long>())) {
+            chart_cache.invalidate(gone->user_name);
         }
+    } else if (t == "stats") {
+        mem_swap_tag(MemTag::Feed);
+        stats_from_json(analytics.at(r["name"]), r["v"]);
+    } else if (t == "stats_del") {
+        analytics.erase(r["name"]);
+    } else if (t == "event") {
+        mem_swap_tag(MemTag::History);
+        std::string id = r["id"];
+        auto it = users.find(id);
+        if (it == users.end()) {
+            event_store.erase(id);
+            return;
+        }
+        std::vector<UserEvent> evs;
+        if (!r["v"].is_null()) evs.push_back(event_from_json(id, r["v"]));
+        event_store.load(it->second, std::move(evs));
+    } else if (t == "history") {
+        mem_swap_tag(MemTag::Feed);
+        DebtSeries& series = engine.debt_history[r["name"]];
+        series.truncate_blocks(r["from"].get<size_t>());
+        for (const auto& b : r["v"]) history_block_from_json(series, b);
+        if (series.empty()) engine.debt_history.erase(r["name"].get<std::string>());
+        chart_cache.invalidate(r["name"]);
     }
-    return false;
+}
+
+std::string get_cookie(const crow::request& req, const std::string& key) {
+    return std::string(FormFields::cookies(req.get_header_value("Cookie")).get(key));
 }
 
 std::string get_logged_in_user(const crow::request& req) {
-    std::string cookie_val = req.get_header_value("Cookie");
-    if (cookie_val.find("user=") != std::string::npos) {
-        std::string name = cookie_val.substr(cookie_val.find("user=") + 5);
-        size_t end = name.find(';');
-        if (end != std::string::npos) name = name.substr(0, end);
+    std::string name = get_cookie(req, "user");
+    if (!name.empty()) {
         std::string decoded_name = name;
         std::replace(decoded_name.begin(), decoded_name.end(), '+', ' ');
         std::string lower_id = decoded_name;
@@ -367,52 +653,320 @@ std::string get_logged_in_user(const crow::request& req) {
     return "";
 }
 
-std::string get_form_value(const std::string& body, const std::string& key) {
-    std::string search = key + "=";
-    size_t start = body.find(search);
-    if (start == std::string::npos) return "";
-    start += search.length();
-    size_t end = body.find('&', start);
-    if (end == std::string::npos) end = body.length();
-    std::string val = body.substr(start, end - start);
-    std::replace(val.begin(), val.end(), '+', ' ');
-    return val;
+// Ids are lowercased names; they go into the user cookie and storage keys
+const size_t MAX_USER_ID = 64;
+
+bool valid_user_id(std::string_view id) {
+    if (id.empty() || id.size() > MAX_USER_ID || id.front() == ' ' || id.back() == ' ') return false;
+    for (char c : id) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == ' ' || c == '_' || c == '-' || c == '.';
+        if (!ok) return false;
+    }
+    return true;
 }
 
-bool is_same_day(time_t t1, time_t t2) {
-    struct tm* tm1 = std::localtime(&t1);
-    struct tm tm1_copy = *tm1; 
-    struct tm* tm2 = std::localtime(&t2);
-    return (tm1_copy.tm_year == tm2->tm_year && tm1_copy.tm_yday == tm2->tm_yday);
+// Spaces travel as '+', which get_logged_in_user() turns back
+std::string user_cookie(std::string id) {
+    std::replace(id.begin(), id.end(), ' ', '+');
+    return "user=" + id + "; Path=/; HttpOnly; Max-Age=31536000";
 }
 
-std::string get_day_name(time_t t) {
-    char buffer[10];
-    struct tm* tm_info = std::localtime(&t);
-    strftime(buffer, 10, "%a", tm_info); 
-    return std::string(buffer);
+// Crow hands handlers a const view of a request it owns and never reads the
+// body of again, so the form is decoded in place rather than copied
+FormFields form_fields(const crow::request& req) {
+    return FormFields(const_cast<std::string&>(req.body));
 }
 
-// --- HTML RENDERERS ---
+// Contract terms shared by the signup and edit forms; nothing on bad numbers
+std::optional<User> contract_from_form(const FormFields& form) {
+    Field<double> vice_freq = form.number<double>("vice_freq");
+    Field<double> vice_per = form.number<double>("vice_per");
+    Field<double> v1_freq = form.number<double>("v1_freq");
+    Field<double> v1_per = form.number<double>("v1_per");
+    Field<double> v2_freq = form.number<double>("v2_freq");
+    Field<double> v2_per = form.number<double>("v2_per");
+    for (const Field<double>* f : {&vice_freq, &vice_per, &v1_freq, &v1_per, &v2_freq, &v2_per}) {
+        if (!f->ok()) return std::nullopt;
+    }
+    if (vice_freq.value <= 0 || vice_per.value <= 0 || v1_per.value <= 0 || v2_per.value <= 0) return std::nullopt;
+    if (v1_freq.value < 0 || v2_freq.value < 0) return std::nullopt;
+
+    User terms;
+    terms.vice = form.get("vice");
+    terms.target_interval_days = vice_per.value / vice_freq.value;
+    terms.virtue1_name = form.get("v1name");
+    terms.promised_v1_weekly = (v1_freq.value / v1_per.value) * 7.0;
+    terms.virtue2_name = form.get("v2name");
+    terms.promised_v2_weekly = (v2_freq.value / v2_per.value) * 7.0;
+    return terms;
+}
 
-std::string render_calendar(const std::string& username) {
-    time_t now = std::time(nullptr);
-    std::string html = "<div style='display:flex; justify-content:space-between; margin-top:15px; background:rgba(0,0,0,0.2); padding:10px; border-radius:8px;'>";
-    for (int i = 6; i >= 0; i--) {
-        time_t day_time = now - (i * 86400);
-        std::string day_label = (i == 0) ? "Today" : get_day_name(day_time);
-        bool has_vice = false;
-        int virtue_count = 0;
-        for (const auto& log : activity_feed) {
-            if (log.user_name == username) {
-                if (is_same_day(log.timestamp, day_time)) {
-                    if (log.action == "vice") has_vice = true;
-                    if (log.action == "virtue1" || log.action == "virtue2") virtue_count++;
-                }
+const size_t MAX_BATCH = 1000; // Actions per /api/actions request
+
+// {"actions": [{"key": "...", "action": "vice" | "virtue1" | "virtue2", "ts": unix seconds}, ...]}
+std::optional<std::vector<OfflineAction>> actions_from_body(const json& body) {
+    if (!body.is_object() || !body.contains("actions") || !body["actions"].is_array()) return std::nullopt;
+    if (body["actions"].size() > MAX_BATCH) return std::nullopt;
+    std::vector<OfflineAction> out;
+    for (const auto& a : body["actions"]) {
+        if (!a.is_object() || !a.contains("key") || !a["key"].is_string()) return std::nullopt;
+        if (!a.contains("action") || !a["action"].is_string()) return std::nullopt;
+        if (!a.contains("ts") || !a["ts"].is_number_integer()) return std::nullopt;
+        OfflineAction act;
+        act.key = a["key"].get<std::string>();
+        act.ts = a["ts"].get<time_t>();
+        std::string type = a["action"];
+        if (type == "vice") act.type = EventType::Vice;
+        else if (type == "virtue1" || type == "virtue2") {
+            act.type = EventType::Virtue;
+            act.virtue = type == "virtue1" ? 1 : 2;
+        } else {
+            return std::nullopt;
+        }
+        out.push_back(std::move(act));
+    }
+    return out;
+}
+
+// JSON unless Accept prefers CBOR or MessagePack; 406 if it takes none of them
+crow::response api_response(const crow::request& req, const json& body) {
+    std::optional<Encoding> enc = negotiate(req.get_header_value("Accept"));
+    if (!enc) return crow::response(406);
+    crow::response res(encode(body, *enc));
+    res.set_header("Content-Type", mime_type(*enc));
+    res.set_header("Vary", "Accept");
+    return res;
+}
+
+// --- ADMISSION CONTROL ---
+
+AdmissionController admission(AdmissionConfig::from_env());
+
+RequestClass classify_request(const crow::request& req) {
+    if (req.method != crow::HTTPMethod::Get) return RequestClass::Write;
+    static const char* mutating[] = {"/vice", "/virtue/1", "/virtue/2", "/reset", "/undo"};
+    for (const char* path : mutating) {
+        if (req.url == path) return RequestClass::Write;
+    }
+    return RequestClass::Read;
+}
+
+// Anyone can send Fly-Client-IP, so it only counts when fly-proxy is the
+// peer (TRUST_FLY_CLIENT_IP) or, on a writer, when a reader forwarded it
+bool trust_fly_client_ip = false;
+bool trust_loopback_client_ip = false;
+
+bool is_loopback(const std::string& ip) {
+    asio::error_code ec;
+    asio::ip::address addr = asio::ip::make_address(ip, ec);
+    if (ec) return false;
+    if (addr.is_v6() && addr.to_v6().is_v4_mapped()) return addr.to_v6().to_v4().is_loopback();
+    return addr.is_loopback();
+}
+
+std::string get_client_ip(const crow::request& req) {
+    // fly-proxy terminates the connection and reports the real peer here
+    if (trust_fly_client_ip || (trust_loopback_client_ip && is_loopback(req.remote_ip_address))) {
+        const std::string& fly_ip = req.get_header_value("Fly-Client-IP");
+        if (!fly_ip.empty()) return fly_ip;
+    }
+    return req.remote_ip_address;
+}
+
+// Sheds abusive or overflow traffic with 429 before it reaches the engine
+struct AdmissionControl {
+    struct context { bool admitted = false; };
+
+    void before_handle(crow::request& req, crow::response& res, context& ctx) {
+        AdmissionDecision d = admission.admit(classify_request(req), get_cookie(req, "user"), get_client_ip(req));
+        if (!d.admitted) {
+            res.code = 429;
+            res.add_header("Retry-After", std::to_string(d.retry_after_sec));
+            res.body = "Too Many Requests";
+            res.end();
+            return;
+        }
+        ctx.admitted = true;
+    }
+
+    void after_handle(crow::request&, crow::response&, context& ctx) {
+        if (ctx.admitted) admission.finish();
+    }
+};
+
+// Readers hand the request to the writer and answer with its response,
+// once their own copy has caught up with it, so the page a write redirects
+// to already shows the write (when it's served by the same reader).
+const std::chrono::milliseconds FORWARD_SETTLE(100);
+
+void forward_to_writer(const crow::request& req, crow::response& res) {
+    ForwardRequest f;
+    f.method = crow::method_name(req.method);
+    f.target = req.raw_url;
+    for (auto const& [name, value] : req.headers) {
+        if (strcasecmp(name.c_str(), "Content-Length") == 0 || strcasecmp(name.c_str(), "Connection") == 0 ||
+            strcasecmp(name.c_str(), "Fly-Client-IP") == 0) continue;
+        f.headers.push_back({name, value});
+    }
+    // The writer's rate limits should see the client, not loopback
+    f.headers.push_back({"Fly-Client-IP", get_client_ip(req)});
+    f.body = req.body;
+
+    std::optional<ForwardResponse> r = forward_request(writer_host, writer_port, f);
+    if (!r) {
+        res.code = 502;
+        res.body = "Writer unavailable";
+        return;
+    }
+    uint64_t lsn = 0;
+    res.code = r->status;
+    for (auto const& [name, value] : r->headers) {
+        if (strcasecmp(name.c_str(), "X-Commit-Lsn") == 0) lsn = std::strtoull(value.c_str(), nullptr, 10);
+        else if (strcasecmp(name.c_str(), "Server") != 0 && strcasecmp(name.c_str(), "Date") != 0) res.add_header(name, value);
+    }
+    res.body = std::move(r->body);
+    auto deadline = std::chrono::steady_clock::now() + FORWARD_SETTLE;
+    while (replica_client.applied_lsn() < lsn && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+// Holds the state lock for the whole handler when more than one thread can
+// touch state; replicas also bounce writes to the primary here
+struct StateGuard {
+    struct context { std::unique_lock<std::mutex> lock; };
+
+    void before_handle(crow::request& req, crow::response& res, context& ctx) {
+        // Event history and the search index are only kept on the primary
+        if (replica_mode && (classify_request(req) == RequestClass::Write || req.url == "/api/debt_at" ||
+                             req.url == "/search" || req.url == "/api/search")) {
+            if (writer_port) {
+                forward_to_writer(req, res);
+            } else {
+                res.code = req.method == crow::HTTPMethod::Get ? 302 : 307;
+                res.add_header("Location", primary_url + req.raw_url);
             }
+            res.end();
+            return;
         }
+        // The feed is safe to read alongside writers; its route locks only to check the login
+        if (lock_state && req.url != "/api/feed") ctx.lock = std::unique_lock<std::mutex>(state_mutex);
+    }
+
+    void after_handle(crow::request&, crow::response& res, context& ctx) {
+        if (ctx.lock.owns_lock()) ctx.lock.unlock();
+        if (replica_mode) res.add_header("X-Replica-Lag", std::to_string(replica_client.lag_seconds()));
+        if (replication_primary.running()) res.add_header("X-Commit-Lsn", std::to_string(replication_primary.lsn()));
+    }
+};
+
+// --- TRAFFIC CAPTURE ---
+// CAPTURE_PATH=<file> records every request this process answers (see
+// capture.h) so bench/replay can send the same traffic to another build.
+// Capture starts with a backup to <file>.backup: the database those
+// requests were made against. Records collect in memory and the I/O thread
+// appends them every CAPTURE_FLUSH bytes or second; past CAPTURE_MAX_MB
+// the rest are counted and dropped.
+
+CaptureWriter capture;
+std::chrono::steady_clock::time_point capture_started;
+const size_t CAPTURE_FLUSH = 64 * 1024;
+
+uint64_t capture_max_bytes() {
+    const char* env_p = std::getenv("CAPTURE_MAX_MB");
+    return (uint64_t)(env_p ? std::max(1LL, std::atoll(env_p)) : 1024) * 1024 * 1024;
+}
+
+void flush_capture() {
+    persist_queue.submit("capture", [](std::string& error) { return capture.flush(error); },
+                         [](bool ok, const std::string& error) {
+                             if (!ok) CROW_LOG_ERROR << "capture: " << error;
+                         });
+}
+
+// Throws std::runtime_error if the file can't be created
+void start_capture(const std::string& path) {
+    auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+    capture.open(path, std::chrono::duration_cast<std::chrono::microseconds>(since_epoch).count(), capture_max_bytes());
+    capture_started = std::chrono::steady_clock::now();
+    std::string error = start_backup(path + ".backup");
+    if (!error.empty()) CROW_LOG_WARNING << "capture: no snapshot to replay against (" << error << ")";
+    std::cerr << "(server) capturing traffic to " << path << std::endl;
+}
+
+json capture_json() {
+    if (!capture.is_open()) return json();
+    return {{"path", capture.file()}, {"records", capture.records()}, {"bytes", capture.bytes()}, {"dropped", capture.dropped()}};
+}
+
+// Outermost, so its times include admission and the state lock, and
+// requests shed with 429 are recorded too
+struct TrafficCapture {
+    struct context {
+        std::chrono::steady_clock::time_point arrived;
+        std::string body; // Form handlers decode req.body in place
+    };
+
+    void before_handle(crow::request& req, crow::response&, context& ctx) {
+        if (!capture.is_open()) return;
+        ctx.arrived = std::chrono::steady_clock::now();
+        ctx.body = redact_form(req.body);
+    }
+
+    void after_handle(crow::request& req, crow::response& res, context& ctx) {
+        if (!capture.is_open()) return;
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        CapturedRequest r;
+        r.arrival_us = duration_cast<microseconds>(ctx.arrived - capture_started).count();
+        r.duration_us = duration_cast<microseconds>(std::chrono::steady_clock::now() - ctx.arrived).count();
+        r.status = res.code;
+        r.method = crow::method_name(req.method);
+        r.target = req.raw_url;
+        r.user = get_cookie(req, "user");
+        r.content_type = req.get_header_value("Content-Type");
+        r.body = std::move(ctx.body);
+        capture.add(r);
+        if (capture.buffered() >= CAPTURE_FLUSH) flush_capture();
+    }
+};
+
+// --- HTML RENDERERS ---
+
+std::shared_ptr<const std::string> chart_series_payload(const std::string& username) {
+    return chart_cache.get(username, [&]() {
+        std::vector<SeriesPoint> pts;
+        auto it = engine.debt_history.find(username);
+        if (it == engine.debt_history.end()) return pts;
+        std::vector<DebtPoint> history = it->second.points();
+        pts.reserve(history.size());
+        for (const DebtPoint& p : history) pts.push_back({(long long)p.ts, p.snapshot});
+        return pts;
+    }, CHART_POINTS);
+}
+
+void render_calendar(pstring& html, const User& u) {
+    const std::string& username = u.name;
+    long long today = civil_day(std::time(nullptr), *u.zone);
+
+    // Bucket the feed into the last 7 days in a single pass
+    bool has_vice_by_day[7] = {false};
+    int virtues_by_day[7] = {0};
+    for (const ActivityLog* log : activity_feed.snapshot()) {
+        if (log->user_name != username) continue;
+        long long age = today - civil_day(log->timestamp, *u.zone);
+        if (age < 0 || age > 6) continue;
+        if (log->action == "vice") has_vice_by_day[age] = true;
+        if (log->action == "virtue1" || log->action == "virtue2") virtues_by_day[age]++;
+    }
+
+    html += "<div style='display:flex; justify-content:space-between; margin-top:15px; background:rgba(0,0,0,0.2); padding:10px; border-radius:8px;'>";
+    for (int i = 6; i >= 0; i--) {
+        const char* day_label = (i == 0) ? "Today" : weekday_abbrev(today - i);
+        bool has_vice = has_vice_by_day[i];
+        int virtue_count = virtues_by_day[i];
         html += "<div style='text-align:center; flex:1; display:flex; flex-direction:column; align-items:center;'>";
-        html += "<div style='font-size:0.65em; color:#666; margin-bottom:5px; text-transform:uppercase;'>" + day_label + "</div>";
+        cat(html, "<div style='font-size:0.65em; color:#666; margin-bottom:5px; text-transform:uppercase;'>", day_label, "</div>");
         html += "<div style='background:rgba(255,255,255,0.03); width:30px; height:40px; border-radius:4px; display:flex; flex-direction:column; justify-content:flex-end; align-items:center; padding:3px; gap:2px; border:1px solid rgba(255,255,255,0.05);'>";
             
             if (virtue_count > 0) {
@@ -459,27 +1013,22 @@ std::string render_calendar(const std::string& username) {
                     pointRadius: 0
                 }]
             };
-            const logs = [
-    )";
-    
-    std::vector<ActivityLog> user_logs;
-    for(const auto& log : activity_feed) {
-        if(log.user_name == username && (log.action == "vice" || log.action == "virtue1" || log.action == "virtue2" || log.action == "reset")) {
-            user_logs.push_back(log);
-        }
-    }
-    std::reverse(user_logs.begin(), user_logs.end()); 
-    
-    for(const auto& log : user_logs) {
-        double debt_days = (double)log.debt_snapshot / (double)DAY_SEC;
-        html += "{ y: " + std::to_string(debt_days) + " },";
-    }
-    
-    html += R"(
-            ];
-            logs.forEach((log, index) => {
+            const series = )";
+    html += *chart_series_payload(username);
+    html += R"(;
+            // Base64 little-endian int32 deltas -> absolute values
+            const decode = (b64, base) => {
+                const bin = atob(b64), out = [];
+                let acc = base;
+                for (let i = 0; i + 3 < bin.length; i += 4) {
+                    acc += bin.charCodeAt(i) | (bin.charCodeAt(i+1) << 8) | (bin.charCodeAt(i+2) << 16) | (bin.charCodeAt(i+3) << 24);
+                    out.push(acc);
+                }
+                return out;
+            };
+            decode(series.y, 0).forEach((y, index) => {
                 data.labels.push(index + 1);
-                data.datasets[0].data.push(log.y);
+                data.datasets[0].data.push(y / 86400);
             });
             new Chart(ctx, {
                 type: 'line',
@@ -498,7 +1047,6 @@ std::string render_calendar(const std::string& username) {
         }
     </script>
     )";
-    return html;
 }
 
 std::string render_signup_wizard(std::string error = "") {
@@ -604,6 +1152,10 @@ std::string render_signup_wizard(std::string error = "") {
                 document.getElementById('r-v2').innerText = v2;
                 document.getElementById('r-v2-sub').innerText = v2f + "x / " + v2p;
             }
+
+            window.addEventListener('DOMContentLoaded', () => {
+                try { document.getElementById('tz').value = Intl.DateTimeFormat().resolvedOptions().timeZone || ''; } catch (e) {}
+            });
         </script>
     </head>
     <body>
@@ -628,6 +1180,7 @@ std::string render_signup_wizard(std::string error = "") {
                     <div class="input-wrapper">
                         <label>Password</label>
                         <input type="password" name="password" placeholder="Password" required>
+                        <input type="hidden" name="tz" id="tz">
                     </div>
                     <div class="btn-row" style="justify-content:center">
                         <button type="button" onclick="next()">Start Contract</button>
@@ -781,7 +1334,7 @@ std::string render_edit_page(const User& u) {
                 
                 <div class="input-wrapper">
                     <label>Vice Name</label>
-                    <input type="text" name="vice" value=")=====" + u.vice + R"=====(">
+                    <input type="text" name="vice" value=")=====" + html_escape(u.vice) + R"=====(">
                 </div>
                 
                 <div class="input-wrapper">
@@ -802,7 +1355,7 @@ std::string render_edit_page(const User& u) {
 
                 <div class="input-wrapper">
                     <label>Virtue #1</label>
-                    <input type="text" name="v1name" value=")=====" + u.virtue1_name + R"=====(">
+                    <input type="text" name="v1name" value=")=====" + html_escape(u.virtue1_name) + R"=====(">
                     <div class="combo-input" style="margin-top:5px">
                         <input type="number" name="v1_freq" value="3" min="1">
                         <div class="slash">/</div>
@@ -815,7 +1368,7 @@ std::string render_edit_page(const User& u) {
 
                 <div class="input-wrapper">
                     <label>Virtue #2</label>
-                    <input type="text" name="v2name" value=")=====" + u.virtue2_name + R"=====(">
+                    <input type="text" name="v2name" value=")=====" + html_escape(u.virtue2_name) + R"=====(">
                     <div class="combo-input" style="margin-top:5px">
                         <input type="number" name="v2_freq" value="5" min="1">
                         <div class="slash">/</div>
@@ -828,6 +1381,11 @@ std::string render_edit_page(const User& u) {
                 
                 <hr style="border:0; border-top:1px solid #444; margin:25px 0;">
                 
+                <div class="input-wrapper">
+                    <label>Time Zone</label>
+                    <input type="text" name="tz" value=")=====" + html_escape(u.tz_name) + R"=====(" placeholder="e.g. America/Toronto">
+                </div>
+
                 <div class="input-wrapper">
                     <label>New Password</label>
                     <input type="password" name="new_password" placeholder="Leave blank to keep current">
@@ -849,6 +1407,362 @@ std::string render_edit_page(const User& u) {
     return html;
 }
 
+// --- INSIGHTS ---
+
+json build_insights(const User& u) {
+    long long today = civil_day(std::time(nullptr), *u.zone);
+    long long this_week = week_index(today);
+    const UserStats* st = analytics.find(u.name);
+    UserStats empty;
+    if (!st) st = &empty;
+
+    auto window = [&](const WindowCounts& w, double weeks) {
+        double p1 = u.promised_v1_weekly * weeks;
+        double p2 = u.promised_v2_weekly * weeks;
+        return json{
+            {"vices", w.vices},
+            {"virtue1", w.virtue1},
+            {"virtue2", w.virtue2},
+            {"virtue1_promised", p1},
+            {"virtue2_promised", p2},
+            {"virtue1_adherence", p1 > 0 ? w.virtue1 / p1 : 0.0},
+            {"virtue2_adherence", p2 > 0 ? w.virtue2 / p2 : 0.0}
+        };
+    };
+
+    json recent = json::array();
+    for (int i = 7; i >= 0; i--) {
+        WindowCounts w = analytics.week(u.name, this_week - i);
+        recent.push_back({{"weeks_ago", i}, {"vices", w.vices}, {"virtue1", w.virtue1}, {"virtue2", w.virtue2}});
+    }
+
+    return {
+        {"user", u.name},
+        {"virtue1_name", u.virtue1_name},
+        {"virtue2_name", u.virtue2_name},
+        {"week", window(analytics.week(u.name, this_week), 1.0)},
+        {"month", window(analytics.month(u.name, month_index(today)), 30.436875 / 7.0)},
+        {"recent_weeks", recent},
+        {"avg_debt_days", st->avg_debt_days()},
+        {"avg_time_to_clean_days", st->avg_time_to_clean_days()},
+        {"clean_episodes", st->clean_episodes},
+        {"bankruptcies", st->bankruptcies}
+    };
+}
+
+std::string fmt_days(double d) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << d;
+    return ss.str();
+}
+
+std::string render_insights(const User& u) {
+    json in = build_insights(u);
+    std::string html = R"=====(
+    <!DOCTYPE html>
+    <html>
+    <head>
+        <meta charset="UTF-8">
+        <meta name="viewport" content="width=device-width, initial-scale=1">
+        <title>Insights</title>
+        <style>
+            body { background: #121212; color: #e0e0e0; font-family: -apple-system, BlinkMacSystemFont, "Segoe UI", Roboto, Helvetica, Arial, sans-serif; max-width: 600px; margin: 0 auto; padding: 20px; }
+            h2 { color: #4CAF50; text-align: center; letter-spacing: -1px; }
+            .card { background: rgba(30, 30, 30, 0.6); border: 1px solid rgba(255, 255, 255, 0.08); padding: 20px; border-radius: 16px; margin-bottom: 20px; }
+            .card h3 { color: #666; font-size: 0.8em; letter-spacing: 1px; text-transform: uppercase; margin-top: 0; }
+            .row { display: flex; justify-content: space-between; padding: 6px 0; border-bottom: 1px solid #222; }
+            .row:last-child { border-bottom: none; }
+            .label { color: #888; }
+            .val { font-weight: 700; font-variant-numeric: tabular-nums; }
+            .bars { display: flex; align-items: flex-end; gap: 6px; height: 80px; }
+            .bar { flex: 1; display: flex; flex-direction: column; justify-content: flex-end; gap: 2px; }
+            .seg { border-radius: 2px; }
+            a { display:block; text-align:center; margin-top:15px; color:#666; text-decoration:none; text-transform:uppercase; font-size:0.8em; }
+        </style>
+    </head>
+    <body>
+        <h2>Insights</h2>
+    )=====";
+
+    auto window_card = [&](const std::string& title, const json& w) {
+        html += "<div class='card'><h3>" + title + "</h3>";
+        html += "<div class='row'><span class='label'>" + html_escape(u.vice) + "</span><span class='val' style='color:#ff5252'>" + std::to_string(w["vices"].get<int>()) + "</span></div>";
+        html += "<div class='row'><span class='label'>" + html_escape(u.virtue1_name) + "</span><span class='val' style='color:#2196F3'>" + std::to_string(w["virtue1"].get<int>()) + " / " + fmt_days(w["virtue1_promised"].get<double>()) + " (" + std::to_string((int)std::round(w["virtue1_adherence"].get<double>() * 100)) + "%)</span></div>";
+        html += "<div class='row'><span class='label'>" + html_escape(u.virtue2_name) + "</span><span class='val' style='color:#9c27b0'>" + std::to_string(w["virtue2"].get<int>()) + " / " + fmt_days(w["virtue2_promised"].get<double>()) + " (" + std::to_string((int)std::round(w["virtue2_adherence"].get<double>() * 100)) + "%)</span></div>";
+        html += "</div>";
+    };
+    window_card("This Week", in["week"]);
+    window_card("This Month", in["month"]);
+
+    // 8-week bars: virtues stacked over vices
+    int peak = 1;
+    for (const auto& w : in["recent_weeks"]) peak = std::max(peak, w["vices"].get<int>() + w["virtue1"].get<int>() + w["virtue2"].get<int>());
+    html += "<div class='card'><h3>Last 8 Weeks</h3><div class='bars'>";
+    for (const auto& w : in["recent_weeks"]) {
+        html += "<div class='bar'>";
+        html += "<div class='seg' style='background:#2196F3; height:" + std::to_string(w["virtue1"].get<int>() * 80 / peak) + "px'></div>";
+        html += "<div class='seg' style='background:#9c27b0; height:" + std::to_string(w["virtue2"].get<int>() * 80 / peak) + "px'></div>";
+        html += "<div class='seg' style='background:#ff5252; height:" + std::to_string(w["vices"].get<int>() * 80 / peak) + "px'></div>";
+        html += "</div>";
+    }
+    html += "</div></div>";
+
+    html += "<div class='card'><h3>All Time</h3>";
+    html += "<div class='row'><span class='label'>Average Debt</span><span class='val'>" + fmt_days(in["avg_debt_days"].get<double>()) + "d</span></div>";
+    html += "<div class='row'><span class='label'>Average Time To Clean</span><span class='val'>" + fmt_days(in["avg_time_to_clean_days"].get<double>()) + "d</span></div>";
+    html += "<div class='row'><span class='label'>Times Clean</span><span class='val'>" + std::to_string(in["clean_episodes"].get<long long>()) + "</span></div>";
+    html += "<div class='row'><span class='label'>Bankruptcies</span><span class='val'>" + std::to_string(in["bankruptcies"].get<int>()) + "</span></div>";
+    html += "</div>";
+
+    html += "<a href='/'>Back</a></body></html>";
+    return html;
+}
+
+// --- LEADERBOARD ---
+
+const char* BOARD_KEYS[] = {"debt", "streak", "clean", "virtues"};
+const char* BOARD_TITLES[] = {"Lowest Debt", "Longest Streak", "Longest Clean Run", "Most Virtues This Week"};
+const size_t LEADERBOARD_PAGE = 20;
+
+Board parse_board(const char* key) {
+    for (int i = 0; key && i < BOARD_COUNT; i++) {
+        if (std::string(key) == BOARD_KEYS[i]) return (Board)i;
+    }
+    return Board::Debt;
+}
+
+std::string board_value(Board b, const User& u) {
+    time_t now = std::time(nullptr);
+    switch (b) {
+        case Board::Debt: {
+            if (u.locked) return "BANKRUPT";
+            long long debt = std::max(0LL, u.debt_seconds - (long long)std::difftime(now, u.last_update));
+            return debt == 0 ? "CLEAN" : fmt_days((double)debt / (double)DAY_SEC) + "d";
+        }
+        case Board::Streak: return std::to_string(u.streak);
+        case Board::Clean: return fmt_days(std::difftime(now, u.last_vice) / (double)DAY_SEC) + "d";
+        case Board::Virtues: {
+            WindowCounts w = analytics.week(u.name, week_index(civil_day(now, *u.zone)));
+            return std::to_string(w.virtue1 + w.virtue2);
+        }
+    }
+    return "";
+}
+
+json build_leaderboard(Board b, size_t offset, size_t limit, const std::string& me) {
+    // Weekly counts restart on Monday; rebuild that board once per week
+    long long week = week_index(civil_day(std::time(nullptr), *default_zone()));
+    if (week != leaderboard_week) {
+        for (auto& [key, user] : users) engine.refresh_rankings(user);
+        leaderboard_week = week;
+    }
+
+    json entries = json::array();
+    size_t rank = offset;
+    for (const std::string& id : leaderboards.page(b, offset, limit)) {
+        const User& u = users[id];
+        entries.push_back({{"rank", ++rank}, {"id", id}, {"name", u.name}, {"value", board_value(b, u)}});
+    }
+    return {
+        {"board", BOARD_KEYS[(int)b]},
+        {"total", leaderboards.size(b)},
+        {"my_rank", leaderboards.rank(b, me)},
+        {"offset", offset},
+        {"entries", entries}
+    };
+}
+
+std::string render_leaderboard(Board b, size_t page_num, const std::string& me) {
+    json lb = build_leaderboard(b, page_num * LEADERBOARD_PAGE, LEADERBOARD_PAGE, me);
+    std::string html = R"=====(
+    <!DOCTYPE html>
+    <html>
+    <head>
+        <meta charset="UTF-8">
+        <meta name="viewport" content="width=device-width, initial-scale=1">
+        <title>Leaderboard</title>
+        <style>
+            body { background: #121212; color: #e0e0e0; font-family: -apple-system, BlinkMacSystemFont, "Segoe UI", Roboto, Helvetica, Arial, sans-serif; max-width: 600px; margin: 0 auto; padding: 20px; }
+            h2 { color: #4CAF50; text-align: center; letter-spacing: -1px; }
+            .tabs { display: grid; grid-template-columns: 1fr 1fr; gap: 8px; margin-bottom: 20px; }
+            .tabs a { text-align: center; padding: 10px; border-radius: 8px; background: #1e1e1e; color: #888; text-decoration: none; font-size: 0.8em; text-transform: uppercase; letter-spacing: 0.5px; border: 1px solid #333; }
+            .tabs a.active { color: #fff; border-color: #4CAF50; }
+            .me { text-align: center; color: #888; font-size: 0.85em; margin-bottom: 15px; }
+            .row { display: flex; justify-content: space-between; padding: 12px 15px; background: rgba(30, 30, 30, 0.6); border-radius: 10px; margin-bottom: 6px; border: 1px solid rgba(255, 255, 255, 0.05); }
+            .row.mine { border-color: #4CAF50; }
+            .rank { color: #666; width: 40px; font-variant-numeric: tabular-nums; }
+            .name { flex: 1; font-weight: 700; }
+            .val { font-variant-numeric: tabular-nums; color: #ccc; }
+            .pager { display: flex; justify-content: space-between; margin-top: 15px; }
+            .pager a, .back { color: #666; text-decoration: none; text-transform: uppercase; font-size: 0.8em; }
+            .back { display: block; text-align: center; margin-top: 25px; }
+        </style>
+    </head>
+    <body>
+        <h2>Leaderboard</h2>
+        <div class="tabs">
+    )=====";
+    for (int i = 0; i < BOARD_COUNT; i++) {
+        html += "<a href='/leaderboard?board=" + std::string(BOARD_KEYS[i]) + "'" + ((Board)i == b ? " class='active'" : "") + ">" + BOARD_TITLES[i] + "</a>";
+    }
+    html += "</div>";
+
+    size_t my_rank = lb["my_rank"];
+    size_t total = lb["total"];
+    if (my_rank) html += "<div class='me'>You are #" + std::to_string(my_rank) + " of " + std::to_string(total) + "</div>";
+
+    for (const auto& e : lb["entries"]) {
+        bool mine = e["id"] == me;
+        html += "<div class='row" + std::string(mine ? " mine" : "") + "'>";
+        html += "<span class='rank'>#" + std::to_string(e["rank"].get<size_t>()) + "</span>";
+        html += "<span class='name'>" + html_escape(e["name"].get<std::string>()) + "</span>";
+        html += "<span class='val'>" + e["value"].get<std::string>() + "</span>";
+        html += "</div>";
+    }
+
+    std::string base = "/leaderboard?board=" + std::string(BOARD_KEYS[(int)b]) + "&page=";
+    html += "<div class='pager'>";
+    html += page_num > 0 ? "<a href='" + base + std::to_string(page_num - 1) + "'>← Prev</a>" : "<span></span>";
+    html += (page_num + 1) * LEADERBOARD_PAGE < total ? "<a href='" + base + std::to_string(page_num + 1) + "'>Next →</a>" : "<span></span>";
+    html += "</div>";
+
+    html += "<a class='back' href='/'>Back</a></body></html>";
+    return html;
+}
+
+// --- SEARCH ---
+
+const size_t SEARCH_PAGE = 50;
+
+std::string url_encode(std::string_view s) {
+    static const char* hex = "0123456789ABCDEF";
+    std::string out;
+    for (char c : s) {
+        unsigned char b = (unsigned char)c;
+        if (std::isalnum(b) || c == '-' || c == '_' || c == '.' || c == '~') out += c;
+        else {
+            out += '%';
+            out += hex[b >> 4];
+            out += hex[b & 15];
+        }
+    }
+    return out;
+}
+
+
+// ?q=<words>&user=<name>&action=<vice|virtue1|...> and either
+// &month=YYYY-MM (in the searcher's zone) or &from=&to= (unix seconds),
+// plus &offset=&limit=. Nothing if a parameter is malformed.
+std::optional<SearchQuery> search_query(const crow::request& req, const User& me) {
+    SearchQuery q;
+    q.limit = SEARCH_PAGE;
+    if (const char* text = req.url_params.get("q")) q.terms.push_back(text);
+    if (const char* user = req.url_params.get("user")) q.user = user;
+    if (const char* action = req.url_params.get("action")) q.action = action;
+
+    const char* month = req.url_params.get("month");
+    if (month && *month) {
+        unsigned y = 0, m = 0;
+        int used = 0;
+        if (std::sscanf(month, "%4u-%2u%n", &y, &m, &used) != 2 || month[used] || m < 1 || m > 12) return std::nullopt;
+        long long idx = (long long)y * 12 + (m - 1);
+        q.from = day_start(month_start_day(idx), *me.zone);
+        q.to = day_start(month_start_day(idx + 1), *me.zone);
+    }
+    auto number = [&](const char* name, long long& out) {
+        const char* v = req.url_params.get(name);
+        if (!v) return true;
+        Field<long long> n = parse_number<long long>(v);
+        out = n.value;
+        return n.ok();
+    };
+    long long from = q.from, to = q.to, offset = 0, limit = SEARCH_PAGE;
+    if (!number("from", from) || !number("to", to) || !number("offset", offset) || !number("limit", limit)) return std::nullopt;
+    if (offset < 0 || limit < 0) return std::nullopt;
+    q.from = (time_t)from;
+    q.to = (time_t)to;
+    q.offset = (size_t)offset;
+    q.limit = std::min<size_t>((size_t)limit, 500);
+    return q;
+}
+
+// The index only has ids; the entries are read back from storage
+json build_search(const SearchQuery& q) {
+    SearchResult found = engine.search.search(q);
+    json results = json::array();
+    for (long long id : found.ids) {
+        if (std::optional<std::string> v = storage->get(log_key(id))) results.push_back(decode_object(*v));
+    }
+    return {{"total", found.total}, {"offset", q.offset}, {"results", results}};
+}
+
+std::string render_search(const crow::request& req, const SearchQuery& q, const User& me) {
+    json found = build_search(q);
+    const char* text = req.url_params.get("q");
+    const char* month = req.url_params.get("month");
+    std::string html = R"=====(
+    <!DOCTYPE html>
+    <html>
+    <head>
+        <meta charset="UTF-8">
+        <meta name="viewport" content="width=device-width, initial-scale=1">
+        <title>Search</title>
+        <style>
+            body { background: #121212; color: #e0e0e0; font-family: -apple-system, BlinkMacSystemFont, "Segoe UI", Roboto, Helvetica, Arial, sans-serif; max-width: 600px; margin: 0 auto; padding: 20px; }
+            h2 { color: #4CAF50; text-align: center; letter-spacing: -1px; }
+            form { display: grid; grid-template-columns: 1fr 1fr; gap: 8px; margin-bottom: 15px; }
+            input, select, button { background: #1e1e1e; color: #e0e0e0; border: 1px solid #333; border-radius: 8px; padding: 10px; font-size: 0.9em; }
+            input[name=q], button { grid-column: span 2; }
+            button { background: #4CAF50; color: #fff; border: none; font-weight: 700; text-transform: uppercase; letter-spacing: 0.5px; }
+            .count { text-align: center; color: #888; font-size: 0.85em; margin-bottom: 15px; }
+            .row { padding: 10px 15px; background: rgba(30, 30, 30, 0.6); border-radius: 10px; margin-bottom: 6px; }
+            .head { display: flex; justify-content: space-between; font-size: 0.8em; color: #888; margin-bottom: 4px; }
+            .user { font-weight: 700; color: #ccc; }
+            .pager { display: flex; justify-content: space-between; margin-top: 15px; }
+            .pager a, .back { color: #666; text-decoration: none; text-transform: uppercase; font-size: 0.8em; }
+            .back { display: block; text-align: center; margin-top: 25px; }
+        </style>
+    </head>
+    <body>
+        <h2>Search</h2>
+        <form method="GET" action="/search">
+    )=====";
+    html += "<input name='q' placeholder='Gym, Weed, bailed...' value='" + html_escape(text ? text : "") + "'>";
+    html += "<select name='user'><option value=''>Everyone</option>";
+    for (auto const& [id, u] : users) {
+        html += "<option value='" + html_escape(u.name) + "'" + (q.user == u.name ? " selected" : "") + ">" + html_escape(u.name) + "</option>";
+    }
+    html += "</select>";
+    html += "<input type='month' name='month' value='" + html_escape(month ? month : "") + "'>";
+    html += "<button type='submit'>Search</button></form>";
+
+    size_t total = found["total"];
+    html += "<div class='count'>" + std::to_string(total) + (total == 1 ? " match" : " matches") + "</div>";
+    for (const auto& r : found["results"]) {
+        time_t ts = r["ts"].get<long long>();
+        time_t local = ts + me.zone->offset_at(ts);
+        char when[32];
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M", std::gmtime(&local));
+        html += "<div class='row' style='border-left: 2px solid " + r["col"].get<std::string>() + "'>";
+        html += "<div class='head'><span class='user'>" + html_escape(r["user"].get<std::string>()) + "</span><span>" + when + "</span></div>";
+        html += "<div>" + html_escape(r["msg"].get<std::string>()) + "</div></div>";
+    }
+
+    // Same query, another page
+    std::string base = "/search?";
+    for (const char* key : {"q", "user", "action", "month", "from", "to"}) {
+        if (const char* v = req.url_params.get(key)) base += std::string(key) + "=" + url_encode(v) + "&";
+    }
+    base += "offset=";
+    html += "<div class='pager'>";
+    html += q.offset > 0 ? "<a href='" + base + std::to_string(q.offset > q.limit ? q.offset - q.limit : 0) + "'>← Newer</a>" : "<span></span>";
+    html += q.offset + q.limit < total ? "<a href='" + base + std::to_string(q.offset + q.limit) + "'>Older →</a>" : "<span></span>";
+    html += "</div>";
+
+    html += "<a class='back' href='/'>Back</a></body></html>";
+    return html;
+}
+
 std::string render_login(std::string error = "") {
     std::string html = R"(
     <!DOCTYPE html>
@@ -890,30 +1804,31 @@ std::string render_login(std::string error = "") {
     return html;
 }
 
-std::string render_feed() {
-    std::string html = "<div class='feed-container'><h3>TRANSACTIONS</h3><div class='feed'>";
-    for (const auto& log : activity_feed) {
+void render_feed(pstring& html) {
+    html += "<div class='feed-container'><h3>TRANSACTIONS</h3><div class='feed'>";
+    for (const ActivityLog* log : activity_feed.snapshot()) {
         time_t now = std::time(nullptr);
-        int diff = (int)difftime(now, log.timestamp);
-        std::string time_str;
-        if (diff < 60) time_str = "Now";
-        else if (diff < 3600) time_str = std::to_string(diff/60) + "m";
-        else if (diff < 86400) time_str = std::to_string(diff/3600) + "h";
-        else time_str = std::to_string(diff/86400) + "d";
-
-        html += "<div class='log-item' style='border-left: 2px solid " + log.color + "'>";
-        html += "<div class='log-head'><span class='log-user'>" + log.user_name + "</span> <span class='log-time'>" + time_str + "</span></div>";
-        html += "<div class='log-msg'>" + log.message + "</div>";
+        int diff = (int)difftime(now, log->timestamp);
+
+        cat(html, "<div class='log-item' style='border-left: 2px solid ", log->color, "'>");
+        cat(html, "<div class='log-head'><span class='log-user'>", Html{log->user_name}, "</span> <span class='log-time'>");
+        if (diff < 60) html += "Now";
+        else if (diff < 3600) cat(html, diff/60, 'm');
+        else if (diff < 86400) cat(html, diff/3600, 'h');
+        else cat(html, diff/86400, 'd');
+        html += "</span></div>";
+        cat(html, "<div class='log-msg'>", Html{log->message}, "</div>");
         html += "</div>";
     }
     html += "</div></div>";
-    return html;
 }
 
 std::string render_dashboard(std::string current_user_id) {
-    for (auto& [key, user] : users) update_decay(user);
+    for (auto& [key, user] : users) engine.update_decay(user);
 
-    std::string html = R"(
+    pstring html(request_arena());
+    html.reserve(64 * 1024);
+    html += R"(
     <!DOCTYPE html>
     <html>
     <head>
@@ -1080,13 +1995,13 @@ std::string render_dashboard(std::string current_user_id) {
     if (users.count(current_user_id)) {
         User& u = users[current_user_id];
         
-        html += "<div class='hero-card " + std::string(u.locked?"locked":"") + "'>";
+        cat(html, "<div class='hero-card ", u.locked ? "locked" : "", "'>");
         
         html += "<div class='tag'>";
-        html += "<span>" + u.name + "</span>"; 
+        cat(html, "<span>", Html{u.name}, "</span>");
         
         html += "<div class='header-right'>";
-        html += "<span class='moderating-badge'>Moderating: " + u.vice + "</span>";
+        cat(html, "<span class='moderating-badge'>Moderating: ", Html{u.vice}, "</span>");
         html += "<a href='/edit' class='edit-btn'>⚙</a>";
         html += "</div></div>";
         
@@ -1094,50 +2009,44 @@ std::string render_dashboard(std::string current_user_id) {
             html += "<div class='timer' style='color:#ff5252'>BANKRUPT</div>";
             html += "<div style='color:#ff9898; text-align:center; font-size:0.9em;'>Account Frozen. Awaiting Bail Out.</div>";
         } else {
-            html += "<div class='timer' data-seconds='" + std::to_string(u.debt_seconds) + "'>...</div>";
+            cat(html, "<div class='timer' data-seconds='", u.debt_seconds, "'>...</div>");
             
             double pct = (double)u.debt_seconds / (double)u.max_threshold * 100.0;
             if (pct>100) pct=100;
-            std::string col = (u.debt_seconds > u.base_cost) ? "#ff9800" : "#4CAF50";
+            const char* col = (u.debt_seconds > u.base_cost) ? "#ff9800" : "#4CAF50";
             
-            html += "<div class='progress-bg'><div class='progress-fill' style='width:"+std::to_string(pct)+"%; background:"+col+"'></div></div>";
+            char pct_str[32];
+            std::snprintf(pct_str, sizeof(pct_str), "%f", pct);
+            cat(html, "<div class='progress-bg'><div class='progress-fill' style='width:", pct_str, "%; background:", col, "'></div></div>");
             
             if (pct > 50.0) {
                 double max_days = (double)u.max_threshold / (double)DAY_SEC;
-                std::stringstream ss_max;
-                ss_max << std::fixed << std::setprecision(1) << max_days;
-                html += "<div style='text-align:center; font-size:0.75em; color:#ff5252; margin-top:-12px; margin-bottom:15px; opacity:0.8; letter-spacing:0.5px;'>⚠ BANKRUPTCY LIMIT: " + ss_max.str() + " DAYS</div>";
+                cat(html, "<div style='text-align:center; font-size:0.75em; color:#ff5252; margin-top:-12px; margin-bottom:15px; opacity:0.8; letter-spacing:0.5px;'>⚠ BANKRUPTCY LIMIT: ", Fixed1{max_days}, " DAYS</div>");
             }
             
             html += "<div class='btn-grid'>";
-            html += "<a href='/virtue/1?name="+u.id+"'><button class='btn virtue1-btn'>" + u.virtue1_name + " (-1d)</button></a>";
-            html += "<a href='/virtue/2?name="+u.id+"'><button class='btn virtue2-btn'>" + u.virtue2_name + " (-1d)</button></a>";
+            cat(html, "<a href='/virtue/1?name=", Html{u.id}, "'><button class='btn virtue1-btn'>", Html{u.virtue1_name}, " (-1d)</button></a>");
+            cat(html, "<a href='/virtue/2?name=", Html{u.id}, "'><button class='btn virtue2-btn'>", Html{u.virtue2_name}, " (-1d)</button></a>");
             html += "</div>";
             
             double days_d = (double)u.base_cost / (double)DAY_SEC;
-            if (u.debt_seconds > 0) days_d = days_d * 1.5;
-            
-            std::stringstream ss;
-            ss << std::fixed << std::setprecision(1) << days_d;
+            if (u.debt_seconds > 0) days_d = days_d * engine.policy().relapse_multiplier;
             
-            html += "<a href='/vice?name="+u.id+"'><button class='btn smoke-btn'>Indulge (+" + ss.str() + "d)</button></a>";
+            cat(html, "<a href='/vice?name=", Html{u.id}, "'><button class='btn smoke-btn'>Indulge (+", Fixed1{days_d}, "d)</button></a>");
             
             html += "<details><summary>View Weekly Insights</summary>";
-            html += render_calendar(u.name); 
+            render_calendar(html, u); 
             html += "</details>";
         }
         html += "</div>";
     }
 
     // 2. TRANSACTIONS
-    html += render_feed();
+    render_feed(html);
     
     // Undo Link
-    if (!activity_feed.empty() && activity_feed.front().user_name == users[current_user_id].name) {
-        time_t now = std::time(nullptr);
-        if (std::difftime(now, activity_feed.front().timestamp) < 600) {
-            html += "<div style='text-align:center; margin-top:5px;'><a href='/undo' style='color:#666; font-size:0.8em; text-decoration:none;'>⎌ Undo Last Action</a></div>";
-        }
+    if (engine.can_undo(users[current_user_id], std::time(nullptr))) {
+        html += "<div style='text-align:center; margin-top:5px;'><a href='/undo' style='color:#666; font-size:0.8em; text-decoration:none;'>⎌ Undo Last Action</a></div>";
     }
 
     // 3. HOUSEHOLD
@@ -1145,32 +2054,359 @@ std::string render_dashboard(std::string current_user_id) {
     for (auto& [key, u] : users) {
         if (key == current_user_id) continue;
         
-        std::string accent = get_user_color(u.name);
-        
-        html += "<div class='mini-card " + std::string(u.locked?"locked":"") + "' style='--accent:" + accent + "'>";
-        html += "<div class='tag'><span>" + u.name + "</span> <span class='streak'>🔥 " + std::to_string(u.streak) + "</span></div>";
+        cat(html, "<div class='mini-card ", u.locked ? "locked" : "", "' style='--accent:hsl(", get_user_hue(u.name), ", 70%, 65%)'>");
+        cat(html, "<div class='tag'><span>", Html{u.name}, "</span> <span class='streak'>🔥 ", u.streak, "</span></div>");
         
         if (u.locked) {
             html += "<div class='mini-timer' style='color:#ff5252'>BANKRUPT</div>";
-            html += "<a href='/reset?name="+u.id+"'><button class='btn punishment-btn'>Bail Out</button></a>";
+            cat(html, "<a href='/reset?name=", Html{u.id}, "'><button class='btn punishment-btn'>Bail Out</button></a>");
         } else {
-            html += "<div class='mini-timer' data-seconds='" + std::to_string(u.debt_seconds) + "'>...</div>";
-            html += "<div style='font-size:0.7em; color:#666'>Target: " + u.virtue1_name + " & " + u.virtue2_name + "</div>";
+            cat(html, "<div class='mini-timer' data-seconds='", u.debt_seconds, "'>...</div>");
+            cat(html, "<div style='font-size:0.7em; color:#666'>Target: ", Html{u.virtue1_name}, " & ", Html{u.virtue2_name}, "</div>");
         }
         html += "</div>";
     }
     html += "</div>";
 
+    html += "<div style='text-align:center; margin-top:25px;'><a href='/leaderboard' style='color:#888; font-size:0.8em; text-decoration:none; text-transform:uppercase; letter-spacing:1px;'>🏆 Leaderboard</a>"
+            "<a href='/search' style='color:#888; font-size:0.8em; text-decoration:none; text-transform:uppercase; letter-spacing:1px; margin-left:20px;'>🔍 Search</a></div>";
     html += "<div class='logout'><a href='/logout'>Log Out</a></div>";
     html += "</body></html>";
-    return html;
+    return std::string(html);
+}
+
+// --- PROCESSES ---
+// PROCESSES=N uses N cores without making the engine any more concurrent.
+// The process started becomes the writer: it owns storage and listens only
+// on loopback, on WRITER_PORT for forwarded writes and on REPLICATION_PORT
+// for its readers. It starts N readers (this binary again, as replicas with
+// WRITER and REUSE_PORT set) that all listen on PORT with SO_REUSEPORT, so
+// the kernel spreads connections over them. Each serves reads from its own
+// copy of the state and forwards writes (see forward_to_writer()). A
+// reader that dies is started again.
+
+std::vector<pid_t> reader_pids;
+std::vector<std::string> reader_env; // Built before any fork: the child only execs
+
+int process_count() {
+    const char* env_p = std::getenv("PROCESSES");
+    return env_p ? std::max(0, std::atoi(env_p)) : 0;
+}
+
+pid_t spawn_reader() {
+    std::vector<char*> envp;
+    for (std::string& e : reader_env) envp.push_back(e.data());
+    envp.push_back(nullptr);
+    char arg0[] = "recurrency";
+    char* argv[] = {arg0, nullptr};
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        // Storage files, the replication listener, ...: none of them are the reader's
+        for (int fd = 3; fd < 1024; fd++) ::close(fd);
+        ::prctl(PR_SET_PDEATHSIG, SIGTERM); // Don't outlive a writer that was killed outright
+        ::execve("/proc/self/exe", argv, envp.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+void start_readers(int n, uint16_t port, const std::string& replication_port, const std::string& token, uint16_t writer) {
+    static const char* own[] = {"PROCESSES=", "REPLICA_OF=", "REPLICATION_PORT=", "REPLICATION_TOKEN=", "WRITER=",
+                                "REUSE_PORT=", "PORT=",
+                                "CAPTURE_PATH="};
+    for (char** e = environ; *e; e++) {
+        bool skip = false;
+        for (const char* name : own) skip |= std::strncmp(*e, name, std::strlen(name)) == 0;
+        if (!skip) reader_env.push_back(*e);
+    }
+    reader_env.push_back("REPLICA_OF=127.0.0.1:" + replication_port);
+    reader_env.push_back("REPLICATION_TOKEN=" + token);
+    reader_env.push_back("WRITER=127.0.0.1:" + std::to_string(writer));
+    reader_env.push_back("REUSE_PORT=1");
+    reader_env.push_back("PORT=" + std::to_string(port));
+    for (int i = 0; i < n; i++) reader_pids.push_back(spawn_reader());
+    std::cerr << "(server) writer on 127.0.0.1:" << writer << ", " << n << " reader(s) on port " << port << std::endl;
+}
+
+void respawn_readers() {
+    for (pid_t& pid : reader_pids) {
+        int status = 0;
+        if (pid > 0 && ::waitpid(pid, &status, WNOHANG) != pid) continue;
+        CROW_LOG_WARNING << "reader " << pid << " exited (status " << status << "), starting another";
+        pid = spawn_reader();
+    }
+}
+
+void stop_readers() {
+    for (pid_t pid : reader_pids) {
+        if (pid > 0) ::kill(pid, SIGTERM);
+    }
+    for (pid_t pid : reader_pids) {
+        if (pid > 0) ::waitpid(pid, nullptr, 0);
+    }
+}
+
+// --- MAINTENANCE ---
+// Background jobs (see scheduler.h). They run on a Crow worker between
+// requests, under the state lock when there is one.
+
+Scheduler maintenance;
+const int64_t SESSION_IDLE_SEC = 30 * 60;
+
+long long history_days() {
+    const char* env_p = std::getenv("HISTORY_DAYS");
+    return env_p ? std::max(1LL, std::atoll(env_p)) : 365;
+}
+
+bool run_on_engine(std::function<void()> job) {
+    asio::io_context* ctx = engine_context.load();
+    // Reactor mode has nowhere safe to run until its worker has shown itself
+    if (!ctx && !lock_state) return false;
+    auto run = [job = std::move(job)] {
+        std::unique_lock<std::mutex> lock(state_mutex, std::defer_lock);
+        if (lock_state) lock.lock();
+        job();
+    };
+    if (ctx) asio::post(*ctx, std::move(run));
+    else run();
+    return true;
+}
+
+// Decays everyone and fires clean-streak milestones without waiting for a page view
+void decay_all() {
+    for (auto& [key, user] : users) engine.update_decay(user);
+}
+
+// A login is followed by the dashboard and usually an action on it: the
+// user's own history, or bailing out a household member. Page those in
+// once the redirect is on its way, not while the next request waits.
+const size_t LOGIN_PREFETCH = 8;
+
+void prefetch_on_login(const std::string& id) {
+    if (!event_store.paged()) return;
+    run_on_engine([id] {
+        size_t budget = std::min(LOGIN_PREFETCH, event_store.capacity);
+        std::vector<std::string> ids = {id};
+        for (auto const& [key, u] : users) {
+            if (ids.size() >= budget) break;
+            if (u.locked && key != id) ids.push_back(key);
+        }
+        // The user's own goes in last, as the most recently used
+        for (auto it = ids.rbegin(); it != ids.rend(); ++it) event_store.prefetch(*it);
+    });
+}
+
+long long memory_warn_bytes() {
+    const char* env_p = std::getenv("MEMORY_WARN_MB");
+    return (env_p ? std::max(1LL, std::atoll(env_p)) : 768) * 1024 * 1024;
+}
+
+json counters_json(const MemCounters& c) {
+    return {{"live_bytes", c.live_bytes}, {"peak_bytes", c.peak_bytes}, {"allocations", c.allocations}, {"frees", c.frees}};
+}
+
+json memory_json() {
+    json tags = json::object();
+    for (int t = 0; t < MEM_TAG_COUNT; t++) tags[mem_tag_name((MemTag)t)] = counters_json(mem_counters((MemTag)t));
+    MemCounters total = mem_total();
+    return {
+        {"total", counters_json(total)},
+        {"subsystems", tags},
+        {"rss_bytes", resident_bytes()},
+        {"warn_bytes", memory_warn_bytes()},
+        {"over_warn", total.live_bytes >= memory_warn_bytes()}
+    };
+}
+
+// Warns once per excursion past MEMORY_WARN_MB, and again only after live
+// bytes have dropped back below 90% of it
+void watch_memory() {
+    static bool warned = false;
+    long long limit = memory_warn_bytes();
+    MemCounters total = mem_total();
+    if (!warned && total.live_bytes >= limit) {
+        warned = true;
+        json by_tag = json::object();
+        for (int t = 0; t < MEM_TAG_COUNT; t++) by_tag[mem_tag_name((MemTag)t)] = mem_counters((MemTag)t).live_bytes;
+        CROW_LOG_WARNING << "memory high-water mark: " << total.live_bytes / (1024 * 1024) << " MB live (peak "
+                         << total.peak_bytes / (1024 * 1024) << " MB, warn at " << limit / (1024 * 1024) << " MB) "
+                         << by_tag.dump();
+    } else if (warned && total.live_bytes < limit / 10 * 9) {
+        warned = false;
+    }
+}
+
+// /api/maintenance and /api/memory take X-Admin-Token = ADMIN_TOKEN; unset, nobody gets them
+bool admin_request(const crow::request& req) {
+    const char* token = std::getenv("ADMIN_TOKEN");
+    return token && *token && req.get_header_value("X-Admin-Token") == token;
+}
+
+json history_cache_json() {
+    PagingStats st = event_store.paging_stats();
+    uint64_t lookups = st.hits + st.misses;
+    return {
+        {"paged", event_store.paged()},
+        {"capacity", event_store.capacity},
+        {"resident", st.resident},
+        {"hits", st.hits},
+        {"misses", st.misses},
+        {"hit_rate", lookups ? (double)st.hits / lookups : 1.0},
+        {"evictions", st.evictions},
+        {"write_backs", st.write_backs}
+    };
+}
+
+json metrics_json() {
+    json jobs = json::object();
+    for (auto const& [name, st] : maintenance.stats()) {
+        jobs[name] = {
+            {"runs", st.runs},
+            {"skipped", st.skipped},
+            {"avg_us", st.runs ? st.total_us / st.runs : 0},
+            {"max_us", st.max_us},
+            {"last_us", st.last_us},
+            {"last_run", st.last_run}
+        };
+    }
+    return {
+        {"jobs", jobs},
+        {"admitted", admission.admitted.load()},
+        {"shed_rate", admission.shed_rate.load()},
+        {"shed_overload", admission.shed_overload.load()},
+        {"persist_pending", persist_queue.pending()},
+        {"storage", storage ? json{{"engine", storage->name()}, {"stats", storage->stats()}} : json()},
+        {"memory", memory_json()},
+        {"history_cache", history_cache_json()},
+        {"backup", backup_json()},
+        {"capture", capture_json()}
+    };
+}
+
+void schedule_maintenance() {
+    using namespace std::chrono;
+    maintenance.once("catch_up", seconds(2), decay_all);
+    maintenance.every("decay", minutes(1), 0.1, decay_all);
+    if (!replica_mode) {
+        // History older than HISTORY_DAYS collapses into each stream's
+        // genesis: here for resident streams, as they page in for the rest
+        event_store.compact_before = std::time(nullptr) - history_days() * DAY_SEC;
+        maintenance.every("compact_events", hours(6), 0.2, [] {
+            event_store.compact_before = std::time(nullptr) - history_days() * DAY_SEC;
+            bool changed = false;
+            for (auto& [key, user] : users) changed |= event_store.compact(user, event_store.compact_before);
+            if (changed) save_db();
+        });
+        // SIGUSR2 only raises the flag; the fork happens here, under the state lock
+        maintenance.every("backup_signal", seconds(1), 0.0, [] {
+            if (!backup_signalled.exchange(false)) return;
+            std::string error = start_backup(get_backup_path());
+            if (!error.empty()) CROW_LOG_ERROR << "backup: " << error;
+        });
+    }
+    if (!reader_pids.empty()) maintenance.every("readers", seconds(1), 0.0, respawn_readers);
+    if (capture.is_open()) maintenance.every("flush_capture", seconds(1), 0.0, flush_capture);
+    maintenance.every("memory_watch", seconds(10), 0.1, watch_memory);
+    maintenance.every("expire_sessions", minutes(5), 0.1, [] { admission.expire_idle(SESSION_IDLE_SEC); });
+    maintenance.every("flush_metrics", minutes(5), 0.0, [] {
+        std::cerr << "(metrics) " << metrics_json().dump() << std::endl;
+    });
 }
 
 // --- ROUTES ---
 
 int main() {
-    load_db();
-    crow::SimpleApp app;
+    const char* port_env = std::getenv("PORT");
+    const char* replica_of = std::getenv("REPLICA_OF");           // host:port of a primary
+    const char* replication_port = std::getenv("REPLICATION_PORT"); // Serve replicas on this port
+    uint16_t port = port_env ? (uint16_t)std::stoi(port_env) : 18080;
+    int processes = replica_of ? 0 : process_count();
+    trust_fly_client_ip = std::getenv("TRUST_FLY_CLIENT_IP") != nullptr;
+    trust_loopback_client_ip = processes > 0;
+    std::string own_replication_port;
+    std::string token = replication_token();
+    uint16_t listen_port = port;
+    if (processes > 0) {
+        // The writer: readers get the public port, it keeps loopback ones
+        const char* w = std::getenv("WRITER_PORT");
+        listen_port = w ? (uint16_t)std::stoi(w) : port + 1;
+        own_replication_port = replication_port ? replication_port : std::to_string(port + 2);
+        replication_port = own_replication_port.c_str();
+        if (token.empty()) token = random_token();
+    }
+    if ((replica_of || replication_port) && token.empty()) {
+        std::cerr << "(server) replication needs REPLICATION_TOKEN on the primary and its replicas" << std::endl;
+        return 1;
+    }
+
+    // Before any thread starts, so they all inherit the mask
+    restrict_to_cpus(execution.cpus);
+    engine.on_change = save_db;
+    // Likewise before any thread reads it (run_on_engine() does). The
+    // replica applier is a second writer even with a single worker.
+    lock_state = replica_of || execution.shared_state();
+
+    if (replica_of) {
+        // Replica: state arrives from the primary, nothing touches the disk
+        std::string target = replica_of;
+        size_t colon = target.rfind(':');
+        replica_mode = true;
+        engine.announce_milestones = false; // The primary fires these
+        const char* url = std::getenv("PRIMARY_URL");
+        primary_url = url ? url : "";
+        if (const char* w = std::getenv("WRITER")) {
+            std::string writer = w;
+            size_t wc = writer.rfind(':');
+            writer_host = writer.substr(0, wc);
+            writer_port = (unsigned short)std::stoi(writer.substr(wc + 1));
+        }
+        crow::reuse_port() = std::getenv("REUSE_PORT") != nullptr;
+        replica_client.start(target.substr(0, colon), (unsigned short)std::stoi(target.substr(colon + 1)), token,
+                             apply_replica_snapshot, apply_replica_record);
+    } else {
+        try {
+            std::optional<Encoding> format = encoding_from_name(get_persist_format());
+            if (!format) throw std::runtime_error("unknown PERSIST_FORMAT '" + get_persist_format() + "' (json, cbor or msgpack)");
+            persist_format = *format;
+            MemScope mem(MemTag::Persistence); // Engines may keep the whole database resident
+            storage = open_storage(get_storage_kind(), DB_FILE, persist_queue, persist_format);
+            if (const char* from = std::getenv("RESTORE_FROM")) restore_backup(from);
+            if (history_cache_size() > 0) {
+                event_store.capacity = history_cache_size();
+                event_store.page_in = page_in_stream;
+                event_store.write_back = write_back_stream;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "(server) storage: " << e.what() << std::endl;
+            return 1;
+        }
+        load_db();
+        for (auto& [key, user] : users) engine.refresh_rankings(user);
+        if (replication_port) {
+            replication_primary.provide_image(replica_image().dump());
+            // The writer keeps both of its ports on loopback, whatever REPLICATION_BIND says
+            std::string bind = processes > 0 ? "127.0.0.1" : replication_bind();
+            replication_primary.start(bind, (unsigned short)std::stoi(replication_port), token, [] {
+                return run_on_engine([] { replication_primary.provide_image(replica_image().dump()); });
+            });
+        }
+        if (processes > 0) start_readers(processes, port, replication_port, token, listen_port);
+    }
+    if (!replica_mode) std::signal(SIGUSR2, [](int) { backup_signalled = true; });
+    persist_queue.start();
+    if (const char* path = std::getenv("CAPTURE_PATH")) {
+        try {
+            start_capture(path);
+        } catch (const std::exception& e) {
+            std::cerr << "(server) capture: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    schedule_maintenance();
+    maintenance.start(run_on_engine);
+    std::cerr << "(server) " << execution.mode_name() << " mode, " << execution.worker_count() << " worker(s)"
+              << (lock_state ? ", state locked" : "") << std::endl;
+    crow::App<TrafficCapture, AdmissionControl, StateGuard, RequestIoContext, RequestScratch> app;
 
     CROW_ROUTE(app, "/")([](const crow::request& req){
         std::string user_id = get_logged_in_user(req);
@@ -1190,7 +2426,9 @@ int main() {
 
     CROW_ROUTE(app, "/signup")([](const crow::request& req){
         std::string err = req.url_params.get("error") ? req.url_params.get("error") : "";
-        std::string msg = (err == "exists") ? "Name taken" : "";
+        std::string msg = (err == "exists") ? "Name taken"
+                        : (err == "name") ? "Names use letters, digits, spaces and - _ ."
+                        : (err == "invalid") ? "Check your numbers" : "";
         return render_signup_wizard(msg);
     });
 
@@ -1212,51 +2450,200 @@ int main() {
              return res;
         }
         
-        std::string vice = get_form_value(req.body, "vice");
-        std::string new_pass = get_form_value(req.body, "new_password");
-        
-        double vice_freq = std::stod(get_form_value(req.body, "vice_freq"));
-        double vice_per = std::stod(get_form_value(req.body, "vice_per"));
-        double days_interval = vice_per / vice_freq;
-
-        std::string v1n = get_form_value(req.body, "v1name");
-        double v1_freq = std::stod(get_form_value(req.body, "v1_freq"));
-        double v1_per = std::stod(get_form_value(req.body, "v1_per"));
-        double v1_weekly = (v1_freq / v1_per) * 7.0;
+        FormFields form = form_fields(req);
+        std::optional<User> terms = contract_from_form(form);
+        crow::response res(302);
+        if (!terms || form.rejected()) {
+            res.add_header("Location", "/edit");
+            return res;
+        }
 
-        std::string v2n = get_form_value(req.body, "v2name");
-        double v2_freq = std::stod(get_form_value(req.body, "v2_freq"));
-        double v2_per = std::stod(get_form_value(req.body, "v2_per"));
-        double v2_weekly = (v2_freq / v2_per) * 7.0;
+        User& u = users[name];
+        
+        // NEW: Update Password if provided
+        std::string_view new_pass = form.get("new_password");
+        if (!new_pass.empty()) {
+            u.password = new_pass;
+        }
 
-        try {
-            User& u = users[name];
-            
-            // NEW: Update Password if provided
-            if (!new_pass.empty()) {
-                u.password = new_pass;
-            }
+        u.set_time_zone(std::string(form.get("tz")));
+        engine.change_contract(u, *terms);
 
-            u.vice = vice;
-            u.target_interval_days = days_interval;
-            u.virtue1_name = v1n;
-            u.promised_v1_weekly = v1_weekly;
-            u.virtue2_name = v2n;
-            u.promised_v2_weekly = v2_weekly;
-            
-            u.calculate_math();
-            save_db();
-        } catch (...) {}
-        
-        crow::response res(302);
         res.add_header("Location", "/");
         return res;
     });
 
+    CROW_ROUTE(app, "/insights")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") {
+            crow::response res(302);
+            res.add_header("Location", "/login");
+            return res;
+        }
+        return crow::response(render_insights(users[user_id]));
+    });
+
+    CROW_ROUTE(app, "/api/insights")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        return api_response(req, build_insights(users[user_id]));
+    });
+
+    CROW_ROUTE(app, "/api/chart")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        std::shared_ptr<const std::string> payload = chart_series_payload(users[user_id].name);
+        // Cached as JSON text; only binary clients pay for a re-encode
+        if (negotiate(req.get_header_value("Accept")) == Encoding::Json) {
+            crow::response res(*payload);
+            res.set_header("Content-Type", "application/json");
+            res.set_header("Vary", "Accept");
+            return res;
+        }
+        return api_response(req, json::parse(*payload));
+    });
+
+    // Debt as it stood at ?t=<unix seconds> (default now)
+    CROW_ROUTE(app, "/api/debt_at")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        const char* t = req.url_params.get("t");
+        Field<long long> at_param = parse_number<long long>(t ? t : "");
+        if (t && !at_param.ok()) return crow::response(400, field_error_name(at_param.error));
+        time_t at = t ? (time_t)at_param.value : std::time(nullptr);
+        std::optional<User> past = event_store.state_at(users[user_id], at);
+        if (!past) return crow::response(404);
+        json out = {
+            {"t", (long long)at},
+            {"debt_seconds", past->debt_seconds},
+            {"locked", past->locked},
+            {"streak", past->streak},
+            {"last_vice", (long long)past->last_vice}
+        };
+        return api_response(req, out);
+    });
+
+    // Chart points with ?from= <= ts < ?to= (unix seconds, default everything), oldest first
+    CROW_ROUTE(app, "/api/debt_history")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        time_t range[2] = {std::numeric_limits<time_t>::min(), std::numeric_limits<time_t>::max()};
+        const char* names[2] = {"from", "to"};
+        for (int i = 0; i < 2; i++) {
+            const char* v = req.url_params.get(names[i]);
+            if (!v) continue;
+            Field<long long> n = parse_number<long long>(v);
+            if (!n.ok()) return crow::response(400, field_error_name(n.error));
+            range[i] = (time_t)n.value;
+        }
+        json pts = json::array();
+        auto it = engine.debt_history.find(users[user_id].name);
+        if (it != engine.debt_history.end()) {
+            for (const DebtPoint& p : it->second.points(range[0], range[1])) pts.push_back({(long long)p.ts, p.delta, p.snapshot});
+        }
+        return api_response(req, json{{"points", pts}});
+    });
+
+    CROW_ROUTE(app, "/leaderboard")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") {
+            crow::response res(302);
+            res.add_header("Location", "/login");
+            return res;
+        }
+        const char* page = req.url_params.get("page");
+        Field<size_t> page_num = parse_number<size_t>(page ? page : "");
+        return crow::response(render_leaderboard(parse_board(req.url_params.get("board")), page_num.ok() ? page_num.value : 0, user_id));
+    });
+
+    CROW_ROUTE(app, "/api/leaderboard")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        const char* offset = req.url_params.get("offset");
+        const char* limit = req.url_params.get("limit");
+        Field<size_t> off = parse_number<size_t>(offset ? offset : "");
+        Field<size_t> lim = parse_number<size_t>(limit ? limit : "");
+        if ((offset && !off.ok()) || (limit && !lim.ok())) return crow::response(400);
+        size_t page_size = limit ? std::min<size_t>(lim.value, 100) : LEADERBOARD_PAGE;
+        return api_response(req, build_leaderboard(parse_board(req.url_params.get("board")), off.value, page_size, user_id));
+    });
+
+    CROW_ROUTE(app, "/search")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") {
+            crow::response res(302);
+            res.add_header("Location", "/login");
+            return res;
+        }
+        std::optional<SearchQuery> q = search_query(req, users[user_id]);
+        if (!q) return crow::response(400);
+        return crow::response(render_search(req, *q, users[user_id]));
+    });
+
+    CROW_ROUTE(app, "/api/search")([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        std::optional<SearchQuery> q = search_query(req, users[user_id]);
+        if (!q) return crow::response(400);
+        return api_response(req, build_search(*q));
+    });
+
+    CROW_ROUTE(app, "/api/feed")([](const crow::request& req){
+        {
+            std::unique_lock<std::mutex> lock(state_mutex, std::defer_lock);
+            if (lock_state) lock.lock();
+            if (get_logged_in_user(req).empty()) return crow::response(401);
+        }
+        json entries = json::array();
+        for (const ActivityLog* log : activity_feed.snapshot()) entries.push_back(log_to_json(*log));
+        return api_response(req, {{"entries", entries}});
+    });
+
+    CROW_ROUTE(app, "/api/maintenance")([](const crow::request& req){
+        if (!admin_request(req)) return crow::response(403);
+        return api_response(req, metrics_json());
+    });
+
+    // Status for anyone; starting one takes X-Backup-Token = BACKUP_TOKEN
+    CROW_ROUTE(app, "/api/backup").methods(crow::HTTPMethod::GET, crow::HTTPMethod::POST)([](const crow::request& req){
+        if (req.method == crow::HTTPMethod::Post) {
+            const char* token = std::getenv("BACKUP_TOKEN");
+            if (!token || !*token || req.get_header_value("X-Backup-Token") != token) return crow::response(403);
+            std::string error = start_backup(get_backup_path());
+            crow::response res = api_response(req, error.empty() ? backup_json() : json{{"error", error}});
+            if (res.code == 200) res.code = error.empty() ? 202 : 409;
+            return res;
+        }
+        return api_response(req, backup_json());
+    });
+
+    CROW_ROUTE(app, "/api/memory")([](const crow::request& req){
+        if (!admin_request(req)) return crow::response(403);
+        return api_response(req, memory_json());
+    });
+
+    CROW_ROUTE(app, "/replication")([](const crow::request& req){
+        json status;
+        if (replica_mode) {
+            status = {
+                {"role", "replica"},
+                {"connected", replica_client.connected()},
+                {"applied_lsn", replica_client.applied_lsn()},
+                {"primary_lsn", replica_client.primary_lsn()},
+                {"lag_seconds", replica_client.lag_seconds()}
+            };
+        } else if (replication_primary.running()) {
+            status = {{"role", "primary"}, {"lsn", replication_primary.lsn()}, {"replicas", replication_primary.replica_count()}};
+        } else {
+            status = {{"role", "standalone"}};
+        }
+        return api_response(req, status);
+    });
+
     CROW_ROUTE(app, "/undo")([](const crow::request& req){
         std::string cur_id = get_logged_in_user(req);
         if (!cur_id.empty() && users.count(cur_id)) {
-            if (perform_undo(users[cur_id])) {
+            if (engine.perform_undo(users[cur_id])) {
                 // Success
             }
         }
@@ -1266,16 +2653,18 @@ int main() {
     });
 
     CROW_ROUTE(app, "/login").methods(crow::HTTPMethod::POST)([](const crow::request& req){
-        std::string name = get_form_value(req.body, "name");
-        std::string pass = get_form_value(req.body, "password");
+        FormFields form = form_fields(req);
+        std::string name(form.get("name"));
+        std::string_view pass = form.get("password");
         
         std::string id = name;
         std::transform(id.begin(), id.end(), id.begin(), ::tolower);
 
         crow::response res(302);
-        if (users.count(id) && users[id].password == pass) {
-            res.add_header("Set-Cookie", "user=" + id + "; Path=/; HttpOnly; Max-Age=31536000");
+        if (!form.rejected() && valid_user_id(id) && users.count(id) && users[id].password == pass) {
+            res.add_header("Set-Cookie", user_cookie(id));
             res.add_header("Location", "/");
+            prefetch_on_login(id);
         } else {
             res.add_header("Location", "/login?error=invalid");
         }
@@ -1283,36 +2672,32 @@ int main() {
     });
 
     CROW_ROUTE(app, "/signup").methods(crow::HTTPMethod::POST)([](const crow::request& req){
-        std::string name = get_form_value(req.body, "name");
-        std::string pass = get_form_value(req.body, "password");
-        std::string vice = get_form_value(req.body, "vice");
-        
-        double vice_freq = std::stod(get_form_value(req.body, "vice_freq"));
-        double vice_per = std::stod(get_form_value(req.body, "vice_per"));
-        double days_interval = vice_per / vice_freq;
-
-        std::string v1n = get_form_value(req.body, "v1name");
-        double v1_freq = std::stod(get_form_value(req.body, "v1_freq"));
-        double v1_per = std::stod(get_form_value(req.body, "v1_per"));
-        double v1_weekly = (v1_freq / v1_per) * 7.0;
-
-        std::string v2n = get_form_value(req.body, "v2name");
-        double v2_freq = std::stod(get_form_value(req.body, "v2_freq"));
-        double v2_per = std::stod(get_form_value(req.body, "v2_per"));
-        double v2_weekly = (v2_freq / v2_per) * 7.0;
+        FormFields form = form_fields(req);
+        std::string name(form.get("name"));
+        std::optional<User> terms = contract_from_form(form);
 
         std::string id = name;
         std::transform(id.begin(), id.end(), id.begin(), ::tolower);
 
         crow::response res(302);
+        if (!valid_user_id(id)) {
+            res.add_header("Location", "/signup?error=name");
+            return res;
+        }
+        if (!terms || form.rejected()) {
+            res.add_header("Location", "/signup?error=invalid");
+            return res;
+        }
         if (users.count(id)) {
             res.add_header("Location", "/signup?error=exists");
             return res;
         }
 
-        users[id] = User(name, pass, vice, days_interval, v1n, v1_weekly, v2n, v2_weekly);
-        save_db();
-        res.add_header("Set-Cookie", "user=" + id + "; Path=/; HttpOnly; Max-Age=31536000");
+        User u(name, std::string(form.get("password")), terms->vice, terms->target_interval_days,
+               terms->virtue1_name, terms->promised_v1_weekly, terms->virtue2_name, terms->promised_v2_weekly);
+        u.set_time_zone(std::string(form.get("tz")));
+        engine.add_user(std::move(u));
+        res.add_header("Set-Cookie", user_cookie(id));
         res.add_header("Location", "/");
         return res;
     });
@@ -1324,10 +2709,43 @@ int main() {
         return res;
     });
 
+    // Offline actions in one go; the body may be JSON, CBOR or MessagePack
+    CROW_ROUTE(app, "/api/actions").methods(crow::HTTPMethod::POST)([](const crow::request& req){
+        std::string user_id = get_logged_in_user(req);
+        if (user_id == "") return crow::response(401);
+        std::optional<std::vector<OfflineAction>> actions;
+        try {
+            actions = actions_from_body(decode_object(req.body));
+        } catch (const json::exception&) {}
+        if (!actions) return crow::response(400);
+
+        User& u = users[user_id];
+        BatchResult r = engine.apply_batch(u, *actions);
+        json out = {
+            {"applied", r.applied},
+            {"duplicates", r.duplicates},
+            {"t", (long long)u.last_update},
+            {"debt_seconds", u.debt_seconds},
+            {"locked", u.locked},
+            {"streak", u.streak},
+            {"virtue_streak_days", u.virtue_streak_days},
+            {"last_vice", (long long)u.last_vice},
+            {"last_v1", (long long)u.last_v1},
+            {"last_v2", (long long)u.last_v2}
+        };
+        if (!r.error.empty()) {
+            out["error"] = r.error;
+            out["index"] = r.failed_at;
+        }
+        crow::response res = api_response(req, out);
+        if (!r.error.empty() && res.code == 200) res.code = 409; // Nothing was applied
+        return res;
+    });
+
     CROW_ROUTE(app, "/vice")([](const crow::request& req){
         auto name = req.url_params.get("name");
         std::string cur_id = get_logged_in_user(req);
-        if (name && cur_id == name) add_vice(users[name]);
+        if (name && cur_id == name) engine.add_vice(users[name]);
         crow::response res(302);
         res.add_header("Location", "/");
         return res;
@@ -1336,7 +2754,7 @@ int main() {
     CROW_ROUTE(app, "/virtue/1")([](const crow::request& req){
         auto name = req.url_params.get("name");
         std::string cur_id = get_logged_in_user(req);
-        if (name && cur_id == name) perform_virtue(users[name], 1);
+        if (name && cur_id == name) engine.perform_virtue(users[name], 1);
         crow::response res(302);
         res.add_header("Location", "/");
         return res;
@@ -1345,7 +2763,7 @@ int main() {
     CROW_ROUTE(app, "/virtue/2")([](const crow::request& req){
         auto name = req.url_params.get("name");
         std::string cur_id = get_logged_in_user(req);
-        if (name && cur_id == name) perform_virtue(users[name], 2);
+        if (name && cur_id == name) engine.perform_virtue(users[name], 2);
         crow::response res(302);
         res.add_header("Location", "/");
         return res;
@@ -1355,7 +2773,7 @@ int main() {
         auto target_id = req.url_params.get("name");
         std::string cur_id = get_logged_in_user(req);
         if (target_id && !cur_id.empty() && users.count(target_id) && cur_id != std::string(target_id)) {
-            reset_user(users[target_id], users[cur_id].name);
+            engine.reset_user(users[target_id], users[cur_id].name);
         }
         crow::response res(302);
         res.add_header("Location", "/");
@@ -1364,32 +2782,24 @@ int main() {
 
     CROW_ROUTE(app, "/delete_account").methods(crow::HTTPMethod::POST)([](const crow::request& req){
         std::string name = get_logged_in_user(req);
-        if (name != "" && users.count(name)) {
-            // 1. Remove User
-            users.erase(name);
-            
-            // 2. Cleanup Logs (Optional: Remove logs belonging to this user)
-            // We use a new deque to filter out the deleted user's logs
-            std::deque<ActivityLog> new_feed;
-            for (const auto& log : activity_feed) {
-                if (log.user_name != name) { // Note: log.user_name stores the Display Name, 'name' here is ID
-                    // This creates a slight mismatch issue if Display Name != ID.
-                    // To be safe, we just keep the logs for history, or strictly check IDs if stored.
-                    // For this MVP, let's just keep the logs or simple filter:
-                    new_feed.push_back(log); 
-                }
-            }
-            // If you want to wipe their history, uncomment:
-            // activity_feed = new_feed; 
-            
-            save_db();
-        }
-        
+        if (name != "" && users.count(name)) engine.remove_user(name);
+
         crow::response res(302);
         res.add_header("Set-Cookie", "user=; Path=/; Max-Age=0"); // Clear Cookie
         res.add_header("Location", "/login");
         return res;
     });
     
-    app.port(18080).multithreaded().run();
+    if (processes > 0) app.bindaddr("127.0.0.1");
+    // A reader serving before its first image would show everyone logged out
+    for (int i = 0; writer_port && !replica_loaded && i < 300; i++) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto server = app.port(listen_port).concurrency(execution.crow_concurrency()).run_async();
+    if (app.wait_for_server_start() == std::cv_status::no_timeout && !disable_nagle_on_listener(listen_port)) {
+        std::cout << "(server) couldn't set TCP_NODELAY; small responses may stall on delayed ACKs" << std::endl;
+    }
+    server.get();
+    stop_readers();
+    maintenance.stop();
+    if (capture.is_open()) flush_capture();
+    persist_queue.stop();
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "memory.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+namespace {
+
+// Keeps the block that follows it 16-byte aligned, like malloc's own
+struct alignas(16) Header {
+    uint64_t size;
+    uint32_t tag;
+};
+static_assert(sizeof(Header) == 16, "header must preserve malloc alignment");
+
+struct alignas(64) Counters {
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frees{0};
+};
+
+// Constant-initialized, so usable by allocations made before main()
+Counters tags[MEM_TAG_COUNT];
+Counters total;
+thread_local MemTag current_tag = MemTag::Other;
+thread_local size_t thread_allocs = 0;
+
+void raise_peak(std::atomic<int64_t>& peak, int64_t now) {
+    int64_t seen = peak.load(std::memory_order_relaxed);
+    while (now > seen && !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {}
+}
+
+void* allocate(std::size_t n) {
+    Header* h = (Header*)std::malloc(sizeof(Header) + n);
+    if (!h) throw std::bad_alloc();
+    h->size = n;
+    h->tag = (uint32_t)current_tag;
+    thread_allocs++;
+    Counters& c = tags[h->tag];
+    raise_peak(c.peak, c.live.fetch_add((int64_t)n, std::memory_order_relaxed) + (int64_t)n);
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    raise_peak(total.peak, total.live.fetch_add((int64_t)n, std::memory_order_relaxed) + (int64_t)n);
+    return h + 1;
+}
+
+void release(void* p) {
+    if (!p) return;
+    Header* h = (Header*)p - 1;
+    Counters& c = tags[h->tag];
+    c.live.fetch_sub((int64_t)h->size, std::memory_order_relaxed);
+    c.frees.fetch_add(1, std::memory_order_relaxed);
+    total.live.fetch_sub((int64_t)h->size, std::memory_order_relaxed);
+    std::free(h);
+}
+
+MemCounters snapshot(const Counters& c) {
+    MemCounters out;
+    out.live_bytes = c.live.load(std::memory_order_relaxed);
+    out.peak_bytes = c.peak.load(std::memory_order_relaxed);
+    out.allocations = c.allocations.load(std::memory_order_relaxed);
+    out.frees = c.frees.load(std::memory_order_relaxed);
+    return out;
+}
+
+} // namespace
+
+const char* mem_tag_name(MemTag tag) {
+    static const char* names[] = {"other", "users", "feed", "history", "persistence", "rendering", "search"};
+    return names[(int)tag];
+}
+
+MemCounters mem_counters(MemTag tag) {
+    return snapshot(tags[(int)tag]);
+}
+
+MemCounters mem_total() {
+    MemCounters out = snapshot(total);
+    for (const Counters& c : tags) {
+        out.allocations += c.allocations.load(std::memory_order_relaxed);
+        out.frees += c.frees.load(std::memory_order_relaxed);
+    }
+    return out;
+}
+
+MemTag mem_swap_tag(MemTag tag) {
+    MemTag prev = current_tag;
+    current_tag = tag;
+    return prev;
+}
+
+size_t thread_allocations() {
+    return thread_allocs;
+}
+
+int64_t resident_bytes() {
+    FILE* f = std::fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    long long pages = 0, resident = 0;
+    bool ok = std::fscanf(f, "%lld %lld", &pages, &resident) == 2;
+    std::fclose(f);
+    return ok ? resident * sysconf(_SC_PAGESIZE) : -1;
+}
+
+int64_t private_dirty_bytes() {
+    FILE* f = std::fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    char line[256];
+    long long kb = -1;
+    while (std::fgets(line, sizeof(line), f)) {
+        if (std::sscanf(line, "Private_Dirty: %lld kB", &kb) == 1) break;
+    }
+    std::fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+}
+
+// The nothrow and array forms in libstdc++ forward to these. Aligned new
+// is left alone: it has its own delete, so the two never see each other's
+// blocks.
+void* operator new(std::size_t n) {
+    return allocate(n);
+}
+
+void* operator new[](std::size_t n) {
+    return allocate(n);
+}
+
+void operator delete(void* p) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p) noexcept {
+    release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    release(p);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// --- MEMORY ACCOUNTING ---
+// Global operator new/delete are replaced so that every heap block carries
+// a small header with its size and the subsystem that allocated it. The
+// subsystem is whatever tag the allocating thread has open (MemScope), so a
+// block freed somewhere else is still credited back to its owner. That
+// costs 16 bytes per block and a few relaxed atomics per call.
+
+enum class MemTag {
+    Other,       // Nothing more specific open: Crow, asio, startup
+    Users,       // The users map and leaderboards
+    Feed,        // Activity feed, analytics aggregates and debt history
+    History,     // Event streams and their checkpoints
+    Persistence, // Documents and batches being saved or loaded, storage engines, the I/O thread
+    Rendering,   // Request handling: pages, API bodies, chart payloads
+    Search,      // The activity index
+};
+const int MEM_TAG_COUNT = 7;
+
+const char* mem_tag_name(MemTag tag);
+
+struct MemCounters {
+    int64_t live_bytes = 0;
+    int64_t peak_bytes = 0;
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+};
+
+MemCounters mem_counters(MemTag tag);
+// All tags together. The peak is the true high-water mark of the sum, not
+// the sum of the per-tag peaks.
+MemCounters mem_total();
+
+// Makes `tag` this thread's current tag and returns the previous one.
+MemTag mem_swap_tag(MemTag tag);
+
+// Attributes everything allocated on this thread to `tag` while it is open.
+class MemScope {
+public:
+    explicit MemScope(MemTag tag) : prev(mem_swap_tag(tag)) {}
+    ~MemScope() { mem_swap_tag(prev); }
+    MemScope(const MemScope&) = delete;
+    MemScope& operator=(const MemScope&) = delete;
+
+private:
+    MemTag prev;
+};
+
+// Global operator new calls made by this thread so far.
+size_t thread_allocations();
+
+// Resident set size from /proc, or -1 where that is unavailable. Includes
+// what malloc keeps cached and never handed back, so it exceeds live bytes.
+int64_t resident_bytes();
+
+// Private_Dirty from /proc/self/smaps_rollup, or -1 where that is
+// unavailable: pages this process has written and shares with nobody. In a
+// forked child that is what copy-on-write has duplicated so far, plus
+// whatever the child allocated itself.
+int64_t private_dirty_bytes();
@@ -0,0 +1,112 @@
+#pragma once
+#include "calendar.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <string>
+
+// --- CORE MODEL ---
+
+const long long DAY_SEC = 86400;
+const long long HALF_DAY = 43200; 
+const long long VIRTUE_REWARD = DAY_SEC; 
+
+// The tunable parts of the debt rules. The defaults are the live rules;
+// recurrency-batch replays history under others to see what would change.
+struct Policy {
+    long long rounding = HALF_DAY;       // Base cost is a whole number of these
+    long long virtue_reward = VIRTUE_REWARD;
+    double relapse_multiplier = 1.5;     // Vice while already in debt
+    double threshold_multiplier = 2.5;   // Bankrupt above base cost times this
+};
+
+// Days clean that earn an achievement
+const int CLEAN_MILESTONES[] = {5, 10, 25, 50, 100, 200, 300};
+
+struct ActivityLog {
+    long long id;
+    std::string user_name;
+    std::string action; 
+    std::string message;
+    time_t timestamp;
+    std::string color; 
+    long long change_delta;
+    long long debt_snapshot;
+};
+
+struct User {
+    std::string name;
+    std::string id;
+    std::string password;
+    
+    std::string vice;
+    double target_interval_days;
+    std::string virtue1_name;
+    double promised_v1_weekly;
+    std::string virtue2_name;
+    double promised_v2_weekly;
+
+    long long base_cost;     
+    long long max_threshold; 
+    
+    long long debt_seconds;
+    time_t last_update;      
+    time_t last_v1;
+    time_t last_v2;
+    time_t lock_time;
+    bool locked;
+    int streak; 
+
+    // Achievements
+    time_t last_vice;
+    int highest_clean_milestone; 
+    int virtue_streak_days;
+    time_t last_virtue_day_check;
+
+    // Time Zone ("" = server default)
+    std::string tz_name;
+    const TimeZone* zone;
+
+    User() : debt_seconds(0), last_update(std::time(nullptr)), last_v1(0), last_v2(0), lock_time(0), locked(false), streak(0), last_vice(std::time(nullptr)), highest_clean_milestone(0), virtue_streak_days(0), last_virtue_day_check(0), zone(default_zone()) {}
+
+    User(std::string n, std::string p, std::string v, double days, std::string v1n, double v1f, std::string v2n, double v2f) 
+        : name(n), password(p), vice(v), target_interval_days(days), 
+          virtue1_name(v1n), promised_v1_weekly(v1f), virtue2_name(v2n), promised_v2_weekly(v2f),
+          debt_seconds(0), last_update(std::time(nullptr)), last_v1(0), last_v2(0), lock_time(0), locked(false), streak(0),
+          last_vice(std::time(nullptr)), highest_clean_milestone(0), virtue_streak_days(0), last_virtue_day_check(0),
+          zone(default_zone())
+    {
+        id = n;
+        std::transform(id.begin(), id.end(), id.begin(), ::tolower);
+        calculate_math();
+    }
+
+    void calculate_math(const Policy& p = Policy()) {
+        long long natural_decay = (long long)(target_interval_days * DAY_SEC);
+        double weeks_in_interval = target_interval_days / 7.0;
+        double total_virtues = weeks_in_interval * (promised_v1_weekly + promised_v2_weekly);
+        double raw_work_capacity = total_virtues * (double)p.virtue_reward;
+        double raw_total = (double)natural_decay + raw_work_capacity;
+        long long blocks = (long long)std::round(raw_total / (double)p.rounding);
+        base_cost = blocks * p.rounding;
+        if (base_cost < natural_decay) base_cost = natural_decay;
+        max_threshold = (long long)(base_cost * p.threshold_multiplier);
+    }
+
+    // Highest clean-streak milestone reached by time t
+    int clean_milestone(time_t t) const {
+        double days_clean = std::difftime(t, last_vice) / 86400.0;
+        int reached = 0;
+        for (int m : CLEAN_MILESTONES) {
+            if (days_clean >= m) reached = m;
+        }
+        return reached;
+    }
+
+    // Unknown names fall back to the server default
+    void set_time_zone(const std::string& tz) {
+        const TimeZone* z = tz.empty() ? nullptr : find_zone(tz);
+        tz_name = z ? tz : "";
+        zone = z ? z : default_zone();
+    }
+};
@@ -0,0 +1,284 @@
+#include "records.h"
+#include "codec.h"
+#include "memory.h"
+#include <algorithm>
+#include <ctime>
+#include <set>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+json user_to_json(const User& user) {
+    return {
+        {"name", user.name},
+        {"password", user.password},
+        {"vice", user.vice},
+        {"target_interval_days", user.target_interval_days},
+        {"virtue1_name", user.virtue1_name},
+        {"promised_v1_weekly", user.promised_v1_weekly},
+        {"virtue2_name", user.virtue2_name},
+        {"promised_v2_weekly", user.promised_v2_weekly},
+        {"base_cost", user.base_cost},
+        {"max_threshold", user.max_threshold},
+        {"debt_seconds", user.debt_seconds},
+        {"last_update", user.last_update},
+        {"last_v1", user.last_v1},
+        {"last_v2", user.last_v2},
+        {"lock_time", user.lock_time},
+        {"locked", user.locked},
+        {"streak", user.streak},
+        {"last_vice", user.last_vice},
+        {"clean_milestone", user.highest_clean_milestone},
+        {"v_streak", user.virtue_streak_days},
+        {"last_v_check", user.last_virtue_day_check},
+        {"tz", user.tz_name}
+    };
+}
+
+User user_from_json(const std::string& key, const json& val) {
+    User u;
+    u.name = val["name"];
+    u.id = key; 
+    u.password = val["password"];
+    u.vice = val.value("vice", "Vice");
+    u.target_interval_days = val.value("target_interval_days", 7.0);
+    u.virtue1_name = val.value("virtue1_name", "Virtue 1");
+    u.promised_v1_weekly = val.value("promised_v1_weekly", 3.0);
+    u.virtue2_name = val.value("virtue2_name", "Virtue 2");
+    u.promised_v2_weekly = val.value("promised_v2_weekly", 5.0);
+    u.base_cost = val.value("base_cost", 10 * DAY_SEC);
+    u.max_threshold = val.value("max_threshold", 25 * DAY_SEC);
+    u.debt_seconds = val["debt_seconds"];
+    u.last_update = val["last_update"];
+    u.last_v1 = val.value("last_v1", 0);
+    u.last_v2 = val.value("last_v2", 0);
+    u.lock_time = val.value("lock_time", 0);
+    u.locked = val["locked"];
+    u.streak = val.value("streak", 0);
+    
+    u.last_vice = val.value("last_vice", (long long)std::time(nullptr));
+    u.highest_clean_milestone = val.value("clean_milestone", 0);
+    u.virtue_streak_days = val.value("v_streak", 0);
+    u.last_virtue_day_check = val.value("last_v_check", 0);
+    u.set_time_zone(val.value("tz", ""));
+    return u;
+}
+
+json log_to_json(const ActivityLog& log) {
+    return {
+        {"id", log.id},
+        {"user", log.user_name},
+        {"action", log.action},
+        {"msg", log.message},
+        {"ts", log.timestamp},
+        {"col", log.color},
+        {"delta", log.change_delta},
+        {"snap", log.debt_snapshot}
+    };
+}
+
+ActivityLog log_from_json(const json& l) {
+    ActivityLog log;
+    log.id = l.value("id", 0LL);
+    log.user_name = l["user"];
+    log.action = l["action"];
+    log.message = l["msg"];
+    log.timestamp = l["ts"];
+    log.color = l["col"];
+    log.change_delta = l.value("delta", 0LL);
+    log.debt_snapshot = l.value("snap", 0LL);
+    return log;
+}
+
+json stats_to_json(const UserStats& st) {
+    json weeks = json::object(), months = json::object();
+    for (auto const& [idx, w] : st.weeks) {
+        if (w.vices || w.virtue1 || w.virtue2) weeks[std::to_string(idx)] = {w.vices, w.virtue1, w.virtue2};
+    }
+    for (auto const& [idx, w] : st.months) {
+        if (w.vices || w.virtue1 || w.virtue2) months[std::to_string(idx)] = {w.vices, w.virtue1, w.virtue2};
+    }
+    return {
+        {"weeks", weeks},
+        {"months", months},
+        {"debt_sum", st.debt_sum},
+        {"debt_samples", st.debt_samples},
+        {"clean_episodes", st.clean_episodes},
+        {"clean_seconds", st.clean_seconds},
+        {"bankruptcies", st.bankruptcies},
+        {"episode", {st.in_debt_episode, st.episode_start, st.frozen, st.last_ts, st.last_snapshot}}
+    };
+}
+
+void stats_from_json(UserStats& st, const json& val) {
+    st = UserStats();
+    for (auto& [idx, w] : val["weeks"].items()) st.weeks[std::stoll(idx)] = {w[0], w[1], w[2]};
+    for (auto& [idx, w] : val["months"].items()) st.months[std::stoll(idx)] = {w[0], w[1], w[2]};
+    st.debt_sum = val.value("debt_sum", 0LL);
+    st.debt_samples = val.value("debt_samples", 0LL);
+    st.clean_episodes = val.value("clean_episodes", 0LL);
+    st.clean_seconds = val.value("clean_seconds", 0LL);
+    st.bankruptcies = val.value("bankruptcies", 0);
+    const json& ep = val["episode"];
+    st.in_debt_episode = ep[0];
+    st.episode_start = ep[1];
+    st.frozen = ep[2];
+    st.last_ts = ep[3];
+    st.last_snapshot = ep[4];
+}
+
+static const char* EVENT_NAMES[] = {"genesis", "contract", "vice", "virtue", "reset"};
+
+json event_to_json(const UserEvent& ev) {
+    json j = {{"e", EVENT_NAMES[(int)ev.type]}, {"ts", ev.ts}};
+    if (!ev.log_ids.empty()) j["logs"] = ev.log_ids;
+    if (ev.type == EventType::Virtue) j["n"] = ev.virtue;
+    if (ev.type == EventType::Reset) j["by"] = ev.by;
+    if (!ev.key.empty()) j["key"] = ev.key;
+    if (ev.type == EventType::Genesis) {
+        j["state"] = user_to_json(*ev.state);
+        j["state"]["password"] = "";
+    }
+    if (ev.type == EventType::Contract) {
+        j["terms"] = {
+            {"vice", ev.state->vice},
+            {"days", ev.state->target_interval_days},
+            {"v1", ev.state->virtue1_name},
+            {"v1w", ev.state->promised_v1_weekly},
+            {"v2", ev.state->virtue2_name},
+            {"v2w", ev.state->promised_v2_weekly}
+        };
+    }
+    return j;
+}
+
+UserEvent event_from_json(const std::string& key, const json& j) {
+    UserEvent ev;
+    std::string e = j["e"];
+    for (int t = 0; t < 5; t++) {
+        if (e == EVENT_NAMES[t]) ev.type = (EventType)t;
+    }
+    ev.ts = j["ts"];
+    if (j.contains("logs")) ev.log_ids = j["logs"].get<std::vector<long long>>();
+    ev.virtue = j.value("n", 0);
+    ev.by = j.value("by", "");
+    ev.key = j.value("key", "");
+    if (ev.type == EventType::Genesis) ev.state = std::make_shared<User>(user_from_json(key, j["state"]));
+    if (ev.type == EventType::Contract) {
+        const json& t = j["terms"];
+        auto terms = std::make_shared<User>();
+        terms->vice = t["vice"];
+        terms->target_interval_days = t["days"];
+        terms->virtue1_name = t["v1"];
+        terms->promised_v1_weekly = t["v1w"];
+        terms->virtue2_name = t["v2"];
+        terms->promised_v2_weekly = t["v2w"];
+        ev.state = terms;
+    }
+    return ev;
+}
+
+json history_block_to_json(const DebtSeries& series, size_t block) {
+    return {{"b", base64_encode(series.block(block))}};
+}
+
+void history_block_from_json(DebtSeries& series, const json& j) {
+    std::optional<std::string> bytes = base64_decode(j.value("b", ""));
+    if (!bytes) throw std::runtime_error("debt history block is not base64");
+    series.load_block(*bytes);
+}
+
+json build_db_json(const Engine& engine, bool events) {
+    json j;
+    j["users"] = json::object();
+    for (auto const& [key, user] : engine.users) j["users"][key] = user_to_json(user);
+    j["logs"] = json::array();
+    for (const ActivityLog* log : engine.activity_feed.snapshot()) j["logs"].push_back(log_to_json(*log));
+    j["stats"] = json::object();
+    for (auto const& [name, st] : engine.analytics.all()) j["stats"][name] = stats_to_json(st);
+    j["history"] = json::object();
+    for (auto const& [name, series] : engine.debt_history) {
+        json& blocks = j["history"][name] = json::array();
+        for (size_t i = 0; i < series.block_count(); i++) blocks.push_back(history_block_to_json(series, i));
+    }
+    j["events"] = json::object();
+    if (!events) return j;
+    for (auto const& [key, user] : engine.users) {
+        json& stream = j["events"][key] = json::array();
+        if (const auto* evs = engine.events.events(key)) {
+            for (const auto& ev : *evs) stream.push_back(event_to_json(ev));
+        }
+    }
+    return j;
+}
+
+void load_db_json(Engine& engine, const json& j) {
+    MemScope mem(MemTag::Users);
+    engine.users.clear();
+    for (auto& [key, val] : j["users"].items()) {
+        engine.users[key] = user_from_json(key, val);
+    }
+    mem_swap_tag(MemTag::Feed);
+    std::vector<ActivityLog> logs; // Newest first
+    if (j.contains("logs")) {
+        for (const auto& l : j["logs"]) logs.push_back(log_from_json(l));
+    }
+    // Older databases have no log ids: number them oldest first
+    engine.next_log_id = 0;
+    for (const auto& log : logs) engine.next_log_id = std::max(engine.next_log_id, log.id);
+    for (auto it = logs.rbegin(); it != logs.rend(); ++it) {
+        if (it->id == 0) it->id = ++engine.next_log_id;
+    }
+    // Everything is searchable; the feed shows the newest FEED_SIZE
+    std::sort(logs.begin(), logs.end(), [](const ActivityLog& a, const ActivityLog& b) { return a.id < b.id; });
+    mem_swap_tag(MemTag::Search);
+    engine.search.clear();
+    for (const auto& log : logs) engine.search.add(log);
+    engine.search.take_added(); // They came from storage
+    mem_swap_tag(MemTag::Feed);
+    engine.activity_feed.clear();
+    for (size_t i = logs.size() > FEED_SIZE ? logs.size() - FEED_SIZE : 0; i < logs.size(); i++) {
+        engine.activity_feed.append(logs[i]);
+    }
+
+    // Aggregates predate keeping every entry, so prefer the stored copy
+    engine.analytics.clear();
+    if (j.contains("stats")) {
+        for (auto& [name, val] : j["stats"].items()) {
+            stats_from_json(engine.analytics.at(name), val);
+        }
+    } else {
+        for (const auto& log : logs) {
+            engine.analytics.apply(log.user_name, log.action, log.timestamp, log.debt_snapshot, engine.zone_for_name(log.user_name));
+        }
+    }
+
+    // So does debt history; users without one start it from the entries
+    // there are
+    engine.debt_history.clear();
+    std::set<std::string> stored;
+    if (j.contains("history")) {
+        for (auto& [name, blocks] : j["history"].items()) {
+            for (const auto& b : blocks) history_block_from_json(engine.debt_history[name], b);
+            stored.insert(name);
+        }
+    }
+    for (const auto& log : logs) {
+        if (!charted_action(log.action) || stored.count(log.user_name) || !engine.find_user_by_name(log.user_name)) continue;
+        engine.debt_history[log.user_name].append({log.timestamp, log.change_delta, log.debt_snapshot});
+    }
+
+    // Users from before event sourcing start their history at today's state.
+    // A paged store fetches (or starts) streams left out here on first use.
+    mem_swap_tag(MemTag::History);
+    engine.events.clear();
+    for (auto& [key, user] : engine.users) {
+        std::vector<UserEvent> evs;
+        if (j.contains("events") && j["events"].contains(key)) {
+            for (const auto& e : j["events"][key]) evs.push_back(event_from_json(key, e));
+        }
+        if (evs.empty() && engine.events.paged()) continue;
+        if (evs.empty()) evs.push_back(genesis_event(user));
+        engine.events.load(user, std::move(evs));
+    }
+}
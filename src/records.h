@@ -0,0 +1,31 @@
+#pragma once
+#include "engine.h"
+#include "json.hpp"
+#include <string>
+
+// --- RECORDS ---
+// The JSON shape of every piece of engine state. Storage keys and encodings
+// are storage.h's and codec.h's business; this is only what goes inside.
+// The same forms make up the legacy single-document layout:
+//   {"users": {id: user}, "logs": [newest first], "stats": {name: stats},
+//    "events": {id: [event, ...]}, "history": {name: [block, ...]}}
+
+nlohmann::json user_to_json(const User& user);
+User user_from_json(const std::string& key, const nlohmann::json& val);
+nlohmann::json log_to_json(const ActivityLog& log);
+ActivityLog log_from_json(const nlohmann::json& l);
+nlohmann::json stats_to_json(const UserStats& st);
+void stats_from_json(UserStats& st, const nlohmann::json& val);
+// Genesis states are written without the password
+nlohmann::json event_to_json(const UserEvent& ev);
+UserEvent event_from_json(const std::string& key, const nlohmann::json& j);
+// {"b": base64 of DebtSeries::block()}. Loading throws std::runtime_error
+// on a malformed block.
+nlohmann::json history_block_to_json(const DebtSeries& series, size_t block);
+void history_block_from_json(DebtSeries& series, const nlohmann::json& j);
+
+// Without events, "events" is left empty, so no paged stream is read back.
+nlohmann::json build_db_json(const Engine& engine, bool events = true);
+// Replaces everything in engine. Documents from before ids, stats or events
+// existed are upgraded on the way in.
+void load_db_json(Engine& engine, const nlohmann::json& j);
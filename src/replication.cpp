@@ -0,0 +1,242 @@
+#include "replication.h"
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include "asio.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+using asio::ip::tcp;
+
+static int64_t wall_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::string frame(const std::string& payload) {
+    return std::to_string(payload.size()) + "\n" + payload;
+}
+
+static const size_t MAX_HELLO = 4096;
+
+// `limit` bounds what an unauthenticated peer can make us allocate
+static std::string read_frame(tcp::socket& sock, asio::streambuf& buf, size_t limit = SIZE_MAX) {
+    asio::read_until(sock, buf, '\n');
+    std::istream in(&buf);
+    std::string header;
+    std::getline(in, header);
+    size_t len = std::stoul(header);
+    if (len > limit) throw std::runtime_error("frame too large");
+    if (buf.size() < len) asio::read(sock, buf, asio::transfer_exactly(len - buf.size()));
+    std::string payload(len, '\0');
+    in.read(&payload[0], (std::streamsize)len);
+    return payload;
+}
+
+// Takes as long whatever the mismatch
+static bool same_token(const std::string& a, const std::string& b) {
+    unsigned char diff = a.size() != b.size();
+    for (size_t i = 0; i < a.size(); i++) diff |= (unsigned char)(a[i] ^ b[i % std::max<size_t>(b.size(), 1)]);
+    return diff == 0;
+}
+
+// --- PRIMARY ---
+
+struct ReplicationPrimary::Session {
+    asio::io_context io;
+    tcp::socket socket{io};
+};
+
+void ReplicationPrimary::start(const std::string& bind, unsigned short port, const std::string& secret,
+                               ImageRequest request) {
+    if (started.exchange(true)) return;
+    token = secret;
+    request_image = std::move(request);
+    acceptor = std::thread([this, bind, port] { accept_loop(bind, port); });
+    acceptor.detach();
+}
+
+uint64_t ReplicationPrimary::lsn() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return head_lsn;
+}
+
+void ReplicationPrimary::publish(std::vector<std::string> records) {
+    if (records.empty()) return;
+    int64_t ts = wall_ms();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& r : records) {
+            head_lsn++;
+            backlog.emplace_back(head_lsn, frame("{\"lsn\":" + std::to_string(head_lsn) + ",\"ts\":" + std::to_string(ts) + ",\"r\":" + r + "}"));
+            if (backlog.size() > BACKLOG) backlog.pop_front();
+        }
+    }
+    cv.notify_all();
+}
+
+void ReplicationPrimary::provide_image(std::string img) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        image = std::make_shared<const std::string>(std::move(img));
+        image_lsn = head_lsn;
+        image_requested = false;
+    }
+    cv.notify_all();
+}
+
+// The cached image is good while the backlog holds everything after it
+bool ReplicationPrimary::image_usable() const {
+    if (!image) return false;
+    return image_lsn == head_lsn || (!backlog.empty() && backlog.front().first <= image_lsn + 1);
+}
+
+void ReplicationPrimary::accept_loop(std::string bind, unsigned short port) {
+    try {
+        asio::io_context io;
+        tcp::acceptor acc(io, tcp::endpoint(asio::ip::make_address(bind), port));
+        std::cerr << "(replication) primary listening on " << bind << ":" << port << std::endl;
+        while (true) {
+            auto session = std::make_shared<Session>();
+            acc.accept(session->socket);
+            session->socket.set_option(tcp::no_delay(true));
+            std::thread([this, session] { serve(session); }).detach();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "(replication) acceptor stopped: " << e.what() << std::endl;
+    }
+}
+
+void ReplicationPrimary::serve(std::shared_ptr<Session> session) {
+    try {
+        // A peer gets five seconds to say who it is
+        timeval tv{5, 0};
+        ::setsockopt(session->socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        asio::streambuf buf;
+        if (!same_token(read_frame(session->socket, buf, MAX_HELLO), token)) {
+            std::cerr << "(replication) refused a replica with the wrong token" << std::endl;
+            return;
+        }
+    } catch (const std::exception&) {
+        return;
+    }
+    replicas++;
+    uint64_t cursor = 0;
+    bool need_snapshot = true;
+    try {
+        while (true) {
+            std::vector<std::string> out;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (!need_snapshot) {
+                    cv.wait_for(lock, std::chrono::seconds(1), [&] { return head_lsn > cursor; });
+                    // Fell out of the backlog window: start over from the image
+                    if (head_lsn > cursor && (backlog.empty() || backlog.front().first > cursor + 1)) need_snapshot = true;
+                }
+                if (need_snapshot && !image_usable()) {
+                    // Asked for outside the lock: the request may build the image right here
+                    bool ask = !image_requested;
+                    image_requested = true;
+                    if (ask) {
+                        lock.unlock();
+                        bool asked = request_image && request_image();
+                        lock.lock();
+                        if (!asked) image_requested = false;
+                    }
+                    cv.wait_for(lock, std::chrono::seconds(1), [&] { return image_usable(); });
+                    continue;
+                }
+                if (need_snapshot) {
+                    out.push_back(frame("{\"t\":\"snapshot\",\"lsn\":" + std::to_string(image_lsn) + "}"));
+                    out.push_back(frame(*image));
+                    cursor = image_lsn;
+                    need_snapshot = false;
+                } else if (head_lsn > cursor) {
+                    auto it = std::lower_bound(backlog.begin(), backlog.end(), cursor + 1,
+                                               [](const std::pair<uint64_t, std::string>& e, uint64_t l) { return e.first < l; });
+                    for (; it != backlog.end(); ++it) out.push_back(it->second);
+                    cursor = head_lsn;
+                } else {
+                    out.push_back(frame("{\"t\":\"hb\",\"lsn\":" + std::to_string(head_lsn) + ",\"ts\":" + std::to_string(wall_ms()) + "}"));
+                }
+            }
+            std::vector<asio::const_buffer> bufs;
+            for (const auto& f : out) bufs.push_back(asio::buffer(f));
+            asio::write(session->socket, bufs);
+        }
+    } catch (const std::exception&) {
+        // Replica went away
+    }
+    replicas--;
+}
+
+// --- REPLICA ---
+
+void ReplicaClient::start(const std::string& host, unsigned short port, const std::string& secret,
+                          SnapshotFn on_snapshot, RecordFn on_record) {
+    token = secret;
+    snapshot_fn = std::move(on_snapshot);
+    record_fn = std::move(on_record);
+    worker = std::thread([this, host, port] { run(host, port); });
+    worker.detach();
+}
+
+double ReplicaClient::lag_seconds() const {
+    int64_t now = wall_ms();
+    if (!is_connected) return primary_ts_ms ? (now - primary_ts_ms) / 1000.0 : -1.0;
+    if (applied >= primary) return 0.0;
+    return (now - applied_ts_ms) / 1000.0;
+}
+
+// Pulls an unsigned field out of a small control frame without a JSON parser
+static uint64_t field_u64(const std::string& s, const std::string& key) {
+    size_t p = s.find("\"" + key + "\":");
+    if (p == std::string::npos) return 0;
+    return std::stoull(s.substr(p + key.size() + 3));
+}
+
+void ReplicaClient::run(std::string host, unsigned short port) {
+    while (true) {
+        try {
+            asio::io_context io;
+            tcp::resolver resolver(io);
+            tcp::socket sock(io);
+            asio::connect(sock, resolver.resolve(host, std::to_string(port)));
+            asio::write(sock, asio::buffer(frame(token)));
+            is_connected = true;
+            std::cerr << "(replication) connected to primary " << host << ":" << port << std::endl;
+            asio::streambuf buf;
+            while (true) {
+                std::string f = read_frame(sock, buf);
+                if (f.compare(0, 15, "{\"t\":\"snapshot\"") == 0) {
+                    uint64_t lsn = field_u64(f, "lsn");
+                    std::string img = read_frame(sock, buf);
+                    snapshot_fn(img);
+                    applied = lsn;
+                    primary = std::max(primary.load(), lsn);
+                    applied_ts_ms = primary_ts_ms = wall_ms();
+                } else if (f.compare(0, 9, "{\"t\":\"hb\"") == 0) {
+                    primary = field_u64(f, "lsn");
+                    primary_ts_ms = (int64_t)field_u64(f, "ts");
+                } else {
+                    // {"lsn":N,"ts":ms,"r":{...}}
+                    size_t r = f.find(",\"r\":");
+                    if (r == std::string::npos) continue;
+                    uint64_t lsn = field_u64(f, "lsn");
+                    int64_t ts = (int64_t)field_u64(f, "ts");
+                    record_fn(f.substr(r + 5, f.size() - r - 6));
+                    applied = lsn;
+                    applied_ts_ms = ts;
+                    primary = std::max(primary.load(), lsn);
+                    primary_ts_ms = std::max(primary_ts_ms.load(), ts);
+                }
+            }
+        } catch (const std::exception& e) {
+            if (is_connected) std::cerr << "(replication) lost primary: " << e.what() << std::endl;
+            is_connected = false;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --- REPLICATION ---
+// The primary ships every commit to replicas over TCP as a stream of
+// length-prefixed frames ("<bytes>\n<payload>"):
+//
+//   {"t":"snapshot","lsn":L}  followed by one raw frame holding the full DB image
+//   {"lsn":N,"ts":ms,"r":{...}}  one change record (user / log / stats / history / event)
+//   {"t":"hb","lsn":N,"ts":ms}  heartbeat, once a second when idle
+//
+// A replica opens with one frame holding the shared token; the primary hangs
+// up on anything else. A replica that connects, or falls further behind
+// than the backlog, is resynchronised from an image. Images are built on
+// request, not per commit: one is reused while the backlog still reaches
+// back to it. LSNs are per primary process. Nothing shipped carries
+// passwords (see main.cpp).
+
+class ReplicationPrimary {
+public:
+    // Asks for a fresh image, to be handed to provide_image() from the
+    // thread that publishes; false if it can't be asked for yet
+    using ImageRequest = std::function<bool()>;
+
+    // Listens on bind:port; replicas must present `token`
+    void start(const std::string& bind, unsigned short port, const std::string& token, ImageRequest request_image);
+    bool running() const { return started.load(); }
+
+    // Called after each commit with its change records, which get
+    // consecutive LSNs.
+    void publish(std::vector<std::string> records);
+    // The full image as of the last record published
+    void provide_image(std::string image);
+
+    uint64_t lsn() const;
+    int replica_count() const { return replicas.load(); }
+
+private:
+    struct Session;
+    void accept_loop(std::string bind, unsigned short port);
+    void serve(std::shared_ptr<Session> session);
+    bool image_usable() const; // With mtx held
+
+    std::string token;
+    ImageRequest request_image;
+
+    static const size_t BACKLOG = 4096;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    uint64_t head_lsn = 0;
+    std::deque<std::pair<uint64_t, std::string>> backlog; // Framed payloads
+    std::shared_ptr<const std::string> image;
+    uint64_t image_lsn = 0;
+    bool image_requested = false;
+
+    std::atomic<bool> started{false};
+    std::atomic<int> replicas{0};
+    std::thread acceptor;
+};
+
+class ReplicaClient {
+public:
+    using SnapshotFn = std::function<void(const std::string& image)>;
+    using RecordFn = std::function<void(const std::string& record)>;
+
+    // Connects (and reconnects) to the primary on a background thread.
+    void start(const std::string& host, unsigned short port, const std::string& token, SnapshotFn on_snapshot,
+               RecordFn on_record);
+
+    bool connected() const { return is_connected.load(); }
+    uint64_t applied_lsn() const { return applied.load(); }
+    uint64_t primary_lsn() const { return primary.load(); }
+    // Seconds between the oldest unapplied commit and now (0 when caught up).
+    double lag_seconds() const;
+
+private:
+    void run(std::string host, unsigned short port);
+
+    std::string token;
+    SnapshotFn snapshot_fn;
+    RecordFn record_fn;
+    std::atomic<bool> is_connected{false};
+    std::atomic<uint64_t> applied{0};
+    std::atomic<uint64_t> primary{0};
+    std::atomic<int64_t> applied_ts_ms{0};  // Primary clock of the last applied record
+    std::atomic<int64_t> primary_ts_ms{0};  // Primary clock of the last frame seen
+    std::thread worker;
+};
@@ -0,0 +1,102 @@
+#include "scheduler.h"
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include "asio.hpp"
+#include <ctime>
+#include <iostream>
+
+struct Scheduler::Entry {
+    std::string name;
+    std::chrono::milliseconds period{0}; // 0 = one-shot
+    double jitter = 0;
+    Job job;
+    asio::steady_timer timer;
+
+    explicit Entry(asio::io_context& io) : timer(io) {}
+};
+
+Scheduler::Scheduler()
+    : io(new asio::io_context()),
+      rng((uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() | 1) {}
+
+Scheduler::~Scheduler() {
+    stop();
+}
+
+void Scheduler::every(const std::string& name, std::chrono::milliseconds period, double jitter, Job job) {
+    auto e = std::make_shared<Entry>(*io);
+    e->name = name;
+    e->period = period;
+    e->jitter = jitter;
+    e->job = std::move(job);
+    arm(e, jittered(*e));
+}
+
+void Scheduler::once(const std::string& name, std::chrono::milliseconds delay, Job job) {
+    auto e = std::make_shared<Entry>(*io);
+    e->name = name;
+    e->job = std::move(job);
+    arm(e, delay);
+}
+
+void Scheduler::start(Dispatch d) {
+    if (worker.joinable()) return;
+    dispatch = std::move(d);
+    worker = std::thread([this] {
+        auto guard = asio::make_work_guard(*io);
+        io->run();
+    });
+}
+
+void Scheduler::stop() {
+    if (!worker.joinable()) return;
+    io->stop();
+    worker.join();
+}
+
+std::map<std::string, JobStats> Scheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return job_stats;
+}
+
+// Jobs are registered before start(), after which only the timer thread gets here
+std::chrono::milliseconds Scheduler::jittered(const Entry& e) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    double unit = (double)(rng >> 11) / (double)(1ULL << 53) * 2.0 - 1.0; // [-1, 1)
+    auto ms = (long long)((double)e.period.count() * (1.0 + e.jitter * unit));
+    return std::chrono::milliseconds(ms > 0 ? ms : 1);
+}
+
+void Scheduler::arm(std::shared_ptr<Entry> e, std::chrono::milliseconds delay) {
+    e->timer.expires_after(delay);
+    e->timer.async_wait([this, e](const asio::error_code& ec) {
+        if (!ec) fire(e);
+    });
+}
+
+void Scheduler::fire(std::shared_ptr<Entry> e) {
+    bool queued = dispatch && dispatch([this, e] {
+        auto t0 = std::chrono::steady_clock::now();
+        try {
+            e->job();
+        } catch (const std::exception& ex) {
+            std::cerr << "(scheduler) " << e->name << " failed: " << ex.what() << std::endl;
+        }
+        uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+        std::lock_guard<std::mutex> lock(mtx);
+        JobStats& s = job_stats[e->name];
+        s.runs++;
+        s.total_us += us;
+        s.last_us = us;
+        if (us > s.max_us) s.max_us = us;
+        s.last_run = (int64_t)std::time(nullptr);
+    });
+    if (!queued) {
+        std::lock_guard<std::mutex> lock(mtx);
+        job_stats[e->name].skipped++;
+    }
+    if (e->period.count() > 0) arm(e, jittered(*e));
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace asio { class io_context; }
+
+// --- MAINTENANCE SCHEDULER ---
+// Named periodic and one-shot jobs driven by Asio steady timers, so work
+// like decay, milestones and compaction happens between requests instead
+// of inside the first one after a quiet spell. Timers tick on the
+// scheduler's own io_context. Each job is handed to a Dispatch function
+// that decides where it runs; the engine posts jobs onto Crow's worker
+// io_context so they never race handlers. Periodic jobs are spread by
+// +-jitter so they don't line up.
+
+struct JobStats {
+    uint64_t runs = 0;
+    uint64_t skipped = 0;   // Dispatch had nowhere to run it yet
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    uint64_t last_us = 0;
+    int64_t last_run = 0;   // Unix seconds
+};
+
+class Scheduler {
+public:
+    using Job = std::function<void()>;
+    // Runs `run` somewhere, eventually; false if it cannot right now.
+    using Dispatch = std::function<bool(std::function<void()> run)>;
+
+    Scheduler();
+    ~Scheduler();
+
+    // Register jobs before start(). jitter is a fraction of the period, e.g. 0.1 for +-10%
+    void every(const std::string& name, std::chrono::milliseconds period, double jitter, Job job);
+    void once(const std::string& name, std::chrono::milliseconds delay, Job job);
+
+    void start(Dispatch dispatch);
+    void stop();
+
+    std::map<std::string, JobStats> stats() const;
+
+private:
+    struct Entry;
+    void arm(std::shared_ptr<Entry> e, std::chrono::milliseconds delay);
+    void fire(std::shared_ptr<Entry> e);
+    std::chrono::milliseconds jittered(const Entry& e);
+
+    std::unique_ptr<asio::io_context> io;
+    std::thread worker;
+    Dispatch dispatch;
+    mutable std::mutex mtx;
+    std::map<std::string, JobStats> job_stats;
+    uint64_t rng;
+};
@@ -0,0 +1,145 @@
+#include "search_index.h"
+#include <algorithm>
+#include <cctype>
+
+// Every entry is also under this, for queries with nothing but a time range
+static const std::string ALL = "*";
+
+std::vector<std::string> SearchIndex::tokenize(std::string_view text) {
+    std::vector<std::string> out;
+    std::string word;
+    for (char c : text) {
+        unsigned char b = (unsigned char)c;
+        if (b >= 0x80 || std::isalnum(b)) {
+            word += (char)std::tolower(b);
+        } else if (!word.empty()) {
+            out.push_back(std::move(word));
+            word.clear();
+        }
+    }
+    if (!word.empty()) out.push_back(std::move(word));
+    return out;
+}
+
+// Every key an entry is listed under
+static std::vector<std::string> keys_of(const ActivityLog& log) {
+    std::vector<std::string> k = SearchIndex::tokenize(log.message);
+    k.push_back("#" + log.action);
+    std::string user = log.user_name;
+    std::transform(user.begin(), user.end(), user.begin(), ::tolower);
+    k.push_back("@" + user);
+    k.push_back(ALL);
+    std::sort(k.begin(), k.end());
+    k.erase(std::unique(k.begin(), k.end()), k.end());
+    return k;
+}
+
+void SearchIndex::add(const ActivityLog& log) {
+    if (!ids.empty() && log.id <= ids.back()) return;
+    uint32_t doc = (uint32_t)ids.size();
+    ids.push_back(log.id);
+    gone.push_back(false);
+    live++;
+    Posting p{log.timestamp, doc};
+    for (const std::string& key : keys_of(log)) {
+        std::vector<Posting>& list = postings[key];
+        // Entries arrive in time order except for offline batches
+        if (list.empty() || list.back() < p) list.push_back(p);
+        else list.insert(std::upper_bound(list.begin(), list.end(), p), p);
+    }
+    unsynced.push_back(log);
+}
+
+bool SearchIndex::remove(long long id) {
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it == ids.end() || *it != id || gone[it - ids.begin()]) return false;
+    gone[it - ids.begin()] = true;
+    live--;
+    auto queued = std::find_if(unsynced.begin(), unsynced.end(), [&](const ActivityLog& l) { return l.id == id; });
+    if (queued != unsynced.end()) unsynced.erase(queued);
+    else removed.push_back(id);
+    return true;
+}
+
+void SearchIndex::clear() {
+    ids.clear();
+    gone.clear();
+    live = 0;
+    postings.clear();
+    unsynced.clear();
+    removed.clear();
+}
+
+std::vector<ActivityLog> SearchIndex::take_added() {
+    std::vector<ActivityLog> out;
+    out.swap(unsynced);
+    return out;
+}
+
+std::vector<long long> SearchIndex::take_removed() {
+    std::vector<long long> out;
+    out.swap(removed);
+    return out;
+}
+
+SearchResult SearchIndex::search(const SearchQuery& q) const {
+    SearchResult result;
+    std::vector<std::string> wanted;
+    for (const std::string& term : q.terms) {
+        for (std::string& t : tokenize(term)) wanted.push_back(std::move(t));
+    }
+    if (!q.action.empty()) wanted.push_back("#" + q.action);
+    if (!q.user.empty()) {
+        std::string user = q.user;
+        std::transform(user.begin(), user.end(), user.begin(), ::tolower);
+        wanted.push_back("@" + user);
+    }
+    if (wanted.empty()) wanted.push_back(ALL);
+
+    // Each list narrowed to the time range
+    struct Span {
+        const Posting* begin;
+        const Posting* end;
+    };
+    std::vector<Span> spans;
+    for (const std::string& key : wanted) {
+        auto it = postings.find(key);
+        if (it == postings.end()) return result;
+        const std::vector<Posting>& list = it->second;
+        auto by_ts = [](const Posting& p, time_t t) { return p.ts < t; };
+        const Posting* b = std::lower_bound(list.data(), list.data() + list.size(), q.from, by_ts);
+        const Posting* e = std::lower_bound(b, list.data() + list.size(), q.to, by_ts);
+        if (b == e) return result;
+        spans.push_back({b, e});
+    }
+    std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.end - a.begin < b.end - b.begin; });
+
+    std::vector<uint32_t> hits;
+    for (const Posting* p = spans[0].begin; p != spans[0].end; ++p) {
+        bool all = true;
+        for (size_t i = 1; i < spans.size() && all; i++) {
+            Span& s = spans[i];
+            // Gallop to the first posting not before p, then binary search the last step
+            size_t step = 1;
+            const Posting* lo = s.begin;
+            while ((size_t)(s.end - lo) > step && lo[step] < *p) {
+                lo += step;
+                step *= 2;
+            }
+            s.begin = std::lower_bound(lo, lo + std::min(step + 1, (size_t)(s.end - lo)), *p);
+            if (s.begin == s.end) {
+                all = false;
+                spans[0].end = p + 1; // Nothing later can match either
+            } else {
+                all = *s.begin == *p;
+            }
+        }
+        if (all && !gone[p->doc]) hits.push_back(p->doc);
+    }
+
+    result.total = hits.size();
+    for (size_t i = q.offset; i < hits.size() && result.ids.size() < q.limit; i++) {
+        result.ids.push_back(ids[hits[hits.size() - 1 - i]]);
+    }
+    return result;
+}
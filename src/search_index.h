@@ -0,0 +1,72 @@
+#pragma once
+#include "models.h"
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// --- SEARCH ---
+// An inverted index over every activity entry ever logged, not only the
+// feed's window. Each word of an entry's message, its action ("#vice") and
+// its user ("@alice") map to a posting list of the entries that have them,
+// kept in (time, entry) order. A query cuts its time range out of each list
+// with a binary search, then intersects them starting from the shortest,
+// galloping through the longer ones. Only ids are kept: the entries
+// themselves live in storage, which is where results are read from.
+
+struct SearchQuery {
+    std::vector<std::string> terms; // Every one must match; split like messages
+    std::string user;                // Display name or id; empty for anyone
+    std::string action;              // "vice", "virtue1", ...; empty for any
+    time_t from = std::numeric_limits<time_t>::min(); // from <= ts < to
+    time_t to = std::numeric_limits<time_t>::max();
+    size_t offset = 0;
+    size_t limit = 50;
+};
+
+struct SearchResult {
+    size_t total = 0;           // Matches before offset and limit
+    std::vector<long long> ids; // Log ids, newest first
+};
+
+class SearchIndex {
+public:
+    // Ids must increase, as the feed's do; anything else is ignored
+    void add(const ActivityLog& log);
+    // Takes an entry back out (undo). False if it isn't indexed.
+    bool remove(long long id);
+    void clear();
+    size_t size() const { return live; }
+
+    SearchResult search(const SearchQuery& q) const;
+
+    // What storage hasn't seen: entries added since the last call (less
+    // any removed since), and ids removed since the last call
+    std::vector<ActivityLog> take_added();
+    std::vector<long long> take_removed();
+
+    // Lowercased runs of letters and digits; any non-ASCII byte counts as a
+    // letter, so names in other scripts stay whole.
+    static std::vector<std::string> tokenize(std::string_view text);
+
+private:
+    struct Posting {
+        time_t ts;
+        uint32_t doc;
+        bool operator<(const Posting& o) const { return ts != o.ts ? ts < o.ts : doc < o.doc; }
+        bool operator==(const Posting& o) const { return ts == o.ts && doc == o.doc; }
+    };
+
+    // Entry number -> log id, ascending. Removed entries keep their number
+    // and postings, and are skipped when a query finds them.
+    std::vector<long long> ids;
+    std::vector<bool> gone;
+    size_t live = 0;
+    std::unordered_map<std::string, std::vector<Posting>> postings;
+
+    std::vector<ActivityLog> unsynced;
+    std::vector<long long> removed;
+};
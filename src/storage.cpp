@@ -0,0 +1,230 @@
+#include "storage.h"
+#include "btree.h"
+#include "codec.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+void StorageEngine::put(const std::string& key, std::string value, Completion done) {
+    StorageBatch batch;
+    batch.push_back({key, std::move(value)});
+    commit(std::move(batch), std::move(done));
+}
+
+// --- KEYS ---
+
+std::string user_key(const std::string& id) {
+    return "u/" + id;
+}
+
+std::string stats_key(const std::string& name) {
+    return "s/" + name;
+}
+
+std::string log_key(long long id) {
+    char buf[24];
+    std::snprintf(buf, sizeof(buf), "l/%016lld", id);
+    return buf;
+}
+
+std::string event_prefix(const std::string& user_id) {
+    return "e/" + user_id + "/";
+}
+
+std::string event_key(const std::string& user_id, size_t seq) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%010zu", seq);
+    return event_prefix(user_id) + buf;
+}
+
+std::string prefix_end(const std::string& prefix) {
+    std::string end = prefix;
+    while (!end.empty() && (unsigned char)end.back() == 0xff) end.pop_back();
+    if (!end.empty()) end.back()++;
+    return end;
+}
+
+// <kind>/<owner>/<n, digits wide>. Owners may contain '/', n never does.
+static bool parse_numbered_key(const std::string& key, const char* kind, size_t digits, std::string& owner, size_t& n) {
+    size_t slash = key.rfind('/');
+    if (key.compare(0, 2, kind) != 0 || slash == std::string::npos || slash < 2 || key.size() - slash != digits + 1) return false;
+    owner = key.substr(2, slash - 2);
+    n = 0;
+    for (size_t i = slash + 1; i < key.size(); i++) {
+        if (key[i] < '0' || key[i] > '9') return false;
+        n = n * 10 + (size_t)(key[i] - '0');
+    }
+    return true;
+}
+
+bool parse_event_key(const std::string& key, std::string& user_id, size_t& seq) {
+    return parse_numbered_key(key, "e/", 10, user_id, seq);
+}
+
+std::string history_key(const std::string& name, size_t block) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%06zu", block);
+    return "h/" + name + "/" + buf;
+}
+
+bool parse_history_key(const std::string& key, std::string& name, size_t& block) {
+    return parse_numbered_key(key, "h/", 6, name, block);
+}
+
+std::unique_ptr<StorageEngine> open_storage(const std::string& kind, const std::string& path, IoExecutor& io,
+                                            Encoding format) {
+    if (kind == "json") return std::make_unique<JsonFileStorage>(path, io, format);
+    if (kind == "memory") return std::make_unique<MemoryStorage>();
+    if (kind == "btree") return std::make_unique<BTreeStorage>(path, io);
+    throw std::runtime_error("unknown storage engine '" + kind + "' (json, memory or btree)");
+}
+
+// --- MEMORY ---
+
+std::optional<std::string> MemoryStorage::get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = records.find(key);
+    if (it == records.end()) return std::nullopt;
+    return it->second;
+}
+
+void MemoryStorage::scan(const std::string& from, const std::string& to, const Visit& visit) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto it = records.lower_bound(from); it != records.end() && it->first < to; ++it) {
+        if (!visit(it->first, it->second)) break;
+    }
+}
+
+void MemoryStorage::commit(StorageBatch batch, Completion done, asio::io_context*) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& w : batch) {
+            if (w.value) records[w.key] = std::move(*w.value);
+            else records.erase(w.key);
+        }
+    }
+    if (done) done(true, "");
+}
+
+std::map<std::string, uint64_t> MemoryStorage::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return {{"entries", records.size()}};
+}
+
+// --- JSON FILE ---
+
+struct JsonFileStorage::Document {
+    std::map<std::string, json> records;
+};
+
+JsonFileStorage::JsonFileStorage(const std::string& path, IoExecutor& io, Encoding format)
+    : path(path), io(io), format(format), doc(new Document()) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return;
+    std::stringstream image;
+    image << in.rdbuf();
+    json j;
+    try {
+        // Whatever format wrote it; the next commit rewrites it in ours
+        j = decode_object(image.str());
+    } catch (const json::exception& e) {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+    auto& records = doc->records;
+    if (j.contains("users")) {
+        for (auto& [key, val] : j["users"].items()) records[user_key(key)] = std::move(val);
+    }
+    if (j.contains("stats")) {
+        for (auto& [name, val] : j["stats"].items()) records[stats_key(name)] = std::move(val);
+    }
+    if (j.contains("logs")) {
+        // Older databases have no log ids: number them oldest first
+        long long next_id = 0;
+        for (const auto& l : j["logs"]) next_id = std::max(next_id, l.value("id", 0LL));
+        for (auto it = j["logs"].rbegin(); it != j["logs"].rend(); ++it) {
+            json l = std::move(*it);
+            if (l.value("id", 0LL) == 0) l["id"] = ++next_id;
+            records[log_key(l["id"].get<long long>())] = l;
+        }
+    }
+    if (j.contains("events")) {
+        for (auto& [key, stream] : j["events"].items()) {
+            for (size_t i = 0; i < stream.size(); i++) records[event_key(key, i)] = std::move(stream[i]);
+        }
+    }
+    if (j.contains("history")) {
+        for (auto& [name, blocks] : j["history"].items()) {
+            for (size_t i = 0; i < blocks.size(); i++) records[history_key(name, i)] = std::move(blocks[i]);
+        }
+    }
+}
+
+JsonFileStorage::~JsonFileStorage() = default;
+
+std::optional<std::string> JsonFileStorage::get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = doc->records.find(key);
+    if (it == doc->records.end()) return std::nullopt;
+    return encode(it->second, format);
+}
+
+void JsonFileStorage::scan(const std::string& from, const std::string& to, const Visit& visit) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto it = doc->records.lower_bound(from); it != doc->records.end() && it->first < to; ++it) {
+        if (!visit(it->first, encode(it->second, format))) break;
+    }
+}
+
+// The caller only pays for its own records. The file is rendered on the
+// I/O thread, once for every commit that queued up while the last write ran.
+void JsonFileStorage::commit(StorageBatch batch, Completion done, asio::io_context* reply_to) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& w : batch) {
+            if (w.value) doc->records[w.key] = decode_object(*w.value);
+            else doc->records.erase(w.key);
+        }
+    }
+    io.submit(path, [this](std::string& error) { return write_out(error); }, std::move(done), reply_to);
+}
+
+bool JsonFileStorage::write_out(std::string& error) {
+    std::string image;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        image = render();
+        bytes_written += image.size();
+    }
+    return IoExecutor::write_atomically(path, image, error);
+}
+
+std::map<std::string, uint64_t> JsonFileStorage::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return {{"entries", doc->records.size()}, {"bytes_written", bytes_written}};
+}
+
+// Caller holds mtx
+std::string JsonFileStorage::render() const {
+    json j;
+    j["users"] = json::object();
+    j["logs"] = json::array();
+    j["stats"] = json::object();
+    j["events"] = json::object();
+    j["history"] = json::object();
+    std::string id;
+    size_t seq;
+    for (auto const& [key, val] : doc->records) {
+        if (key.compare(0, 2, "u/") == 0) j["users"][key.substr(2)] = val;
+        else if (key.compare(0, 2, "s/") == 0) j["stats"][key.substr(2)] = val;
+        else if (key.compare(0, 2, "l/") == 0) j["logs"].push_back(val);
+        else if (parse_event_key(key, id, seq)) j["events"][id].push_back(val);
+        else if (parse_history_key(key, id, seq)) j["history"][id].push_back(val);
+    }
+    // The feed is stored newest first
+    std::reverse(j["logs"].begin(), j["logs"].end());
+    return format == Encoding::Json ? j.dump(4) : encode(j, format);
+}
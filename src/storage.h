@@ -0,0 +1,125 @@
+#pragma once
+#include "io_executor.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// --- STORAGE ENGINES ---
+// Persistence is a sorted key-value store. Every record is an object in
+// one of the codec.h encodings, under a key that says what it is:
+//   u/<user id>            user
+//   s/<display name>       analytics
+//   l/<log id, 16 digits>  activity entry, kept once it leaves the feed
+//   e/<user id>/<seq, 10>  event, in stream order
+//   h/<display name>/<block, 6>  debt history block (debt_history.h)
+// so a user's history is one range scan. Engines: "json" (the single db.json
+// file, rewritten after commits), "memory" (nothing on disk, for tests and
+// benchmarks) and "btree" (page file with point updates, see btree.h).
+
+enum class Encoding; // codec.h
+
+struct StorageWrite {
+    std::string key;
+    std::optional<std::string> value; // Nothing deletes the key
+};
+using StorageBatch = std::vector<StorageWrite>;
+
+class StorageEngine {
+public:
+    using Visit = std::function<bool(const std::string& key, const std::string& value)>; // false stops
+    using Completion = IoExecutor::Completion;
+
+    virtual ~StorageEngine() = default;
+    virtual const char* name() const = 0;
+
+    virtual std::optional<std::string> get(const std::string& key) = 0;
+    // Keys in [from, to), in order.
+    virtual void scan(const std::string& from, const std::string& to, const Visit& visit) = 0;
+    // All or nothing. Readable at once; on disk when `done` fires (on
+    // `reply_to` when given, like IoExecutor::write_file).
+    virtual void commit(StorageBatch batch, Completion done = {}, asio::io_context* reply_to = nullptr) = 0;
+    void put(const std::string& key, std::string value, Completion done = {});
+
+    // Engine counters for /api/maintenance (pages, cache hits, ...).
+    virtual std::map<std::string, uint64_t> stats() const { return {}; }
+
+    // Online backups read every record from a forked child (backup.h).
+    // prepare_fork() waits out any thread inside the engine and keeps the
+    // rest out until after_fork(), which runs in both processes. While disk
+    // writes are held, commits are still readable but nothing the child
+    // might read is changed on disk.
+    virtual void prepare_fork() {}
+    virtual void after_fork() {}
+    virtual void hold_disk_writes(bool held) { (void)held; }
+};
+
+std::string user_key(const std::string& id);
+std::string stats_key(const std::string& name);
+std::string log_key(long long id);
+std::string event_key(const std::string& user_id, size_t seq);
+std::string event_prefix(const std::string& user_id);
+// First key after every key that starts with `prefix`.
+std::string prefix_end(const std::string& prefix);
+// Splits an event key back into user id and sequence number.
+bool parse_event_key(const std::string& key, std::string& user_id, size_t& seq);
+std::string history_key(const std::string& name, size_t block);
+bool parse_history_key(const std::string& key, std::string& name, size_t& block);
+
+// kind: "json", "memory" or "btree". `format` is what the json engine
+// writes its file in. Throws std::runtime_error if the file can't be opened
+// or isn't what the engine expects.
+std::unique_ptr<StorageEngine> open_storage(const std::string& kind, const std::string& path, IoExecutor& io,
+                                            Encoding format);
+
+class MemoryStorage : public StorageEngine {
+public:
+    const char* name() const override { return "memory"; }
+    std::optional<std::string> get(const std::string& key) override;
+    void scan(const std::string& from, const std::string& to, const Visit& visit) override;
+    void commit(StorageBatch batch, Completion done = {}, asio::io_context* reply_to = nullptr) override;
+    std::map<std::string, uint64_t> stats() const override;
+    void prepare_fork() override { mtx.lock(); }
+    void after_fork() override { mtx.unlock(); }
+
+private:
+    mutable std::mutex mtx;
+    std::map<std::string, std::string> records;
+};
+
+// The original layout ({"users", "stats", "logs", "events"}, plus
+// "history"), so existing
+// databases open unchanged. Commits rewrite the whole file from the I/O
+// thread, coalesced: pretty-printed JSON, or a CBOR/MessagePack image of the
+// same document. Records come back out of get()/scan() in that format too.
+// Every feed entry ever logged stays in "logs" (search reads them back), so
+// the file and each rewrite grow with total activity; btree doesn't.
+class JsonFileStorage : public StorageEngine {
+public:
+    JsonFileStorage(const std::string& path, IoExecutor& io, Encoding format);
+    ~JsonFileStorage() override;
+
+    const char* name() const override { return "json"; }
+    std::optional<std::string> get(const std::string& key) override;
+    void scan(const std::string& from, const std::string& to, const Visit& visit) override;
+    void commit(StorageBatch batch, Completion done = {}, asio::io_context* reply_to = nullptr) override;
+    std::map<std::string, uint64_t> stats() const override;
+    void prepare_fork() override { mtx.lock(); }
+    void after_fork() override { mtx.unlock(); }
+
+private:
+    struct Document;
+    std::string render() const;
+    bool write_out(std::string& error);
+
+    std::string path;
+    IoExecutor& io;
+    Encoding format;
+    mutable std::mutex mtx;
+    std::unique_ptr<Document> doc;
+    uint64_t bytes_written = 0;
+};
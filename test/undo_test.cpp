@@ -0,0 +1,52 @@
+// Engine checks with no server: `make check` builds and runs them, and
+// exits non-zero at the first one that fails.
+#include "engine.h"
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            std::exit(1);                                                     \
+        }                                                                     \
+    } while (0)
+
+static User member(const std::string& name) {
+    return User(name, "pw", "Snacks", 2, "Gym", 3, "Read", 5);
+}
+
+// Undo has to take its vice back out of analytics even after more than
+// FEED_SIZE entries have pushed it out of the feed
+static void undo_after_the_feed_moved_on() {
+    Engine engine;
+    User& amy = engine.add_user(member("Amy"));
+    engine.add_user(member("Bob"));
+    CHECK(engine.perform_virtue(amy, 1));
+    UserStats before = *engine.analytics.find("Amy");
+    long long week = week_index(civil_day(amy.last_update, *amy.zone));
+
+    engine.add_vice(amy);
+    long long vice_id = engine.next_log_id;
+    CHECK(engine.analytics.week("Amy", week).vices == 1);
+    for (size_t i = 0; i < FEED_SIZE + 20; i++) engine.add_log("Bob", "achievement", "noise", "#000", 0, 0);
+    for (const ActivityLog* log : engine.activity_feed.snapshot()) CHECK(log->id != vice_id);
+
+    CHECK(engine.perform_undo(amy));
+    const UserStats& after = *engine.analytics.find("Amy");
+    WindowCounts w = engine.analytics.week("Amy", week);
+    CHECK(w.vices == 0 && w.virtue1 == 1);
+    CHECK(after.debt_sum == before.debt_sum);
+    CHECK(after.debt_samples == before.debt_samples);
+    CHECK(after.in_debt_episode == before.in_debt_episode);
+    CHECK(after.episode_start == before.episode_start);
+    CHECK(after.last_ts == before.last_ts);
+    CHECK(after.last_snapshot == before.last_snapshot);
+    CHECK(engine.debt_history["Amy"].size() == 1);
+}
+
+int main() {
+    undo_after_the_feed_moved_on();
+    std::printf("ok\n");
+    return 0;
+}